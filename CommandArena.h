@@ -0,0 +1,509 @@
+#ifndef COMMAND_ARENA_H_2026_10_19
+#define COMMAND_ARENA_H_2026_10_19
+
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include "CommonMacro.h"
+
+BEGIN_NAMESPACE(NSVirgo)
+
+/////////////////////////////////////////////////////////////////////////////////
+
+typedef std::string::size_type size_type;   /**< typedef size_type. */
+
+/** @class CommandRecord
+ *  @brief Storage of one queued command: an interned prefix and the rest.
+ *
+ *  Records are recycled by CommandArena, the suffix keeps its capacity, so
+ *  that storing a command does not allocate once the arena is warm.
+ */
+struct CommandRecord
+{
+    const std::string* prefix;  /**< Interned prefix, never NULL. */
+    std::string suffix;         /**< The rest of the command. */
+    unsigned flags;             /**< Flags given by the owner, e.g. directive kind. */
+    uint64_t stamp;             /**< Time stamp given by the owner, e.g. enqueue time. */
+    uint32_t key;               /**< Locality key given by the owner, 0 for none. */
+    int priority;               /**< Priority given by the owner, higher first. */
+    uint32_t spec;              /**< Index of an execution spec given by the owner, 0 for none. */
+    uint64_t item;              /**< Place of the command among those of its spec, given by the owner. */
+    CommandRecord* next;        /**< Next free record. */
+};
+
+class CommandArena;
+
+/** @class CommandHandle
+ *  @brief Move-only owner of a CommandRecord, returns it to the arena when destroyed.
+ */
+class CommandHandle
+{
+public:
+    CommandHandle() : m_pArena(NULL), m_pRecord(NULL) {}
+    CommandHandle(CommandArena* arena, CommandRecord* record) : m_pArena(arena), m_pRecord(record) {}
+    CommandHandle(CommandHandle&& other) : m_pArena(other.m_pArena), m_pRecord(other.m_pRecord)
+    {
+        other.m_pRecord = NULL;
+    }
+    CommandHandle& operator=(CommandHandle&& other)
+    {
+        if (this != &other)
+        {
+            Reset();
+            m_pArena = other.m_pArena;
+            m_pRecord = other.m_pRecord;
+            other.m_pRecord = NULL;
+        }
+        return *this;
+    }
+    CommandHandle(const CommandHandle&) = delete;
+    CommandHandle& operator=(const CommandHandle&) = delete;
+    ~CommandHandle()
+    {
+        Reset();
+    }
+
+    /** @brief Release the record to the arena. */
+    void Reset();
+
+    bool Empty() const
+    {
+        return m_pRecord == NULL;
+    }
+
+    /** @brief The flags given when created. */
+    unsigned Flags() const
+    {
+        assert(m_pRecord != NULL);
+        return m_pRecord->flags;
+    }
+
+    /** @brief The time stamp given when created. */
+    uint64_t Stamp() const
+    {
+        assert(m_pRecord != NULL);
+        return m_pRecord->stamp;
+    }
+
+    /** @brief The locality key given when created. */
+    uint32_t Key() const
+    {
+        assert(m_pRecord != NULL);
+        return m_pRecord->key;
+    }
+
+    /** @brief The priority given when created. */
+    int Priority() const
+    {
+        assert(m_pRecord != NULL);
+        return m_pRecord->priority;
+    }
+
+    /** @brief The execution spec index given when created. */
+    uint32_t Spec() const
+    {
+        assert(m_pRecord != NULL);
+        return m_pRecord->spec;
+    }
+
+    /** @brief The item given when created. */
+    uint64_t Item() const
+    {
+        assert(m_pRecord != NULL);
+        return m_pRecord->item;
+    }
+
+    /** @brief The length of the whole command. */
+    size_type Size() const
+    {
+        assert(m_pRecord != NULL);
+        return m_pRecord->prefix->size() + m_pRecord->suffix.size();
+    }
+
+    /** @brief Copy the whole command to str, reusing its capacity. */
+    void Text(std::string& str) const
+    {
+        assert(m_pRecord != NULL);
+        str.assign(*m_pRecord->prefix);
+        str.append(m_pRecord->suffix);
+    }
+
+private:
+    CommandArena* m_pArena;
+    CommandRecord* m_pRecord;
+};
+
+/** @class CommandArena
+ *  @brief Thread-safe pool of command records with interned command prefixes.
+ *
+ *  The prefix of a command is its first word with the following blank, e.g.
+ *  the program path, which is shared by most lines of a generated command
+ *  file. Records are allocated in chunks and recycled through a free list.
+ *
+ *  @date 2026-10-19
+ */
+class CommandArena
+{
+public:
+    enum { CHUNK_SIZE = 256, MAX_PREFIX = 4096, MAX_PREFIX_LEN = 256 };
+
+    CommandArena() : m_pFree(NULL), m_vSlot(2 * MAX_PREFIX, 0)
+    {
+        pthread_mutex_init(&m_Mutex, NULL);
+        m_vPrefix.reserve(MAX_PREFIX);
+        m_vPrefix.push_back(new std::string());     //  id 0: no prefix
+    }
+    ~CommandArena()
+    {
+        for (size_type i=0; i<m_vChunk.size(); ++i)
+        {
+            delete[] m_vChunk[i];
+        }
+        for (size_type i=0; i<m_vPrefix.size(); ++i)
+        {
+            delete m_vPrefix[i];
+        }
+        pthread_mutex_destroy(&m_Mutex);
+    }
+    CommandArena(const CommandArena&) = delete;
+    CommandArena& operator=(const CommandArena&) = delete;
+
+    /** @brief Store a command.
+     *
+     *  @param[in]  cmd The command text.
+     *  @param[in]  len The length of command text.
+     *  @param[in]  flags   The flags of the command.
+     *  @param[in]  stamp   The time stamp of the command.
+     *  @param[in]  key The locality key of the command.
+     *  @param[in]  priority    The priority of the command.
+     *  @param[in]  spec    The execution spec index of the command.
+     *  @param[in]  item    The place of the command among those of its spec.
+     *  @return Return the handle owning the stored command.
+     */
+    CommandHandle Create(const char* cmd, size_type len, unsigned flags = 0, uint64_t stamp = 0, uint32_t key = 0, int priority = 0,
+        uint32_t spec = 0, uint64_t item = 0)
+    {
+        //  prefix: first word and the blank after it
+        size_type plen = 0;
+        const char* sp = static_cast<const char*>(memchr(cmd, ' ', len < MAX_PREFIX_LEN ? len : static_cast<size_type>(MAX_PREFIX_LEN)));
+        if (sp != NULL)
+        {
+            plen = sp - cmd + 1;
+        }
+        pthread_mutex_lock(&m_Mutex);
+        if (m_pFree == NULL)
+        {
+            Grow();
+        }
+        CommandRecord* record = m_pFree;
+        m_pFree = record->next;
+        record->prefix = Intern(cmd, plen);
+        pthread_mutex_unlock(&m_Mutex);
+        plen = record->prefix->size();
+        record->suffix.assign(cmd + plen, len - plen);
+        record->flags = flags;
+        record->stamp = stamp;
+        record->key = key;
+        record->priority = priority;
+        record->spec = spec;
+        record->item = item;
+        record->next = NULL;
+        return CommandHandle(this, record);
+    }
+
+    /** @brief Return a record to the free list. */
+    void Release(CommandRecord* record)
+    {
+        pthread_mutex_lock(&m_Mutex);
+        record->next = m_pFree;
+        m_pFree = record;
+        pthread_mutex_unlock(&m_Mutex);
+    }
+
+    /** @brief The number of distinct interned prefixes. */
+    size_type PrefixNum() const
+    {
+        return m_vPrefix.size() - 1;
+    }
+
+    /** @brief The number of allocated records. */
+    size_type RecordNum() const
+    {
+        return m_vChunk.size() * CHUNK_SIZE;
+    }
+
+private:
+    void Grow()
+    {
+        CommandRecord* chunk = new CommandRecord[CHUNK_SIZE];
+        m_vChunk.push_back(chunk);
+        for (size_type i=0; i<CHUNK_SIZE; ++i)
+        {
+            chunk[i].next = m_pFree;
+            m_pFree = &chunk[i];
+        }
+    }
+
+    //  FNV-1a
+    static uint32_t Hash(const char* str, size_type len)
+    {
+        uint32_t h = 2166136261u;
+        for (size_type i=0; i<len; ++i)
+        {
+            h = (h ^ static_cast<unsigned char>(str[i])) * 16777619u;
+        }
+        return h;
+    }
+
+    //  Return the interned prefix, or the empty one if the table is full.
+    const std::string* Intern(const char* str, size_type len)
+    {
+        if (len == 0)
+        {
+            return m_vPrefix[0];
+        }
+        size_type mask = m_vSlot.size() - 1;
+        for (size_type i=Hash(str, len) & mask; ; i=(i + 1) & mask)
+        {
+            uint32_t id = m_vSlot[i];
+            if (id == 0)
+            {
+                if (m_vPrefix.size() > MAX_PREFIX)
+                {
+                    return m_vPrefix[0];
+                }
+                m_vSlot[i] = m_vPrefix.size();
+                m_vPrefix.push_back(new std::string(str, len));
+                return m_vPrefix.back();
+            }
+            const std::string& prefix = *m_vPrefix[id];
+            if (prefix.size() == len && memcmp(prefix.data(), str, len) == 0)
+            {
+                return &prefix;
+            }
+        }
+    }
+
+    pthread_mutex_t m_Mutex;
+    CommandRecord* m_pFree;
+    std::vector<CommandRecord*> m_vChunk;
+    std::vector<std::string*> m_vPrefix;    //  stable addresses, read without lock
+    std::vector<uint32_t> m_vSlot;          //  open addressing, prefix id or 0
+};
+
+inline void CommandHandle::Reset()
+{
+    if (m_pRecord != NULL)
+    {
+        m_pArena->Release(m_pRecord);
+        m_pRecord = NULL;
+    }
+}
+
+/** @class CommandRing
+ *  @brief FIFO of command handles in a growable ring buffer.
+ *
+ *  Unlike std::deque it does not allocate while pushing and popping, only
+ *  when it has to grow beyond the largest size seen so far.
+ */
+class CommandRing
+{
+public:
+    CommandRing() : m_Head(0), m_Size(0)
+    {
+        m_vSlot.resize(64);
+    }
+
+    bool empty() const
+    {
+        return m_Size == 0;
+    }
+    size_type size() const
+    {
+        return m_Size;
+    }
+    const CommandHandle& front() const
+    {
+        assert(m_Size > 0);
+        return m_vSlot[m_Head];
+    }
+    const CommandHandle& at(size_type i) const
+    {
+        assert(i < m_Size);
+        return m_vSlot[(m_Head + i) % m_vSlot.size()];
+    }
+    void push(CommandHandle&& handle)
+    {
+        if (m_Size == m_vSlot.size())
+        {
+            Grow();
+        }
+        m_vSlot[(m_Head + m_Size) % m_vSlot.size()] = std::move(handle);
+        ++m_Size;
+    }
+    CommandHandle pop()
+    {
+        assert(m_Size > 0);
+        CommandHandle handle(std::move(m_vSlot[m_Head]));
+        m_Head = (m_Head + 1) % m_vSlot.size();
+        --m_Size;
+        return handle;
+    }
+    /** @brief Remove the i-th handle, the ones before it move by one, O(i). */
+    CommandHandle take(size_type i)
+    {
+        assert(i < m_Size);
+        const size_type n = m_vSlot.size();
+        CommandHandle handle(std::move(m_vSlot[(m_Head + i) % n]));
+        for (; i>0; --i)
+        {
+            m_vSlot[(m_Head + i) % n] = std::move(m_vSlot[(m_Head + i - 1) % n]);
+        }
+        m_Head = (m_Head + 1) % n;
+        --m_Size;
+        return handle;
+    }
+
+private:
+    void Grow()
+    {
+        std::vector<CommandHandle> slot(m_vSlot.size() * 2);
+        for (size_type i=0; i<m_Size; ++i)
+        {
+            slot[i] = std::move(m_vSlot[(m_Head + i) % m_vSlot.size()]);
+        }
+        m_vSlot.swap(slot);
+        m_Head = 0;
+    }
+
+    std::vector<CommandHandle> m_vSlot;
+    size_type m_Head;
+    size_type m_Size;
+};
+
+/** @class CommandHeap
+ *  @brief Priority queue of command handles, a binary heap.
+ *
+ *  The handle with the highest score is taken first, handles of equal
+ *  score in the order pushed. Pushing and taking are O(log n), and do not
+ *  allocate unless it grows beyond the largest size seen so far.
+ */
+class CommandHeap
+{
+public:
+    CommandHeap() : m_Seq(0) {}
+
+    bool empty() const
+    {
+        return m_vEntry.empty();
+    }
+    size_type size() const
+    {
+        return m_vEntry.size();
+    }
+    /** @brief The i-th handle in heap order, 0 is the top. */
+    const CommandHandle& at(size_type i) const
+    {
+        assert(i < m_vEntry.size());
+        return m_vEntry[i].handle;
+    }
+    const CommandHandle& top() const
+    {
+        return at(0);
+    }
+    void push(CommandHandle&& handle, int64_t score)
+    {
+        m_vEntry.push_back(Entry());
+        Entry& entry = m_vEntry.back();
+        entry.score = score;
+        entry.seq = m_Seq++;
+        entry.handle = std::move(handle);
+        SiftUp(m_vEntry.size() - 1);
+    }
+    CommandHandle pop()
+    {
+        return take(0);
+    }
+    /** @brief Remove the i-th handle in heap order. */
+    CommandHandle take(size_type i)
+    {
+        assert(i < m_vEntry.size());
+        CommandHandle handle(std::move(m_vEntry[i].handle));
+        const size_type last = m_vEntry.size() - 1;
+        if (i != last)
+        {
+            Move(i, last);
+        }
+        m_vEntry.pop_back();
+        if (i < m_vEntry.size())
+        {
+            SiftDown(SiftUp(i));
+        }
+        return handle;
+    }
+
+private:
+    struct Entry
+    {
+        int64_t score;
+        uint64_t seq;           //  push order, for FIFO among equal scores
+        CommandHandle handle;
+    };
+
+    bool Before(const Entry& a, const Entry& b) const
+    {
+        return a.score > b.score || (a.score == b.score && a.seq < b.seq);
+    }
+
+    void Move(size_type to, size_type from)
+    {
+        m_vEntry[to] = std::move(m_vEntry[from]);
+    }
+
+    size_type SiftUp(size_type i)
+    {
+        while (i > 0 && Before(m_vEntry[i], m_vEntry[(i - 1) / 2]))
+        {
+            std::swap(m_vEntry[i], m_vEntry[(i - 1) / 2]);
+            i = (i - 1) / 2;
+        }
+        return i;
+    }
+
+    void SiftDown(size_type i)
+    {
+        const size_type n = m_vEntry.size();
+        while (true)
+        {
+            size_type best = i;
+            size_type l = 2 * i + 1;
+            if (l < n && Before(m_vEntry[l], m_vEntry[best]))
+            {
+                best = l;
+            }
+            if (l + 1 < n && Before(m_vEntry[l + 1], m_vEntry[best]))
+            {
+                best = l + 1;
+            }
+            if (best == i)
+            {
+                return;
+            }
+            std::swap(m_vEntry[i], m_vEntry[best]);
+            i = best;
+        }
+    }
+
+    std::vector<Entry> m_vEntry;
+    uint64_t m_Seq;
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+
+END_NAMESPACE(NSVirgo)
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef COMPILED_FILE_H_2026_10_19
+#define COMPILED_FILE_H_2026_10_19
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "CommonMacro.h"
+
+BEGIN_NAMESPACE(NSVirgo)
+
+/////////////////////////////////////////////////////////////////////////////////
+
+/** @class CompiledFile
+ *  @brief A command file compiled to typed records, read from a memory map.
+ *
+ *  Layout, in native byte order:
+ *      Header                      magic, sizes, and a checksum of itself
+ *      Record...                   12 bytes each, then the text, a NUL, and
+ *                                  padding to 4 bytes
+ *      uint64_t commands[]         offset of the first record of each command,
+ *                                  i.e. of its annotations and loops if any
+ *      uint64_t directives[]       offset of each other directive but #sync
+ *  Each record has its own checksum, verified when it is read, so opening
+ *  and seeking take constant time whatever the size of the file. Not
+ *  thread-safe.
+ *
+ *  @date 2026-10-19
+ */
+class CompiledFile
+{
+public:
+    typedef std::string::size_type size_type;
+
+    enum Type { COMMAND = 1, ANNOTATION, LOOP, SYNC, EXIT, DIRECTIVE };
+    enum { PRIORITY = 1, IDEMPOTENT = 2 };     //  flags of ANNOTATION
+
+    /** @brief A record, text points into the map and is NUL terminated. */
+    struct Record
+    {
+        Type type;
+        unsigned flags;
+        int priority;
+        const char* text;
+        size_type size;
+    };
+
+    CompiledFile() : m_Data(NULL), m_Size(0), m_Pos(0), m_End(0), m_Commands(0), m_Directives(0) {}
+
+    ~CompiledFile()
+    {
+        if (m_Data != NULL)
+        {
+            munmap(const_cast<char*>(m_Data), m_Size);
+        }
+    }
+
+    /** @brief Whether path names a compiled file, by its ".mrc" extension. */
+    static bool Named(const std::string& path)
+    {
+        return path.size() > 4 && path.compare(path.size() - 4, 4, ".mrc") == 0;
+    }
+
+    /** @brief Map the file at path, return false if it is not a valid compiled file. */
+    bool Open(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(Header))
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return false;
+        }
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+        m_Data = static_cast<const char*>(data);
+        m_Size = st.st_size;
+        Header header;
+        memcpy(&header, m_Data, sizeof(header));
+        uint32_t sum = header.checksum;
+        header.checksum = 0;
+        if (memcmp(header.magic, Magic(), sizeof(header.magic)) != 0 || header.version != VERSION
+            || Checksum(&header, sizeof(header), FNV_BASIS) != sum || header.records_end < sizeof(Header)
+            || header.records_end % 8 != 0 || header.records_end > m_Size
+            || (m_Size - header.records_end) / 8 != header.commands + header.directives
+            || (m_Size - header.records_end) % 8 != 0)
+        {
+            return false;
+        }
+        m_Pos = sizeof(Header);
+        m_End = header.records_end;
+        m_Commands = header.commands;
+        m_Directives = header.directives;
+        return true;
+    }
+
+    /** @brief The number of commands, a template counts as one. */
+    uint64_t Commands() const
+    {
+        return m_Commands;
+    }
+
+    /** @brief Read the next record, return false at the end, or if corrupt() then. */
+    bool Next(Record& rec)
+    {
+        if (m_Pos >= m_End)
+        {
+            return false;
+        }
+        RecordHeader head;
+        if (m_End - m_Pos < sizeof(head))
+        {
+            m_Pos = CORRUPT;
+            return false;
+        }
+        memcpy(&head, m_Data + m_Pos, sizeof(head));
+        uint32_t sum = head.checksum;
+        head.checksum = 0;
+        uint64_t text = m_Pos + sizeof(head);
+        if (head.size >= m_End - text || head.type < COMMAND || head.type > DIRECTIVE
+            || Checksum(m_Data + text, head.size, Checksum(&head, sizeof(head), FNV_BASIS)) != sum)
+        {
+            m_Pos = CORRUPT;
+            return false;
+        }
+        rec.type = static_cast<Type>(head.type);
+        rec.flags = head.flags;
+        rec.priority = head.priority;
+        rec.text = m_Data + text;
+        rec.size = head.size;
+        m_Pos = Align(text + head.size + 1, 4);
+        return true;
+    }
+
+    /** @brief Whether a corrupt record was found. */
+    bool Corrupt() const
+    {
+        return m_Pos == CORRUPT;
+    }
+
+    /** @brief Move to command index, or to the end if there are fewer, and
+     *         return the directives before it but #sync, in order.
+     *
+     *  @return Return false if the file is corrupt.
+     */
+    bool Seek(uint64_t index, std::vector<Record>& directives)
+    {
+        directives.clear();
+        uint64_t target = m_End;
+        if (index < m_Commands)
+        {
+            target = Offset(index);
+        }
+        if (target < sizeof(Header) || target > m_End || target % 4 != 0)
+        {
+            m_Pos = CORRUPT;
+            return false;
+        }
+        Record rec;
+        for (uint64_t k=0; k<m_Directives; ++k)
+        {
+            m_Pos = Offset(m_Commands + k);
+            if (m_Pos >= target)
+            {
+                break;
+            }
+            if (!Next(rec))
+            {
+                m_Pos = CORRUPT;
+                return false;
+            }
+            directives.push_back(rec);
+        }
+        m_Pos = target;
+        return true;
+    }
+
+    /** @brief Writes a compiled file, records first and the index last. */
+    class Writer
+    {
+    public:
+        Writer() : m_Fp(NULL), m_Offset(0), m_Group(false), m_GroupStart(0) {}
+
+        ~Writer()
+        {
+            if (m_Fp != NULL)
+            {
+                fclose(m_Fp);
+            }
+        }
+
+        /** @brief Create the file at path, return false on error, with errno set. */
+        bool Open(const std::string& path)
+        {
+            m_Fp = fopen(path.c_str(), "w");
+            if (m_Fp == NULL)
+            {
+                return false;
+            }
+            Header header;
+            memset(&header, 0, sizeof(header));
+            m_Offset = sizeof(header);
+            return fwrite(&header, sizeof(header), 1, m_Fp) == 1;
+        }
+
+        /** @brief Append a record, return false on error. */
+        bool Add(Type type, const char* text, size_type size, unsigned flags = 0, int priority = 0)
+        {
+            if (type == ANNOTATION || type == LOOP)
+            {
+                //  they belong to the next command
+                if (!m_Group)
+                {
+                    m_Group = true;
+                    m_GroupStart = m_Offset;
+                }
+            }
+            else if (type == COMMAND)
+            {
+                m_vCommand.push_back(m_Group ? m_GroupStart : m_Offset);
+                m_Group = false;
+            }
+            else if (type != SYNC)
+            {
+                m_vDirective.push_back(m_Offset);
+            }
+            RecordHeader head;
+            head.size = size;
+            head.type = type;
+            head.flags = flags;
+            head.priority = priority;
+            head.checksum = 0;
+            head.checksum = Checksum(text, size, Checksum(&head, sizeof(head), FNV_BASIS));
+            static const char pad[8] = {0};
+            uint64_t end = Align(m_Offset + sizeof(head) + size + 1, 4);
+            size_t tail = end - m_Offset - sizeof(head) - size;
+            if (fwrite(&head, sizeof(head), 1, m_Fp) != 1 || fwrite(text, 1, size, m_Fp) != size
+                || fwrite(pad, 1, tail, m_Fp) != tail)
+            {
+                return false;
+            }
+            m_Offset = end;
+            return true;
+        }
+
+        /** @brief Write the index and the header, return false on error. */
+        bool Close(uint64_t source_size)
+        {
+            static const char pad[8] = {0};
+            Header header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, Magic(), sizeof(header.magic));
+            header.version = VERSION;
+            header.records_end = Align(m_Offset, 8);
+            header.commands = m_vCommand.size();
+            header.directives = m_vDirective.size();
+            header.source_size = source_size;
+            header.checksum = Checksum(&header, sizeof(header), FNV_BASIS);
+            size_t tail = header.records_end - m_Offset;
+            bool ok = fwrite(pad, 1, tail, m_Fp) == tail
+                && fwrite(m_vCommand.data(), 8, m_vCommand.size(), m_Fp) == m_vCommand.size()
+                && fwrite(m_vDirective.data(), 8, m_vDirective.size(), m_Fp) == m_vDirective.size()
+                && fseek(m_Fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, m_Fp) == 1;
+            ok = fclose(m_Fp) == 0 && ok;
+            m_Fp = NULL;
+            return ok;
+        }
+
+        /** @brief The number of commands written. */
+        uint64_t Commands() const
+        {
+            return m_vCommand.size();
+        }
+
+    private:
+        FILE* m_Fp;
+        uint64_t m_Offset;
+        bool m_Group;                       //  annotations or loops wait for their command
+        uint64_t m_GroupStart;
+        std::vector<uint64_t> m_vCommand;
+        std::vector<uint64_t> m_vDirective;
+    };
+
+private:
+    static const uint32_t VERSION = 1;
+    static const uint64_t CORRUPT = ~0ull;
+    static const uint32_t FNV_BASIS = 2166136261u;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t checksum;                  //  of the header, with this field 0
+        uint64_t records_end;               //  the index follows
+        uint64_t commands;
+        uint64_t directives;
+        uint64_t source_size;               //  of the text, for information
+    };
+
+    struct RecordHeader
+    {
+        uint32_t size;                      //  of the text
+        uint8_t type;
+        uint8_t flags;
+        int16_t priority;
+        uint32_t checksum;                  //  of the record, with this field 0
+    };
+
+    static const char* Magic()
+    {
+        return "MULTIRUN";
+    }
+
+    //  FNV-1a, continued from sum.
+    static uint32_t Checksum(const void* data, size_type size, uint32_t sum)
+    {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_type i=0; i<size; ++i)
+        {
+            sum = (sum ^ p[i]) * 16777619u;
+        }
+        return sum;
+    }
+
+    static uint64_t Align(uint64_t offset, uint64_t align)
+    {
+        return (offset + align - 1) / align * align;
+    }
+
+    uint64_t Offset(uint64_t entry) const
+    {
+        uint64_t offset;
+        memcpy(&offset, m_Data + m_End + entry * 8, sizeof(offset));
+        return offset;
+    }
+
+    const char* m_Data;
+    uint64_t m_Size;
+    uint64_t m_Pos;                         //  of the next record, CORRUPT after an error
+    uint64_t m_End;                         //  of the records
+    uint64_t m_Commands;
+    uint64_t m_Directives;
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+
+END_NAMESPACE(NSVirgo)
+
+#endif
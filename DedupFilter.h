@@ -0,0 +1,146 @@
+#ifndef DEDUP_FILTER_H_2026_10_19
+#define DEDUP_FILTER_H_2026_10_19
+
+#include <cassert>
+#include <cmath>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <stdint.h>
+#include "CommonMacro.h"
+
+BEGIN_NAMESPACE(NSVirgo)
+
+/////////////////////////////////////////////////////////////////////////////////
+
+/** @class DedupFilter
+ *  @brief Set of seen strings in bounded memory, for skipping duplicates of a stream.
+ *
+ *  Strings are kept exactly in a hash set until it outgrows half of the
+ *  memory budget, then they move to a Bloom filter of the rest of it, so
+ *  that both together stay within the budget while moving. From then
+ *  on the filter may report a new string as seen with the probability given
+ *  by FalsePositiveRate(), but never misses a duplicate. Not thread-safe.
+ *
+ *  @date 2026-10-19
+ */
+class DedupFilter
+{
+public:
+    typedef std::string::size_type size_type;
+
+    enum { HASH_NUM = 7, NODE_OVERHEAD = 64 };
+
+    explicit DedupFilter(size_type budget) : m_Budget(budget < 64 ? 64 : budget), m_Bytes(0), m_Num(0), m_BitsSet(0) {}
+
+    /** @brief Insert str, return whether it was (probably) seen before. */
+    bool Seen(const std::string& str)
+    {
+        if (m_vBit.empty())
+        {
+            if (!m_Exact.insert(str).second)
+            {
+                return true;
+            }
+            ++m_Num;
+            m_Bytes += str.capacity() + NODE_OVERHEAD;
+            if (m_Bytes > m_Budget / 2)
+            {
+                ToBloom();
+            }
+            return false;
+        }
+        if (Insert(str.data(), str.size()))
+        {
+            return true;
+        }
+        ++m_Num;
+        return false;
+    }
+
+    /** @brief Whether strings are kept exactly, i.e. no false positive. */
+    bool Exact() const
+    {
+        return m_vBit.empty();
+    }
+
+    /** @brief The number of distinct strings inserted. */
+    size_type Num() const
+    {
+        return m_Num;
+    }
+
+    /** @brief The memory used by the set or the Bloom filter in bytes. */
+    size_type Bytes() const
+    {
+        return Exact() ? m_Bytes : m_vBit.size() * sizeof(uint64_t);
+    }
+
+    /** @brief The probability that a new string is reported as seen now. */
+    double FalsePositiveRate() const
+    {
+        if (Exact())
+        {
+            return 0;
+        }
+        return std::pow(static_cast<double>(m_BitsSet) / (m_vBit.size() * 64), static_cast<double>(HASH_NUM));
+    }
+
+private:
+    //  Move the exact set to a Bloom filter of the other half of the budget.
+    void ToBloom()
+    {
+        m_vBit.assign((m_Budget - m_Budget / 2) / sizeof(uint64_t), 0);
+        for (std::unordered_set<std::string>::const_iterator it=m_Exact.begin(); it!=m_Exact.end(); ++it)
+        {
+            Insert(it->data(), it->size());
+        }
+        std::unordered_set<std::string>().swap(m_Exact);
+        m_Bytes = 0;
+    }
+
+    //  FNV-1a, 64 bits
+    static uint64_t Hash(const char* str, size_type len)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (size_type i=0; i<len; ++i)
+        {
+            h = (h ^ static_cast<unsigned char>(str[i])) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    //  Set the bits of str by double hashing, return whether all were set.
+    bool Insert(const char* str, size_type len)
+    {
+        uint64_t h1 = Hash(str, len);
+        uint64_t h2 = ((h1 >> 33) ^ (h1 * 0x9e3779b97f4a7c15ull)) | 1;
+        uint64_t bits = m_vBit.size() * 64;
+        bool seen = true;
+        for (size_type k=0; k<HASH_NUM; ++k)
+        {
+            uint64_t bit = (h1 + k * h2) % bits;
+            uint64_t mask = 1ull << (bit & 63);
+            if ((m_vBit[bit >> 6] & mask) == 0)
+            {
+                m_vBit[bit >> 6] |= mask;
+                ++m_BitsSet;
+                seen = false;
+            }
+        }
+        return seen;
+    }
+
+    size_type m_Budget;
+    size_type m_Bytes;                          //  estimated size of m_Exact
+    size_type m_Num;
+    size_type m_BitsSet;
+    std::unordered_set<std::string> m_Exact;
+    std::vector<uint64_t> m_vBit;               //  empty while exact
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+
+END_NAMESPACE(NSVirgo)
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef FILE_BUILTIN_H_2026_10_19
+#define FILE_BUILTIN_H_2026_10_19
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "CommonMacro.h"
+
+BEGIN_NAMESPACE(NSVirgo)
+
+/////////////////////////////////////////////////////////////////////////////////
+
+/** @class FileBuiltin
+ *  @brief In-process versions of simple rm, mkdir, mv, cp and touch commands.
+ *
+ *  Each one is a single system call or two, much cheaper than starting a
+ *  shell and a coreutils process. Only these forms are recognized:
+ *      rm [-f] [--] FILE...
+ *      mkdir [-p] [--] DIR...
+ *      mv SRC DST
+ *      cp SRC DST
+ *      touch [--] FILE...
+ *  where DST may be a directory, and no FILE or DIR starts with '-' unless
+ *  after "--", as coreutils would take it as an option. Errors are reported like coreutils, with
+ *  exit status 1. Anything else, e.g. other options, a directory to cp, or
+ *  mv across file systems, is not handled and should be run as usual.
+ *  Thread-safe as far as the file system is.
+ *
+ *  @date 2026-10-19
+ */
+class FileBuiltin
+{
+public:
+    /** @brief Run argv, a NULL terminated argument list, if it is a builtin form.
+     *
+     *  @param[in]  argv    The arguments, argv[0] is the program.
+     *  @param[out] status  The wait status as by waitpid, if handled.
+     *  @return Return whether it was handled.
+     */
+    static bool Run(char* const* argv, int& status)
+    {
+        const char* prog = argv[0];
+        int argc = 0;
+        while (argv[argc] != NULL)
+        {
+            ++argc;
+        }
+        int code = -1;
+        if (strcmp(prog, "rm") == 0)
+        {
+            code = Remove(argc, argv);
+        }
+        else if (strcmp(prog, "mkdir") == 0)
+        {
+            code = MakeDir(argc, argv);
+        }
+        else if (strcmp(prog, "mv") == 0 || strcmp(prog, "cp") == 0)
+        {
+            code = argc == 3 && argv[1][0] != '-' && argv[2][0] != '-' ? MoveCopy(prog[0] == 'm', argv[1], argv[2]) : -1;
+        }
+        else if (strcmp(prog, "touch") == 0)
+        {
+            code = Touch(argc, argv);
+        }
+        if (code < 0)
+        {
+            return false;
+        }
+        status = W_EXITCODE(code, 0);
+        return true;
+    }
+
+    /** @brief Copy the rest of file in to out, in kernel by copy_file_range.
+     *
+     *  Falls back to read and write where copy_file_range is not supported.
+     *  @return Return false on error, with errno set.
+     */
+    static bool Copy(int in, int out)
+    {
+        ssize_t n;
+        while ((n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0)) > 0)
+        {
+        }
+        if (n == 0)
+        {
+            return true;
+        }
+        if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)
+        {
+            return false;
+        }
+        char buf[65536];
+        while ((n = read(in, buf, sizeof(buf))) > 0)
+        {
+            for (ssize_t done=0; done<n; )
+            {
+                ssize_t w = write(out, buf + done, n - done);
+                if (w < 0)
+                {
+                    return false;
+                }
+                done += w;
+            }
+        }
+        return n == 0;
+    }
+
+private:
+    //  Write "prog: what 'file': error" to stderr in one call, return 1.
+    static int Error(const char* prog, const char* what, const char* file, int err)
+    {
+        std::string msg = prog;
+        msg += ": ";
+        msg += what;
+        msg += " '";
+        msg += file;
+        msg += "': ";
+        msg += strerror(err);
+        msg += '\n';
+        ssize_t n = write(STDERR_FILENO, msg.data(), msg.size());
+        (void)n;
+        return 1;
+    }
+
+    //  Index of the first operand after the option opt and an optional "--",
+    //  -1 if an other option is given. As coreutils permute the arguments,
+    //  an operand starting with '-' not after "--" is taken as an option.
+    static int Operands(int argc, char* const* argv, const char* opt, bool& given)
+    {
+        given = false;
+        int i = 1;
+        for (; i<argc && argv[i][0] == '-'; ++i)
+        {
+            if (strcmp(argv[i], "--") == 0)
+            {
+                return i + 1;
+            }
+            if (opt == NULL || strcmp(argv[i], opt) != 0)
+            {
+                return -1;
+            }
+            given = true;
+        }
+        for (int k=i; k<argc; ++k)
+        {
+            if (argv[k][0] == '-')
+            {
+                return -1;
+            }
+        }
+        return i;
+    }
+
+    //  Return the exit code, or -1 if not handled.
+    static int Remove(int argc, char* const* argv)
+    {
+        bool force;
+        int first = Operands(argc, argv, "-f", force);
+        if (first < 0 || (first == argc && !force))
+        {
+            return -1;
+        }
+        int code = 0;
+        for (int i=first; i<argc; ++i)
+        {
+            if (unlinkat(AT_FDCWD, argv[i], 0) != 0 && !(force && errno == ENOENT))
+            {
+                code = Error("rm", "cannot remove", argv[i], errno);
+            }
+        }
+        return code;
+    }
+
+    static int MakeDir(int argc, char* const* argv)
+    {
+        bool parents;
+        int first = Operands(argc, argv, "-p", parents);
+        if (first < 0 || first == argc)
+        {
+            return -1;
+        }
+        int code = 0;
+        for (int i=first; i<argc; ++i)
+        {
+            if (parents)
+            {
+                //  each ancestor, then the directory itself
+                std::string path = argv[i];
+                for (std::string::size_type k=path.find('/', 1); k!=std::string::npos; k=path.find('/', k + 1))
+                {
+                    path[k] = '\0';
+                    mkdirat(AT_FDCWD, path.c_str(), 0777);
+                    path[k] = '/';
+                }
+            }
+            if (mkdirat(AT_FDCWD, argv[i], 0777) != 0)
+            {
+                struct stat st;
+                if (!(parents && errno == EEXIST && stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)))
+                {
+                    code = Error("mkdir", "cannot create directory", argv[i], errno);
+                }
+            }
+        }
+        return code;
+    }
+
+    static int MoveCopy(bool move, const char* src, const char* dst)
+    {
+        const char* prog = move ? "mv" : "cp";
+        //  mv moves a symbolic link itself, cp copies the file it refers to
+        struct stat st;
+        if ((move ? lstat(src, &st) : stat(src, &st)) != 0)
+        {
+            return Error(prog, "cannot stat", src, errno);
+        }
+        if (!move && !S_ISREG(st.st_mode))
+        {
+            return -1;
+        }
+        //  into dst if it is a directory
+        std::string target = dst;
+        struct stat dst_st;
+        if (stat(dst, &dst_st) == 0 && S_ISDIR(dst_st.st_mode))
+        {
+            const char* base = strrchr(src, '/');
+            target += '/';
+            target += base == NULL ? src : base + 1;
+        }
+        //  the same file, e.g. cp d/f d, which would truncate it, left to coreutils to refuse
+        if ((move ? lstat(target.c_str(), &dst_st) : stat(target.c_str(), &dst_st)) == 0
+            && dst_st.st_dev == st.st_dev && dst_st.st_ino == st.st_ino)
+        {
+            return -1;
+        }
+        if (move)
+        {
+            if (renameat2(AT_FDCWD, src, AT_FDCWD, target.c_str(), 0) == 0)
+            {
+                return 0;
+            }
+            return errno == EXDEV || errno == EISDIR || errno == ENOTDIR || errno == ENOTEMPTY || errno == EEXIST
+                ? -1 : Error(prog, "cannot move", src, errno);
+        }
+        int in = open(src, O_RDONLY | O_CLOEXEC);
+        if (in < 0)
+        {
+            return Error(prog, "cannot open", src, errno);
+        }
+        int out = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+        if (out < 0)
+        {
+            int err = errno;
+            close(in);
+            return Error(prog, "cannot create regular file", target.c_str(), err);
+        }
+        int code = Copy(in, out) ? 0 : Error(prog, "error copying", src, errno);
+        close(in);
+        if (close(out) != 0 && code == 0)
+        {
+            code = Error(prog, "error writing", target.c_str(), errno);
+        }
+        return code;
+    }
+
+    static int Touch(int argc, char* const* argv)
+    {
+        bool given;
+        int first = Operands(argc, argv, NULL, given);
+        if (first < 0 || first == argc)
+        {
+            return -1;
+        }
+        int code = 0;
+        for (int i=first; i<argc; ++i)
+        {
+            if (utimensat(AT_FDCWD, argv[i], NULL, 0) == 0)
+            {
+                continue;
+            }
+            int fd = errno == ENOENT ? open(argv[i], O_WRONLY | O_CREAT | O_NONBLOCK | O_NOCTTY | O_CLOEXEC, 0666) : -1;
+            if (fd < 0)
+            {
+                code = Error("touch", "cannot touch", argv[i], errno);
+                continue;
+            }
+            close(fd);
+        }
+        return code;
+    }
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+
+END_NAMESPACE(NSVirgo)
+
+#endif
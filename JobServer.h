@@ -0,0 +1,287 @@
+#ifndef JOB_SERVER_H_2026_10_19
+#define JOB_SERVER_H_2026_10_19
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "CommonMacro.h"
+
+BEGIN_NAMESPACE(NSVirgo)
+
+/////////////////////////////////////////////////////////////////////////////////
+
+/** @class JobServer
+ *  @brief Job slots shared with GNU make and other programs by its jobserver
+ *         protocol, as a client or as the server.
+ *
+ *  A pool of N slots is a pipe or a FIFO holding N - 1 one-byte tokens; every
+ *  process of the pool owns one implicit slot, for its first job, and reads a
+ *  token for each other one, writing it back when the job is done. The pool
+ *  is passed to children in MAKEFLAGS, as "--jobserver-auth=R,W" with the
+ *  descriptors of a pipe, or "--jobserver-auth=fifo:PATH" since make 4.4.
+ *  Tokens are read from a descriptor of its own in non-blocking mode, so
+ *  that waiting can be given up without changing the descriptor shared
+ *  with other processes. Thread-safe.
+ *
+ *  @date 2026-10-19
+ */
+class JobServer
+{
+public:
+    enum { IMPLICIT = -1, NONE = -2 };     //  tokens besides the bytes read
+
+    /** @brief Join the pool in makeflags, the value of MAKEFLAGS.
+     *
+     *  @return Return NULL if there is none, or if it is not usable, e.g.
+     *          the descriptors were not passed, then error tells why.
+     */
+    static JobServer* Client(const char* makeflags, std::string& error)
+    {
+        error.clear();
+        if (makeflags == NULL)
+        {
+            return NULL;
+        }
+        //  the last one wins, like in make
+        std::string auth;
+        const char* keys[] = {"--jobserver-auth=", "--jobserver-fds="};
+        for (const char* p=makeflags; *p!='\0'; ++p)
+        {
+            for (size_t k=0; k<2; ++k)
+            {
+                size_t len = strlen(keys[k]);
+                if (strncmp(p, keys[k], len) == 0 && (p == makeflags || p[-1] == ' '))
+                {
+                    const char* end = strchr(p + len, ' ');
+                    auth.assign(p + len, end == NULL ? strlen(p + len) : end - p - len);
+                }
+            }
+        }
+        if (auth.empty())
+        {
+            return NULL;
+        }
+        JobServer* server = new JobServer();
+        if (auth.compare(0, 5, "fifo:") == 0)
+        {
+            std::string path = auth.substr(5);
+            server->m_Read = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            server->m_Write = server->m_Read < 0 ? -1 : open(path.c_str(), O_WRONLY | O_CLOEXEC);
+            if (server->m_Write < 0)
+            {
+                error = "can not open jobserver fifo " + path + ": " + strerror(errno);
+                delete server;
+                return NULL;
+            }
+            return server;
+        }
+        int r = -1;
+        int w = -1;
+        if (sscanf(auth.c_str(), "%d,%d", &r, &w) != 2 || r < 0 || w < 0)
+        {
+            //  e.g. "-2,-2" of a make that disabled it
+            delete server;
+            return NULL;
+        }
+        struct stat st;
+        if (fcntl(r, F_GETFD) < 0 || fcntl(w, F_GETFD) < 0 || fstat(r, &st) != 0 || !S_ISFIFO(st.st_mode))
+        {
+            error = "jobserver unavailable, its descriptors are not passed, add '+' to the parent make rule";
+            delete server;
+            return NULL;
+        }
+        server->m_Read = OpenNonBlocking(r);
+        server->m_Write = fcntl(w, F_DUPFD_CLOEXEC, 3);
+        if (server->m_Read < 0 || server->m_Write < 0)
+        {
+            error = std::string("can not use the jobserver: ") + strerror(errno);
+            delete server;
+            return NULL;
+        }
+        return server;
+    }
+
+    /** @brief Create a pool of slots, in a FIFO if fifo, else in a pipe.
+     *
+     *  @return Return NULL on error, then error tells why.
+     */
+    static JobServer* Server(size_t slots, bool fifo, std::string& error)
+    {
+        JobServer* server = new JobServer();
+        server->m_Owner = true;
+        if (fifo)
+        {
+            const char* tmp = getenv("TMPDIR");
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/multirun-jobserver.%d", tmp != NULL && tmp[0] != '\0' ? tmp : "/tmp", getpid());
+            if (mkfifo(path, 0600) != 0)
+            {
+                error = std::string("can not create jobserver fifo ") + path + ": " + strerror(errno);
+                delete server;
+                return NULL;
+            }
+            server->m_Path = path;
+            server->m_Read = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            server->m_Write = server->m_Read < 0 ? -1 : open(path, O_WRONLY | O_CLOEXEC);
+            server->m_Auth = std::string("fifo:") + path;
+        }
+        else
+        {
+            //  inherited by children, unlike the other descriptors
+            int fds[2];
+            if (pipe(fds) == 0)
+            {
+                server->m_Pipe[0] = fds[0];
+                server->m_Pipe[1] = fds[1];
+                server->m_Read = OpenNonBlocking(fds[0]);
+                server->m_Write = fcntl(fds[1], F_DUPFD_CLOEXEC, 3);
+                char auth[32];
+                snprintf(auth, sizeof(auth), "%d,%d", fds[0], fds[1]);
+                server->m_Auth = auth;
+            }
+        }
+        if (server->m_Read < 0 || server->m_Write < 0)
+        {
+            error = std::string("can not create the jobserver: ") + strerror(errno);
+            delete server;
+            return NULL;
+        }
+        for (size_t i=1; i<slots; ++i)
+        {
+            if (write(server->m_Write, "+", 1) != 1)
+            {
+                error = std::string("can not fill the jobserver: ") + strerror(errno);
+                delete server;
+                return NULL;
+            }
+        }
+        return server;
+    }
+
+    /** @brief Close, and remove the FIFO if created. Taken tokens are lost. */
+    ~JobServer()
+    {
+        int fds[4] = {m_Read, m_Write, m_Pipe[0], m_Pipe[1]};
+        for (size_t i=0; i<4; ++i)
+        {
+            if (fds[i] >= 0)
+            {
+                close(fds[i]);
+            }
+        }
+        if (m_Owner && !m_Path.empty())
+        {
+            unlink(m_Path.c_str());
+        }
+    }
+
+    /** @brief The MAKEFLAGS for children of the server, from the current makeflags. */
+    std::string MakeFlags(const char* makeflags, size_t slots) const
+    {
+        std::string flags = makeflags == NULL ? "" : makeflags;
+        char jobs[32];
+        snprintf(jobs, sizeof(jobs), " -j%zu", slots);
+        flags += jobs;
+        flags += " --jobserver-auth=";
+        flags += m_Auth;
+        return flags;
+    }
+
+    /** @brief Take a slot for a job, waiting until one is free or stop becomes
+     *         nonzero, then return false.
+     *
+     *  @param[out] token   The token to give back to Release(), IMPLICIT for
+     *                      the implicit slot.
+     */
+    bool Acquire(int& token, const volatile sig_atomic_t& stop)
+    {
+        bool expected = true;
+        if (m_Implicit.compare_exchange_strong(expected, false))
+        {
+            token = IMPLICIT;
+            return true;
+        }
+        while (stop == 0)
+        {
+            unsigned char c;
+            ssize_t n = read(m_Read, &c, 1);
+            if (n == 1)
+            {
+                token = c;
+                return true;
+            }
+            if (n < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                //  broken pool, run without it rather than hang
+                token = NONE;
+                return true;
+            }
+            //  another process got the token, or the implicit slot came back
+            expected = true;
+            if (m_Implicit.compare_exchange_strong(expected, false))
+            {
+                token = IMPLICIT;
+                return true;
+            }
+            struct pollfd pfd;
+            pfd.fd = m_Read;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            poll(&pfd, 1, 100);
+        }
+        return false;
+    }
+
+    /** @brief Give back a slot taken by Acquire(), nothing for NONE. */
+    void Release(int token)
+    {
+        if (token == IMPLICIT)
+        {
+            m_Implicit.store(true);
+        }
+        else if (token >= 0)
+        {
+            unsigned char c = token;
+            while (write(m_Write, &c, 1) < 0 && errno == EINTR)
+            {
+            }
+        }
+    }
+
+private:
+    JobServer() : m_Read(-1), m_Write(-1), m_Owner(false), m_Implicit(true)
+    {
+        m_Pipe[0] = m_Pipe[1] = -1;
+    }
+
+    //  A new open file description of the pipe fd, so that O_NONBLOCK is
+    //  not shared with the other processes of the pool.
+    static int OpenNonBlocking(int fd)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+        return open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    }
+
+    int m_Read;
+    int m_Write;
+    int m_Pipe[2];                      //  of the server, inherited by children
+    std::string m_Path;                 //  of the FIFO of the server
+    std::string m_Auth;                 //  of the server, for MAKEFLAGS
+    bool m_Owner;
+    std::atomic<bool> m_Implicit;       //  the implicit slot is free
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+
+END_NAMESPACE(NSVirgo)
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef LINE_MERGER_H_2026_10_19
+#define LINE_MERGER_H_2026_10_19
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "CommonMacro.h"
+
+BEGIN_NAMESPACE(NSVirgo)
+
+/////////////////////////////////////////////////////////////////////////////////
+
+/** @class LineMerger
+ *  @brief K-way merge of files of sorted lines, like "sort -m".
+ *
+ *  Lines are compared by a key: the whole line, or a blank separated field,
+ *  as bytes or as a number. Equal keys keep the order of the inputs, so the
+ *  merge is stable. Memory is one line per input.
+ *
+ *  @date 2026-10-19
+ */
+class LineMerger
+{
+public:
+    typedef std::string::size_type size_type;
+
+    /** @param[in]  field   The key field from 1, 0 for the whole line.
+     *  @param[in]  numeric Whether keys are compared as numbers.
+     */
+    LineMerger(size_type field, bool numeric) : m_Field(field), m_Numeric(numeric) {}
+
+    /** @brief Merge the files inputs to out, return false on error, with errno set. */
+    bool Merge(const std::vector<std::string>& inputs, FILE* out) const
+    {
+        std::vector<Input> in(inputs.size());
+        std::vector<size_type> heap;
+        bool ok = true;
+        for (size_type i=0; i<inputs.size(); ++i)
+        {
+            in[i].fp = fopen(inputs[i].c_str(), "r");
+            if (in[i].fp == NULL)
+            {
+                ok = false;
+                break;
+            }
+            if (Next(in[i]))
+            {
+                heap.push_back(i);
+                SiftUp(in, heap, heap.size() - 1);
+            }
+        }
+        while (ok && !heap.empty())
+        {
+            Input& top = in[heap[0]];
+            ok = fwrite(top.line, 1, top.len, out) == static_cast<size_t>(top.len);
+            if (!Next(top))
+            {
+                heap[0] = heap.back();
+                heap.pop_back();
+            }
+            if (!heap.empty())
+            {
+                SiftDown(in, heap, 0);
+            }
+        }
+        for (size_type i=0; i<in.size(); ++i)
+        {
+            if (in[i].fp != NULL)
+            {
+                ok = ok && !ferror(in[i].fp);
+                fclose(in[i].fp);
+            }
+            free(in[i].line);
+        }
+        return ok;
+    }
+
+    /** @brief Compare the keys of two lines, like strcmp. */
+    int Compare(const char* a, size_type alen, const char* b, size_type blen) const
+    {
+        const char* ka = a;
+        const char* kb = b;
+        size_type la = Key(ka, alen);
+        size_type lb = Key(kb, blen);
+        if (m_Numeric)
+        {
+            double x = strtod(ka, NULL);
+            double y = strtod(kb, NULL);
+            return x < y ? -1 : (x > y ? 1 : 0);
+        }
+        int c = memcmp(ka, kb, la < lb ? la : lb);
+        return c != 0 ? c : (la < lb ? -1 : (la > lb ? 1 : 0));
+    }
+
+private:
+    struct Input
+    {
+        FILE* fp;
+        char* line;
+        size_t cap;
+        ssize_t len;            //  with the newline
+        Input() : fp(NULL), line(NULL), cap(0), len(0) {}
+    };
+
+    //  Read the next line of in, return false at the end.
+    static bool Next(Input& in)
+    {
+        in.len = getline(&in.line, &in.cap, in.fp);
+        if (in.len > 0 && in.line[in.len - 1] != '\n')
+        {
+            //  the last line without newline
+            if (static_cast<size_t>(in.len) + 1 >= in.cap)
+            {
+                in.cap = in.len + 2;
+                in.line = static_cast<char*>(realloc(in.line, in.cap));
+            }
+            in.line[in.len++] = '\n';
+            in.line[in.len] = '\0';
+        }
+        return in.len > 0;
+    }
+
+    //  Move key to the key of the line, return its length without the newline.
+    size_type Key(const char*& key, size_type len) const
+    {
+        const char* end = key + len;
+        if (end > key && end[-1] == '\n')
+        {
+            --end;
+        }
+        for (size_type f=1; f<=m_Field; ++f)
+        {
+            while (key < end && (*key == ' ' || *key == '\t'))
+            {
+                ++key;
+            }
+            if (f == m_Field)
+            {
+                const char* stop = key;
+                while (stop < end && *stop != ' ' && *stop != '\t')
+                {
+                    ++stop;
+                }
+                return stop - key;
+            }
+            while (key < end && *key != ' ' && *key != '\t')
+            {
+                ++key;
+            }
+        }
+        return end - key;
+    }
+
+    bool Less(const std::vector<Input>& in, size_type i, size_type j) const
+    {
+        int c = Compare(in[i].line, in[i].len, in[j].line, in[j].len);
+        return c < 0 || (c == 0 && i < j);
+    }
+
+    void SiftUp(const std::vector<Input>& in, std::vector<size_type>& heap, size_type k) const
+    {
+        while (k > 0 && Less(in, heap[k], heap[(k - 1) / 2]))
+        {
+            std::swap(heap[k], heap[(k - 1) / 2]);
+            k = (k - 1) / 2;
+        }
+    }
+
+    void SiftDown(const std::vector<Input>& in, std::vector<size_type>& heap, size_type k) const
+    {
+        while (true)
+        {
+            size_type best = k;
+            size_type l = 2 * k + 1;
+            if (l < heap.size() && Less(in, heap[l], heap[best]))
+            {
+                best = l;
+            }
+            if (l + 1 < heap.size() && Less(in, heap[l + 1], heap[best]))
+            {
+                best = l + 1;
+            }
+            if (best == k)
+            {
+                return;
+            }
+            std::swap(heap[k], heap[best]);
+            k = best;
+        }
+    }
+
+    size_type m_Field;
+    bool m_Numeric;
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+
+END_NAMESPACE(NSVirgo)
+
+#endif
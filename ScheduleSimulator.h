@@ -0,0 +1,223 @@
+#ifndef SCHEDULE_SIMULATOR_H_2026_10_19
+#define SCHEDULE_SIMULATOR_H_2026_10_19
+
+#include <cassert>
+#include <functional>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+#include "CommonMacro.h"
+
+BEGIN_NAMESPACE(NSVirgo)
+
+/////////////////////////////////////////////////////////////////////////////////
+
+/** @class ScheduleSimulator
+ *  @brief Discrete-event simulation of the multirun scheduler.
+ *
+ *  Each source is a sequence of tasks with known durations and barriers. The
+ *  simulation follows the scheduler of multirun: sources are served by
+ *  deficit round robin, a barrier of a source is passed once all earlier tasks
+ *  of the source are finished, and every task is queued at time 0, i.e. the
+ *  producer is never the bottleneck. Nothing is executed, a run costs
+ *  O(T log S) for T tasks and S slots.
+ *
+ *  @date 2026-10-19
+ */
+class ScheduleSimulator
+{
+public:
+    typedef std::string::size_type size_type;
+
+    /** @brief The prediction for a number of slots, times in seconds. */
+    struct Result
+    {
+        size_type slots;
+        double makespan;        /**< From start to the end of the last task. */
+        double busy;            /**< Slot-seconds running tasks. */
+        double barrier_idle;    /**< Slot-seconds idle while a source waits at a barrier. */
+        double tail_idle;       /**< Slot-seconds idle for lack of tasks, e.g. at the end. */
+        double Utilization() const
+        {
+            return makespan > 0 ? busy / (slots * makespan) : 0;
+        }
+    };
+
+    ScheduleSimulator() : m_TaskNum(0), m_BarrierNum(0) {}
+
+    /** @brief Add a source with the given weight, return its index. */
+    size_type AddSource(size_type weight)
+    {
+        m_vSource.push_back(SourceTasks());
+        m_vSource.back().weight = weight == 0 ? 1 : weight;
+        return m_vSource.size() - 1;
+    }
+
+    /** @brief Append a task of duration seconds to a source. */
+    void AddTask(size_type source, double duration)
+    {
+        assert(source < m_vSource.size());
+        m_vSource[source].tasks.push_back(duration > 0 ? static_cast<float>(duration) : 0.0f);
+        ++m_TaskNum;
+    }
+
+    /** @brief Append a barrier to a source. */
+    void AddBarrier(size_type source)
+    {
+        assert(source < m_vSource.size());
+        m_vSource[source].tasks.push_back(Barrier());
+        ++m_BarrierNum;
+    }
+
+    size_type TaskNum() const
+    {
+        return m_TaskNum;
+    }
+
+    size_type BarrierNum() const
+    {
+        return m_BarrierNum;
+    }
+
+    /** @brief Simulate the whole run with the given number of slots. */
+    Result Run(size_type slots) const
+    {
+        assert(slots > 0);
+        Result result;
+        result.slots = slots;
+        result.makespan = result.busy = result.barrier_idle = result.tail_idle = 0;
+        std::vector<SourceState> state(m_vSource.size());
+        //  finish time and source of running tasks, earliest first
+        typedef std::pair<double, size_type> Event;
+        std::priority_queue<Event, std::vector<Event>, std::greater<Event> > events;
+        size_type turn = 0;
+        size_type idle = slots;
+        double now = 0;
+        while (true)
+        {
+            //  dispatch to idle slots
+            while (idle > 0)
+            {
+                size_type s = Pick(state, turn);
+                if (s == m_vSource.size())
+                {
+                    break;
+                }
+                double duration = m_vSource[s].tasks[state[s].next++];
+                ++state[s].running;
+                --idle;
+                result.busy += duration;
+                events.push(Event(now + duration, s));
+            }
+            if (events.empty())
+            {
+                break;
+            }
+            //  advance to the next finish
+            const Event event = events.top();
+            events.pop();
+            if (idle > 0)
+            {
+                double idle_time = idle * (event.first - now);
+                if (BarrierBlocked(state))
+                {
+                    result.barrier_idle += idle_time;
+                }
+                else
+                {
+                    result.tail_idle += idle_time;
+                }
+            }
+            now = event.first;
+            --state[event.second].running;
+            ++idle;
+        }
+        result.makespan = now;
+        return result;
+    }
+
+private:
+    //  marks a #sync in the task list
+    static float Barrier()
+    {
+        return -1.0f;
+    }
+
+    struct SourceTasks
+    {
+        size_type weight;
+        std::vector<float> tasks;       //  durations, Barrier() for #sync
+    };
+
+    struct SourceState
+    {
+        size_type next;                 //  index of the next task
+        size_type running;
+        size_type deficit;
+        SourceState() : next(0), running(0), deficit(0) {}
+    };
+
+    //  Whether source s has a task to dispatch, passing barriers without running tasks.
+    bool Dispatchable(std::vector<SourceState>& state, size_type s) const
+    {
+        const std::vector<float>& tasks = m_vSource[s].tasks;
+        SourceState& st = state[s];
+        while (st.next < tasks.size() && tasks[st.next] == Barrier())
+        {
+            if (st.running > 0)
+            {
+                return false;
+            }
+            ++st.next;
+        }
+        return st.next < tasks.size();
+    }
+
+    //  Deficit round robin, as PickSource of multirun, return m_vSource.size() if none.
+    size_type Pick(std::vector<SourceState>& state, size_type& turn) const
+    {
+        for (size_type k=0; k<m_vSource.size(); ++k)
+        {
+            size_type s = turn;
+            if (Dispatchable(state, s))
+            {
+                if (state[s].deficit == 0)
+                {
+                    state[s].deficit = m_vSource[s].weight;
+                }
+                if (--state[s].deficit == 0)
+                {
+                    turn = (turn + 1) % m_vSource.size();
+                }
+                return s;
+            }
+            state[s].deficit = 0;
+            turn = (turn + 1) % m_vSource.size();
+        }
+        return m_vSource.size();
+    }
+
+    bool BarrierBlocked(const std::vector<SourceState>& state) const
+    {
+        for (size_type s=0; s<m_vSource.size(); ++s)
+        {
+            const std::vector<float>& tasks = m_vSource[s].tasks;
+            if (state[s].running > 0 && state[s].next < tasks.size() && tasks[state[s].next] == Barrier())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<SourceTasks> m_vSource;
+    size_type m_TaskNum;
+    size_type m_BarrierNum;
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+
+END_NAMESPACE(NSVirgo)
+
+#endif
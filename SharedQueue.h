@@ -0,0 +1,592 @@
+#ifndef SHARED_QUEUE_H_2026_10_19
+#define SHARED_QUEUE_H_2026_10_19
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "CommonMacro.h"
+
+BEGIN_NAMESPACE(NSVirgo)
+
+/////////////////////////////////////////////////////////////////////////////////
+
+/** @class SharedQueue
+ *  @brief A queue of commands in POSIX shared memory, shared by processes.
+ *
+ *  Any number of processes attach as members, each pushing commands,
+ *  taking them, or both. The queue is a ring of cells indexed by tickets:
+ *  producers fill the cell of the tail ticket under a robust process-shared
+ *  mutex, so that a producer dying in it leaves no half-written cell behind;
+ *  consumers take the cell of the head ticket without a lock, by a CAS on
+ *  its owner word from free to claimed by them, and help each other move
+ *  the head. A taken command keeps its cell until done, so the ring holds
+ *  the queued and the running commands, and a long command delays the
+ *  producers once they wrap around to it.
+ *
+ *  Every member renews a lease by Heartbeat(). Reap() hands the commands
+ *  claimed by a member whose process is gone or whose lease expired back
+ *  to the others, by marking their cells to retry, which consumers look
+ *  for before the head while some are marked, after killing the process
+ *  group running each of them if recorded by SetLeader(). Release() does
+ *  the same for one command, e.g. one interrupted on shutdown. Marking
+ *  needs no room, so a command may run more than once, never zero times. The producer of a command learns that it is done by its
+ *  counters of finished and failed commands.
+ *
+ *  @date 2026-10-19
+ */
+class SharedQueue
+{
+public:
+    typedef std::string::size_type size_type;
+
+    enum { MAX_MEMBERS = 64, TEXT_SIZE = 4056 };
+
+    /** @brief A command taken by a member. */
+    struct Task
+    {
+        uint64_t ticket;
+        uint32_t producer;              //  member who pushed it
+        uint32_t generation;            //  of the producer then
+        unsigned flags;                 //  given to Push()
+    };
+
+    /** @brief Attach to the queue name, creating it with capacity cells if missing.
+     *
+     *  The name is of shm_open, a leading / is added if missing. Capacity is
+     *  rounded up to a power of 2 and ignored if the queue exists.
+     *  @return Return NULL on error, with errno set.
+     */
+    static SharedQueue* Attach(const std::string& name, size_type capacity)
+    {
+        uint64_t cells = 16;
+        while (cells < capacity)
+        {
+            cells *= 2;
+        }
+        std::string shm = ShmName(name);
+        int fd = shm_open(shm.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd >= 0)
+        {
+            size_t size = sizeof(Header) + cells * sizeof(Cell);
+            void* data = ftruncate(fd, size) == 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+            close(fd);
+            if (data == MAP_FAILED || !Init(static_cast<Header*>(data), cells))
+            {
+                int err = errno;
+                if (data != MAP_FAILED)
+                {
+                    munmap(data, size);
+                }
+                shm_unlink(shm.c_str());
+                errno = err;
+                return NULL;
+            }
+            return new SharedQueue(name, data, size);
+        }
+        if (errno != EEXIST)
+        {
+            return NULL;
+        }
+        fd = shm_open(shm.c_str(), O_RDWR | O_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            return NULL;
+        }
+        //  wait for the creator to size and fill it
+        errno = 0;
+        struct stat st;
+        Header* header = NULL;
+        for (int i=0; i<1000 && header == NULL; ++i)
+        {
+            if (fstat(fd, &st) != 0)
+            {
+                break;
+            }
+            if (static_cast<size_t>(st.st_size) < sizeof(Header))
+            {
+                usleep(1000);
+                continue;
+            }
+            void* data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                break;
+            }
+            header = static_cast<Header*>(data);
+            if (header->ready.load(std::memory_order_acquire) == 0)
+            {
+                munmap(data, st.st_size);
+                header = NULL;
+                usleep(1000);
+            }
+        }
+        int err = errno;
+        close(fd);
+        if (header == NULL)
+        {
+            errno = err == 0 ? ETIMEDOUT : err;
+            return NULL;
+        }
+        if (memcmp(header->magic, Magic(), sizeof(header->magic)) != 0 || header->version != VERSION
+            || sizeof(Header) + header->capacity * sizeof(Cell) > static_cast<size_t>(st.st_size))
+        {
+            munmap(header, st.st_size);
+            errno = EINVAL;
+            return NULL;
+        }
+        return new SharedQueue(name, header, st.st_size);
+    }
+
+    /** @brief Unmap, the member must have left. */
+    ~SharedQueue()
+    {
+        munmap(m_pHeader, m_Size);
+    }
+
+    /** @brief Join as a member, return its index, or -1 if there are too many. */
+    int Join(bool producer)
+    {
+        Header* h = m_pHeader;
+        for (int m=0; m<MAX_MEMBERS; ++m)
+        {
+            Member& member = h->member[m];
+            uint64_t expected = 0;
+            if (!member.pid.compare_exchange_strong(expected, getpid()))
+            {
+                continue;
+            }
+            //  a new generation first, so that commands of a former member do not count
+            member.generation.store(h->generation.fetch_add(1) + 1);
+            member.finished.store(0);
+            member.failed.store(0);
+            member.heartbeat.store(NowNs());
+            member.producer.store(producer ? 1 : 0);
+            if (producer)
+            {
+                h->producers.fetch_add(1);
+                h->opened.store(1);
+            }
+            h->members.fetch_add(1);
+            return m;
+        }
+        return -1;
+    }
+
+    /** @brief Stop pushing, the queue is closed once no member pushes. */
+    void EndProducer(int m)
+    {
+        uint64_t expected = 1;
+        if (m_pHeader->member[m].producer.compare_exchange_strong(expected, 0))
+        {
+            m_pHeader->producers.fetch_sub(1);
+        }
+    }
+
+    /** @brief Leave, after releasing or finishing the commands taken. The
+     *         last member removes the queue. Nothing is done if m was
+     *         reaped, its entry may belong to another member since.
+     */
+    void Leave(int m)
+    {
+        Member& member = m_pHeader->member[m];
+        uint64_t pid = getpid();
+        if (!member.pid.compare_exchange_strong(pid, REAPING))
+        {
+            return;
+        }
+        EndProducer(m);
+        member.pid.store(0);
+        if (m_pHeader->members.fetch_sub(1) == 1)
+        {
+            shm_unlink(ShmName(m_Name).c_str());
+        }
+    }
+
+    /** @brief Renew the lease of member m, return false if it was reaped meanwhile. */
+    bool Heartbeat(int m)
+    {
+        Member& member = m_pHeader->member[m];
+        member.heartbeat.store(NowNs());
+        return member.pid.load() == static_cast<uint64_t>(getpid());
+    }
+
+    /** @brief Push a command of member m, return false if the ring is full. */
+    bool Push(int m, const char* text, size_type size, unsigned flags)
+    {
+        Header* h = m_pHeader;
+        if (size > TEXT_SIZE - 1)
+        {
+            return false;
+        }
+        int ret = pthread_mutex_lock(&h->mutex);
+        if (ret == EOWNERDEAD)
+        {
+            //  the last producer died in Push(), maybe after publishing its cell
+            uint64_t tail = h->tail.load();
+            if (At(tail).seq.load() == tail + 1)
+            {
+                h->tail.store(tail + 1);
+            }
+            pthread_mutex_consistent(&h->mutex);
+        }
+        else if (ret != 0)
+        {
+            return false;
+        }
+        uint64_t ticket = h->tail.load(std::memory_order_relaxed);
+        Cell& cell = At(ticket);
+        bool ok = cell.seq.load(std::memory_order_acquire) == ticket;
+        if (ok)
+        {
+            cell.size = size;
+            cell.flags = flags;
+            cell.producer = m;
+            cell.generation = h->member[m].generation.load(std::memory_order_relaxed);
+            memcpy(cell.text, text, size);
+            cell.text[size] = '\0';
+            cell.leader.store(0, std::memory_order_relaxed);
+            cell.seq.store(ticket + 1, std::memory_order_release);
+            h->tail.store(ticket + 1, std::memory_order_release);
+        }
+        pthread_mutex_unlock(&h->mutex);
+        return ok;
+    }
+
+    /** @brief Take a command for member m, a retried one first, return false if none. */
+    bool Take(int m, Task& task, std::string& text)
+    {
+        Header* h = m_pHeader;
+        if (static_cast<int64_t>(h->retries.load(std::memory_order_acquire)) > 0 && TakeRetry(m, task, text))
+        {
+            return true;
+        }
+        while (true)
+        {
+            uint64_t ticket = h->head.load(std::memory_order_acquire);
+            Cell& cell = At(ticket);
+            uint64_t seq = cell.seq.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(seq - (ticket + 1));
+            if (diff < 0)
+            {
+                //  not pushed yet
+                return false;
+            }
+            if (diff == 0)
+            {
+                uint64_t expected = Free(ticket);
+                if (cell.owner.compare_exchange_strong(expected, Claimed(ticket, m), std::memory_order_acq_rel))
+                {
+                    Copy(cell, ticket, task, text);
+                    h->head.compare_exchange_strong(ticket, ticket + 1);
+                    return true;
+                }
+            }
+            //  taken by another member, help it move the head
+            h->head.compare_exchange_strong(ticket, ticket + 1);
+        }
+    }
+
+    /** @brief Finish a command taken by member m, return false if it was
+     *         reaped meanwhile, then it is run again and not counted.
+     */
+    bool Done(int m, const Task& task, bool failed)
+    {
+        Cell& cell = At(task.ticket);
+        uint64_t expected = Claimed(task.ticket, m);
+        if (!cell.owner.compare_exchange_strong(expected, Free(task.ticket + Capacity()), std::memory_order_acq_rel))
+        {
+            return false;
+        }
+        Member& producer = m_pHeader->member[task.producer];
+        if (producer.generation.load() == task.generation)
+        {
+            if (failed)
+            {
+                producer.failed.fetch_add(1);
+            }
+            producer.finished.fetch_add(1);
+        }
+        m_pHeader->done.fetch_add(1);
+        cell.seq.store(task.ticket + Capacity(), std::memory_order_release);
+        return true;
+    }
+
+    /** @brief Record the process group running the command of ticket, killed if reaped. */
+    void SetLeader(uint64_t ticket, uint64_t leader)
+    {
+        At(ticket).leader.store(leader);
+    }
+
+    /** @brief Give back a command taken by member m, to be run again by any member. */
+    void Release(int m, const Task& task)
+    {
+        Requeue(Claimed(task.ticket, m));
+    }
+
+    /** @brief Give back the commands of members whose process is gone or
+     *         whose lease is older than lease_ns, return the number of them.
+     */
+    size_type Reap(uint64_t lease_ns)
+    {
+        Header* h = m_pHeader;
+        uint64_t now = NowNs();
+        size_type reaped = 0;
+        for (int m=0; m<MAX_MEMBERS; ++m)
+        {
+            Member& member = h->member[m];
+            uint64_t pid = member.pid.load();
+            if (pid == 0 || pid == REAPING || pid == static_cast<uint64_t>(getpid()))
+            {
+                continue;
+            }
+            bool gone = kill(static_cast<pid_t>(pid), 0) != 0 && errno == ESRCH;
+            if (!gone && now - member.heartbeat.load() < lease_ns)
+            {
+                continue;
+            }
+            if (!member.pid.compare_exchange_strong(pid, REAPING))
+            {
+                continue;
+            }
+            for (uint64_t i=0; i<Capacity(); ++i)
+            {
+                Cell* cell = h->cell(i, Capacity());
+                uint64_t owner = cell->owner.load();
+                if ((owner & MEMBER_MASK) != static_cast<uint64_t>(m) + 1)
+                {
+                    continue;
+                }
+                //  the command may outlive its member, in its own process group
+                uint64_t leader = cell->leader.exchange(0);
+                if (leader != 0)
+                {
+                    kill(-static_cast<pid_t>(leader), SIGKILL);
+                }
+                if (Requeue(owner))
+                {
+                    ++reaped;
+                }
+            }
+            EndProducer(m);
+            member.pid.store(0);
+            h->members.fetch_sub(1);
+        }
+        return reaped;
+    }
+
+    /** @brief The commands pushed by member m, finished and failed by any member. */
+    uint64_t Finished(int m) const
+    {
+        return m_pHeader->member[m].finished.load(std::memory_order_acquire);
+    }
+
+    uint64_t Failed(int m) const
+    {
+        return m_pHeader->member[m].failed.load(std::memory_order_acquire);
+    }
+
+    /** @brief Whether some member pushed and none pushes any more. */
+    bool Closed() const
+    {
+        return m_pHeader->opened.load() != 0 && m_pHeader->producers.load() == 0;
+    }
+
+    /** @brief Whether every command pushed is done, none waits or runs,
+     *         not even one claimed by a member that is gone and not reaped yet.
+     */
+    bool Drained() const
+    {
+        const Header* h = m_pHeader;
+        return h->done.load() == h->tail.load();
+    }
+
+    uint64_t Capacity() const
+    {
+        return m_pHeader->capacity;
+    }
+
+    /** @brief Monotonic nanoseconds, the clock of leases. */
+    static uint64_t NowNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+private:
+    static const uint32_t VERSION = 2;
+    static const uint64_t REAPING = ~0ull;          //  pid of a member being reaped or leaving
+    static const uint64_t MEMBER_MASK = 0xff;       //  member + 1 in the owner word, 0 if free
+    static const uint64_t RETRY = 0xff;             //  as member, free and to be taken again
+
+    struct Member
+    {
+        std::atomic<uint64_t> pid;                  //  0 if the entry is free
+        std::atomic<uint64_t> heartbeat;
+        std::atomic<uint64_t> generation;
+        std::atomic<uint64_t> producer;
+        std::atomic<uint64_t> finished;
+        std::atomic<uint64_t> failed;
+        uint64_t pad[2];
+    };
+
+    //  4096 bytes
+    struct Cell
+    {
+        std::atomic<uint64_t> seq;                  //  ticket if free, ticket + 1 if pushed
+        std::atomic<uint64_t> owner;                //  ticket << 8 | member + 1, 0 as member if free, RETRY
+        std::atomic<uint64_t> leader;               //  process group running it, 0 if none
+        uint32_t size;
+        uint32_t flags;
+        uint32_t producer;
+        uint32_t generation;
+        char text[TEXT_SIZE];
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t capacity;
+        std::atomic<uint64_t> ready;
+        pthread_mutex_t mutex;                      //  of producers
+        std::atomic<uint64_t> generation;
+        std::atomic<uint64_t> producers;
+        std::atomic<uint64_t> opened;
+        std::atomic<uint64_t> members;
+        std::atomic<uint64_t> retries;              //  cells marked RETRY, may be -1 for a moment
+        std::atomic<uint64_t> done;                 //  commands done, of tail pushed
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+        alignas(64) Member member[MAX_MEMBERS];
+
+        Cell* cell(uint64_t ticket, uint64_t capacity)
+        {
+            return reinterpret_cast<Cell*>(this + 1) + (ticket & (capacity - 1));
+        }
+    };
+
+    SharedQueue(const std::string& name, void* data, size_t size)
+        : m_Name(name), m_pHeader(static_cast<Header*>(data)), m_Size(size)
+    {
+    }
+
+    static const char* Magic()
+    {
+        return "MRSHARED";
+    }
+
+    static std::string ShmName(const std::string& name)
+    {
+        return name.empty() || name[0] != '/' ? "/" + name : name;
+    }
+
+    //  Fill a new queue, zero filled by ftruncate, return false on error.
+    static bool Init(Header* h, uint64_t cells)
+    {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        int ret = pthread_mutex_init(&h->mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+        if (ret != 0)
+        {
+            errno = ret;
+            return false;
+        }
+        memcpy(h->magic, Magic(), sizeof(h->magic));
+        h->version = VERSION;
+        h->capacity = cells;
+        for (uint64_t i=0; i<cells; ++i)
+        {
+            Cell* cell = h->cell(i, cells);
+            cell->seq.store(i, std::memory_order_relaxed);
+            cell->owner.store(Free(i), std::memory_order_relaxed);
+        }
+        h->ready.store(1, std::memory_order_release);
+        return true;
+    }
+
+    static uint64_t Free(uint64_t ticket)
+    {
+        return ticket << 8;
+    }
+
+    static uint64_t Claimed(uint64_t ticket, int m)
+    {
+        return ticket << 8 | (m + 1);
+    }
+
+    Cell& At(uint64_t ticket) const
+    {
+        return *m_pHeader->cell(ticket, m_pHeader->capacity);
+    }
+
+    static void Copy(const Cell& cell, uint64_t ticket, Task& task, std::string& text)
+    {
+        task.ticket = ticket;
+        task.producer = cell.producer;
+        task.generation = cell.generation;
+        task.flags = cell.flags;
+        text.assign(cell.text, cell.size < TEXT_SIZE ? cell.size : TEXT_SIZE - 1);
+    }
+
+    //  Mark the cell claimed as owner to be taken again, return false if it
+    //  is not claimed so any more.
+    bool Requeue(uint64_t owner)
+    {
+        Header* h = m_pHeader;
+        uint64_t ticket = owner >> 8;
+        //  counted first, so that a consumer that takes it at once finds it counted
+        h->retries.fetch_add(1);
+        if (!At(ticket).owner.compare_exchange_strong(owner, ticket << 8 | RETRY))
+        {
+            h->retries.fetch_sub(1);
+            return false;
+        }
+        return true;
+    }
+
+    //  Take a cell marked RETRY, scanning the ring, as marked cells are rare.
+    bool TakeRetry(int m, Task& task, std::string& text)
+    {
+        Header* h = m_pHeader;
+        for (uint64_t i=0; i<Capacity(); ++i)
+        {
+            Cell* cell = h->cell(i, Capacity());
+            uint64_t owner = cell->owner.load(std::memory_order_acquire);
+            if ((owner & MEMBER_MASK) != RETRY)
+            {
+                continue;
+            }
+            uint64_t ticket = owner >> 8;
+            if (cell->owner.compare_exchange_strong(owner, Claimed(ticket, m), std::memory_order_acq_rel))
+            {
+                h->retries.fetch_sub(1);
+                Copy(*cell, ticket, task, text);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string m_Name;
+    Header* m_pHeader;
+    size_t m_Size;
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+
+END_NAMESPACE(NSVirgo)
+
+#endif
@@ -0,0 +1,345 @@
+#ifndef STATUS_TABLE_H_2026_10_19
+#define STATUS_TABLE_H_2026_10_19
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "CommonMacro.h"
+
+BEGIN_NAMESPACE(NSVirgo)
+
+/////////////////////////////////////////////////////////////////////////////////
+
+/** @class StatusTable
+ *  @brief The status of a multirun process in POSIX shared memory, read by
+ *         other processes without system calls to it or locks in it.
+ *
+ *  A header of counters and one record per thread, each under its own
+ *  seqlock: the writer makes the sequence odd, stores the fields, and makes
+ *  it even again; a reader retries until it sees the same even sequence
+ *  before and after copying. Every field is an atomic word, so copying is
+ *  free of data races. There must be one writer at a time of the header
+ *  and of each slot; readers are not limited.
+ *
+ *  @date 2026-10-19
+ */
+class StatusTable
+{
+public:
+    typedef std::string::size_type size_type;
+
+    enum Field { QUEUED, RUNNING, COMPLETED, FAILED, INTERRUPTED, BARRIERS, FIELD_NUM };
+    enum { TEXT_SIZE = 256 };
+
+    /** @brief A copy of the counters. */
+    struct Counters
+    {
+        uint64_t value[FIELD_NUM];
+        uint64_t updated;               //  realtime nanoseconds
+    };
+
+    /** @brief A copy of the record of a thread, pid and start are 0 if idle. */
+    struct Slot
+    {
+        uint64_t pid;                   //  of the process group of the command, 0 if run in process
+        uint64_t start;                 //  realtime nanoseconds
+        uint64_t input;                 //  index of its input
+        uint64_t number;                //  dispatched from its input before it, from 1
+        char text[TEXT_SIZE];           //  the command, truncated, NUL terminated
+    };
+
+    /** @brief Create the table name with slots, for writing. Return NULL on error, with errno set.
+     *
+     *  The name is of shm_open, a leading / is added if missing. It fails
+     *  with EEXIST if the name is in use, unless by a table whose writer is
+     *  gone, which is replaced.
+     */
+    static StatusTable* Create(const std::string& name, size_type slots)
+    {
+        int fd = shm_open(ShmName(name).c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0 && errno == EEXIST)
+        {
+            //  left by a writer killed before removing it, not one being created
+            StatusTable* old = Open(name);
+            bool stale = old != NULL && kill(old->Pid(), 0) != 0 && errno == ESRCH;
+            delete old;
+            if (stale && shm_unlink(ShmName(name).c_str()) == 0)
+            {
+                fd = shm_open(ShmName(name).c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+            }
+            else
+            {
+                errno = EEXIST;
+            }
+        }
+        if (fd < 0)
+        {
+            return NULL;
+        }
+        size_t size = sizeof(Shared) + slots * sizeof(SharedSlot);
+        void* data = ftruncate(fd, size) == 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            shm_unlink(ShmName(name).c_str());
+            return NULL;
+        }
+        StatusTable* table = new StatusTable(name, data, size, true);
+        Shared* shared = table->m_pShared;
+        //  zero filled by ftruncate
+        shared->version = VERSION;
+        shared->slots = slots;
+        shared->pid = getpid();
+        shared->start = RealNs();
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(shared->magic, Magic(), sizeof(shared->magic));
+        return table;
+    }
+
+    /** @brief Open the table name for reading, return NULL if it is missing or invalid. */
+    static StatusTable* Open(const std::string& name)
+    {
+        int fd = shm_open(ShmName(name).c_str(), O_RDONLY | O_CLOEXEC, 0);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Shared))
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return NULL;
+        }
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            return NULL;
+        }
+        StatusTable* table = new StatusTable(name, data, st.st_size, false);
+        const Shared* shared = table->m_pShared;
+        if (memcmp(shared->magic, Magic(), sizeof(shared->magic)) != 0 || shared->version != VERSION
+            || sizeof(Shared) + shared->slots * sizeof(SharedSlot) > table->m_Size)
+        {
+            delete table;
+            return NULL;
+        }
+        return table;
+    }
+
+    /** @brief Unmap, and remove the table if created by this process. */
+    ~StatusTable()
+    {
+        munmap(m_pShared, m_Size);
+        if (m_Owner)
+        {
+            shm_unlink(ShmName(m_Name).c_str());
+        }
+    }
+
+    size_type Slots() const
+    {
+        return m_pShared->slots;
+    }
+
+    /** @brief The pid of the writer. */
+    uint64_t Pid() const
+    {
+        return m_pShared->pid;
+    }
+
+    /** @brief The realtime nanoseconds when the table was created. */
+    uint64_t Start() const
+    {
+        return m_pShared->start;
+    }
+
+    /** @brief Current realtime in nanoseconds, the clock of the times in the table. */
+    static uint64_t RealNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+    }
+
+    /** @brief Publish counters, by the single writer of the header. */
+    void SetCounters(const uint64_t (&value)[FIELD_NUM])
+    {
+        Shared* shared = m_pShared;
+        WriteBegin(shared->seq);
+        for (size_type i=0; i<FIELD_NUM; ++i)
+        {
+            shared->value[i].store(value[i], std::memory_order_relaxed);
+        }
+        shared->updated.store(RealNs(), std::memory_order_relaxed);
+        WriteEnd(shared->seq);
+    }
+
+    /** @brief Publish the command started by slot i, by its single writer. */
+    void StartSlot(size_type i, uint64_t input, uint64_t number, const char* text, size_type size)
+    {
+        SharedSlot& slot = m_pSlot[i];
+        WriteBegin(slot.seq);
+        slot.pid.store(0, std::memory_order_relaxed);
+        slot.start.store(RealNs(), std::memory_order_relaxed);
+        slot.input.store(input, std::memory_order_relaxed);
+        slot.number.store(number, std::memory_order_relaxed);
+        //  whole words, the last one NUL padded
+        size = size < TEXT_SIZE - 1 ? size : TEXT_SIZE - 1;
+        for (size_type w=0; w*8<=size; ++w)
+        {
+            uint64_t word = 0;
+            memcpy(&word, text + w * 8, w * 8 + 8 <= size ? 8 : size - w * 8);
+            slot.text[w].store(word, std::memory_order_relaxed);
+        }
+        WriteEnd(slot.seq);
+    }
+
+    /** @brief Publish the pid of the command of slot i. */
+    void SetSlotPid(size_type i, uint64_t pid)
+    {
+        SharedSlot& slot = m_pSlot[i];
+        WriteBegin(slot.seq);
+        slot.pid.store(pid, std::memory_order_relaxed);
+        WriteEnd(slot.seq);
+    }
+
+    /** @brief Publish that slot i is idle. */
+    void ClearSlot(size_type i)
+    {
+        SharedSlot& slot = m_pSlot[i];
+        WriteBegin(slot.seq);
+        slot.pid.store(0, std::memory_order_relaxed);
+        slot.start.store(0, std::memory_order_relaxed);
+        WriteEnd(slot.seq);
+    }
+
+    /** @brief Copy a consistent snapshot of the counters. */
+    void ReadCounters(Counters& counters) const
+    {
+        const Shared* shared = m_pShared;
+        uint64_t seq;
+        do
+        {
+            seq = ReadBegin(shared->seq);
+            for (size_type i=0; i<FIELD_NUM; ++i)
+            {
+                counters.value[i] = shared->value[i].load(std::memory_order_relaxed);
+            }
+            counters.updated = shared->updated.load(std::memory_order_relaxed);
+        }
+        while (!ReadEnd(shared->seq, seq));
+    }
+
+    /** @brief Copy a consistent snapshot of slot i. */
+    void ReadSlot(size_type i, Slot& out) const
+    {
+        const SharedSlot& slot = m_pSlot[i];
+        uint64_t seq;
+        do
+        {
+            seq = ReadBegin(slot.seq);
+            out.pid = slot.pid.load(std::memory_order_relaxed);
+            out.start = slot.start.load(std::memory_order_relaxed);
+            out.input = slot.input.load(std::memory_order_relaxed);
+            out.number = slot.number.load(std::memory_order_relaxed);
+            for (size_type w=0; w<TEXT_SIZE/8; ++w)
+            {
+                uint64_t word = slot.text[w].load(std::memory_order_relaxed);
+                memcpy(out.text + w * 8, &word, 8);
+            }
+        }
+        while (!ReadEnd(slot.seq, seq));
+        out.text[TEXT_SIZE - 1] = '\0';
+    }
+
+private:
+    static const uint32_t VERSION = 1;
+
+    struct Shared
+    {
+        char magic[8];                  //  set last by the writer
+        uint32_t version;
+        uint32_t slots;
+        uint64_t pid;
+        uint64_t start;
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> value[FIELD_NUM];
+        std::atomic<uint64_t> updated;
+        uint64_t pad[4];
+    };
+
+    //  a multiple of cache lines, so that threads do not share them
+    struct SharedSlot
+    {
+        std::atomic<uint64_t> seq;
+        std::atomic<uint64_t> pid;
+        std::atomic<uint64_t> start;
+        std::atomic<uint64_t> input;
+        std::atomic<uint64_t> number;
+        std::atomic<uint64_t> text[TEXT_SIZE / 8];
+        uint64_t pad[3];
+    };
+
+    StatusTable(const std::string& name, void* data, size_t size, bool owner)
+        : m_Name(name), m_pShared(static_cast<Shared*>(data)), m_pSlot(reinterpret_cast<SharedSlot*>(m_pShared + 1)),
+        m_Size(size), m_Owner(owner)
+    {
+    }
+
+    static const char* Magic()
+    {
+        return "MRSTATUS";
+    }
+
+    static std::string ShmName(const std::string& name)
+    {
+        return name.empty() || name[0] != '/' ? "/" + name : name;
+    }
+
+    static void WriteBegin(std::atomic<uint64_t>& seq)
+    {
+        seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    static void WriteEnd(std::atomic<uint64_t>& seq)
+    {
+        seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    //  Wait for an even sequence, i.e. no write in progress, and return it.
+    static uint64_t ReadBegin(const std::atomic<uint64_t>& seq)
+    {
+        uint64_t s;
+        while ((s = seq.load(std::memory_order_acquire)) & 1)
+        {
+        }
+        return s;
+    }
+
+    static bool ReadEnd(const std::atomic<uint64_t>& seq, uint64_t begin)
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return seq.load(std::memory_order_relaxed) == begin;
+    }
+
+    std::string m_Name;
+    Shared* m_pShared;
+    SharedSlot* m_pSlot;
+    size_t m_Size;
+    bool m_Owner;
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+
+END_NAMESPACE(NSVirgo)
+
+#endif
@@ -12,6 +12,13 @@
 #include <algorithm>
 #include <functional>
 #include <stdexcept>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 #include "CommonMacro.h"
 
 //  please include this file in cpp file, if you want to use SplitUTF8/UTF16to8/UTF8to16
@@ -581,6 +588,117 @@ std::basic_string<TChar>& ReplaceEndInplace(std::basic_string<TChar>& str, const
 /** @} */
 
 
+/** @name String View Functions
+ *
+ *  Allocation-free versions of the functions above for char strings, which
+ *  refer to the input instead of copying it. Blanks are space, tab, CR and
+ *  LF, as the default of Trim, and are scanned 16 (SSE2) or 32 (AVX2) bytes
+ *  at a time where the compiler targets them; single characters and strings
+ *  are found by memchr and memmem of the C library, which are vectorized.
+ */
+/** @{ */
+
+/** @class StringView
+ *  @brief A read-only reference to chars, like std::string_view of C++17.
+ *
+ *  The referred chars must outlive the view.
+ *
+ *  @date 2026-10-19
+ */
+class StringView
+{
+public:
+    static const size_type npos = static_cast<size_type>(-1);
+
+    StringView() : m_Data(NULL), m_Size(0) {}
+    StringView(const char* data, size_type size) : m_Data(data), m_Size(size) {}
+    StringView(const char* str) : m_Data(str), m_Size(strlen(str)) {}
+    StringView(const std::string& str) : m_Data(str.data()), m_Size(str.size()) {}
+
+    const char* data() const { return m_Data; }
+    size_type size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+    const char* begin() const { return m_Data; }
+    const char* end() const { return m_Data + m_Size; }
+    char operator[](size_type pos) const { return m_Data[pos]; }
+
+    /** @brief The view of at most n chars from pos, which must not be greater than size(). */
+    StringView substr(size_type pos, size_type n = npos) const
+    {
+        return StringView(m_Data + pos, std::min(n, m_Size - pos));
+    }
+
+    /** @brief Find c from pos, return its position or npos. */
+    size_type find(char c, size_type pos = 0) const
+    {
+        const void* p = pos < m_Size ? memchr(m_Data + pos, c, m_Size - pos) : NULL;
+        return p == NULL ? npos : static_cast<const char*>(p) - m_Data;
+    }
+
+    /** @brief Copy to a new string. */
+    std::string str() const { return std::string(m_Data, m_Size); }
+
+    bool operator==(const StringView& other) const
+    {
+        return m_Size == other.m_Size && memcmp(m_Data, other.m_Data, m_Size) == 0;
+    }
+
+    bool operator!=(const StringView& other) const { return !(*this == other); }
+
+private:
+    const char* m_Data;
+    size_type m_Size;
+};
+
+/** @brief Find the first blank in [begin, end), return end if none. */
+const char* FindBlank(const char* begin, const char* end);
+
+/** @brief Find the first char in [begin, end) that is not blank, return end if none. */
+const char* SkipBlank(const char* begin, const char* end);
+
+/** @brief Find the end of [begin, end) without trailing blanks. */
+const char* SkipBlankBack(const char* begin, const char* end);
+
+/** @brief The view of str without leading and trailing blanks. */
+StringView TrimView(StringView str);
+
+/** @brief Trim blanks in both left and right of str in place, like Trim with the default ATrim. */
+std::string& Trim(std::string& str);
+
+bool StartsWith(StringView str, StringView sub);
+
+bool EndsWith(StringView str, StringView sub);
+
+/** @brief Split str into views of the items separated by blanks.
+ *
+ *  @param[in] str The input string.
+ *  @param[in] result The output iterator of StringView.
+ *  @return Return the output iterator pointed to next output position.
+ */
+template <typename TOutputIter>
+TOutputIter SplitSpaceView(StringView str, TOutputIter result);
+
+/** @brief Split str into views of the items separated by sep, see SplitChar. */
+template <typename TOutputIter>
+TOutputIter SplitCharView(StringView str, TOutputIter result, char sep = ' ', bool output_empty = false);
+
+/** @brief Split str into views of the items separated by sep, see SplitString. */
+template <typename TOutputIter>
+TOutputIter SplitStringView(StringView str, TOutputIter result, StringView sep = " ", bool output_empty = false);
+
+/** @brief Append str with old_str replaced by new_str to out, see Replace.
+ *
+ *  @param[in]  str The input string.
+ *  @param[in]  old_str The old sub string.
+ *  @param[in]  new_str The new sub string.
+ *  @param[out] out The string appended to, no allocation once it has the capacity.
+ *  @param[out] pReplaced The number of replacing.
+ *  @return Return out.
+ */
+std::string& ReplaceAppend(StringView str, StringView old_str, StringView new_str, std::string& out, size_type* pReplaced = NULL);
+/** @} */
+
+
 /** @name Miscellaneous Functions
  *
  *  Miscellaneous functions.
@@ -1242,6 +1360,205 @@ inline std::string XMLAttribute(const std::string& str, const std::string& tag,
     return str.substr(attribute_start_pos, attribute_end_pos - attribute_start_pos);
 }
 
+BEGIN_NAMESPACE(detail)
+
+inline bool IsBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+#if defined(__SSE2__)
+//  Bit i is set if p[i] is blank, for 16 chars.
+inline unsigned BlankMask16(const char* p)
+{
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'))),
+        _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'))));
+    return static_cast<unsigned>(_mm_movemask_epi8(m));
+}
+#endif
+
+#if defined(__AVX2__)
+//  Bit i is set if p[i] is blank, for 32 chars.
+inline unsigned BlankMask32(const char* p)
+{
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'))));
+    return static_cast<unsigned>(_mm256_movemask_epi8(m));
+}
+#endif
+
+//  Find the first char in [p, end) which is blank or not, as blank.
+inline const char* ScanBlank(const char* p, const char* end, bool blank)
+{
+    //  short strings, e.g. a single leading blank, are done before any vector load
+    for (const char* stop=std::min(p + 4, end); p<stop; ++p)
+    {
+        if (IsBlank(*p) == blank)
+        {
+            return p;
+        }
+    }
+#if defined(__AVX2__)
+    for (; end - p >= 32; p += 32)
+    {
+        unsigned m = BlankMask32(p) ^ (blank ? 0u : 0xFFFFFFFFu);
+        if (m != 0)
+        {
+            return p + __builtin_ctz(m);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    for (; end - p >= 16; p += 16)
+    {
+        unsigned m = BlankMask16(p) ^ (blank ? 0u : 0xFFFFu);
+        if (m != 0)
+        {
+            return p + __builtin_ctz(m);
+        }
+    }
+#endif
+    for (; p<end && IsBlank(*p) != blank; ++p)
+    {
+    }
+    return p;
+}
+
+END_NAMESPACE(detail)
+
+inline const char* FindBlank(const char* begin, const char* end)
+{
+    return detail::ScanBlank(begin, end, true);
+}
+
+inline const char* SkipBlank(const char* begin, const char* end)
+{
+    return detail::ScanBlank(begin, end, false);
+}
+
+inline const char* SkipBlankBack(const char* begin, const char* end)
+{
+    for (const char* stop=end-std::min<size_type>(end - begin, 4); end>stop; --end)
+    {
+        if (!detail::IsBlank(end[-1]))
+        {
+            return end;
+        }
+    }
+#if defined(__SSE2__)
+    for (; end - begin >= 16; end -= 16)
+    {
+        unsigned m = ~detail::BlankMask16(end - 16) & 0xFFFFu;
+        if (m != 0)
+        {
+            return end - 16 + (32 - __builtin_clz(m));
+        }
+    }
+#endif
+    for (; end>begin && detail::IsBlank(end[-1]); --end)
+    {
+    }
+    return end;
+}
+
+inline StringView TrimView(StringView str)
+{
+    const char* begin = SkipBlank(str.begin(), str.end());
+    const char* end = SkipBlankBack(begin, str.end());
+    return StringView(begin, end - begin);
+}
+
+inline std::string& Trim(std::string& str)
+{
+    StringView view = TrimView(str);
+    str.erase(view.end() - str.data());
+    str.erase(0, view.begin() - str.data());
+    return str;
+}
+
+inline bool StartsWith(StringView str, StringView sub)
+{
+    return str.size() >= sub.size() && memcmp(str.data(), sub.data(), sub.size()) == 0;
+}
+
+inline bool EndsWith(StringView str, StringView sub)
+{
+    return str.size() >= sub.size() && memcmp(str.end() - sub.size(), sub.data(), sub.size()) == 0;
+}
+
+template <typename TOutputIter>
+TOutputIter SplitSpaceView(StringView str, TOutputIter result)
+{
+    const char* end = str.end();
+    for (const char* p=SkipBlank(str.begin(), end); p<end; )
+    {
+        const char* stop = FindBlank(p, end);
+        *result = StringView(p, stop - p);
+        ++result;
+        p = SkipBlank(stop, end);
+    }
+    return result;
+}
+
+template <typename TOutputIter>
+TOutputIter SplitCharView(StringView str, TOutputIter result, char sep, bool output_empty)
+{
+    return SplitStringView(str, result, StringView(&sep, 1), output_empty);
+}
+
+template <typename TOutputIter>
+TOutputIter SplitStringView(StringView str, TOutputIter result, StringView sep, bool output_empty)
+{
+    if (str.empty() || sep.empty())
+    {
+        return result;
+    }
+    const char* p = str.begin();
+    while (true)
+    {
+        const void* q = sep.size() == 1 ? memchr(p, sep[0], str.end() - p) : memmem(p, str.end() - p, sep.data(), sep.size());
+        const char* stop = q == NULL ? str.end() : static_cast<const char*>(q);
+        if (stop != p || output_empty)
+        {
+            *result = StringView(p, stop - p);
+            ++result;
+        }
+        if (stop == str.end())
+        {
+            break;
+        }
+        p = stop + sep.size();
+    }
+    return result;
+}
+
+inline std::string& ReplaceAppend(StringView str, StringView old_str, StringView new_str, std::string& out, size_type* pReplaced)
+{
+    size_type num = 0;
+    const char* p = str.begin();
+    while (!old_str.empty())
+    {
+        const void* q = memmem(p, str.end() - p, old_str.data(), old_str.size());
+        if (q == NULL)
+        {
+            break;
+        }
+        out.append(p, static_cast<const char*>(q) - p);
+        out.append(new_str.data(), new_str.size());
+        p = static_cast<const char*>(q) + old_str.size();
+        ++num;
+    }
+    out.append(p, str.end() - p);
+    if (pReplaced != NULL)
+    {
+        *pReplaced = num;
+    }
+    return out;
+}
+
 /////////////////////////////////////////////////////////////////////////////////
 
 END_NAMESPACE(NSStringHelper)
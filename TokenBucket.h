@@ -0,0 +1,67 @@
+#ifndef TOKEN_BUCKET_H_2026_10_19
+#define TOKEN_BUCKET_H_2026_10_19
+
+#include <atomic>
+#include <stdint.h>
+#include "CommonMacro.h"
+
+BEGIN_NAMESPACE(NSVirgo)
+
+/////////////////////////////////////////////////////////////////////////////////
+
+/** @class TokenBucket
+ *  @brief A token bucket limiting the rate of events, without a lock.
+ *
+ *  Tokens come at rate per second and at most burst of them are saved.
+ *  Reserve() takes the next token, whether it is there or still to come,
+ *  and returns when it is available; the caller waits until then on its
+ *  own, so nothing is held while waiting and callers are served in order.
+ *  Only the time the next token is due is kept (the theoretical arrival
+ *  time of the generic cell rate algorithm), moved by compare-and-swap.
+ *  Thread-safe.
+ *
+ *  @date 2026-10-19
+ */
+class TokenBucket
+{
+public:
+    TokenBucket(double rate, uint64_t burst)
+        : m_Interval(static_cast<uint64_t>(1e9 / rate)), m_Credit((burst - 1) * m_Interval), m_Due(0)
+    {
+    }
+
+    /** @brief Take a token at time now, in nanoseconds of any clock.
+     *
+     *  @return Return the time the token is available, now if it is there.
+     */
+    uint64_t Reserve(uint64_t now)
+    {
+        //  a token not taken is saved, up to the burst
+        uint64_t earliest = now > m_Credit ? now - m_Credit : 0;
+        uint64_t due = m_Due.load(std::memory_order_relaxed);
+        uint64_t take;
+        do
+        {
+            take = due > earliest ? due : earliest;
+        }
+        while (!m_Due.compare_exchange_weak(due, take + m_Interval, std::memory_order_relaxed));
+        return take > now ? take : now;
+    }
+
+    /** @brief The time the next token is available, Reserve() returns no sooner. */
+    uint64_t Due() const
+    {
+        return m_Due.load(std::memory_order_relaxed);
+    }
+
+private:
+    const uint64_t m_Interval;              //  nanoseconds between tokens
+    const uint64_t m_Credit;                //  of the saved tokens but the one taken
+    std::atomic<uint64_t> m_Due;            //  when the next token comes if none is saved
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+
+END_NAMESPACE(NSVirgo)
+
+#endif
@@ -0,0 +1,279 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <stdint.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "CommandArena.h"
+#include "FileBuiltin.h"
+#include "StringHelper.h"
+
+using namespace std;
+using namespace NSVirgo;
+
+//  Micro benchmarks of the data structures of multirun, run by "make bench".
+
+uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+//  Fill a heap with n commands of random priority, then take them all, as a
+//  long queue is drained. Report nanoseconds per push and per pop.
+void BenchHeap(size_type n)
+{
+    CommandArena arena;
+    CommandHeap heap;
+    const string cmd = "gzip /path/to/input/file.txt";
+    srand(1);
+    uint64_t t0 = NowNs();
+    for (size_type i=0; i<n; ++i)
+    {
+        int priority = rand() % 16;
+        heap.push(arena.Create(cmd.data(), cmd.size(), 0, i, 0, priority), priority);
+    }
+    uint64_t t1 = NowNs();
+    int last = 16;
+    for (size_type i=0; i<n; ++i)
+    {
+        CommandHandle handle = heap.pop();
+        if (handle.Priority() > last)
+        {
+            cerr << "heap order error" << endl;
+            exit(1);
+        }
+        last = handle.Priority();
+    }
+    uint64_t t2 = NowNs();
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%10zu %12.1f %12.1f %14.1f", n, double(t1 - t0) / n, double(t2 - t1) / n,
+        double(t2 - t1) / n / log2(double(n)));
+    cout << buf << endl;
+}
+
+//  Take commands from a heap of n queued commands while pushing new ones,
+//  e.g. urgent commands injected into a long queue.
+void BenchSteady(size_type n)
+{
+    CommandArena arena;
+    CommandHeap heap;
+    const string cmd = "gzip /path/to/input/file.txt";
+    srand(2);
+    for (size_type i=0; i<n; ++i)
+    {
+        heap.push(arena.Create(cmd.data(), cmd.size(), 0, i, 0, 0), 0);
+    }
+    const size_type ops = 1000000;
+    uint64_t t0 = NowNs();
+    for (size_type i=0; i<ops; ++i)
+    {
+        heap.pop();
+        int priority = rand() % 1000 == 0 ? 10 : 0;
+        heap.push(arena.Create(cmd.data(), cmd.size(), 0, i, 0, priority), priority);
+    }
+    uint64_t t1 = NowNs();
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%10zu %12.1f", n, double(t1 - t0) / ops);
+    cout << buf << endl;
+}
+
+//  Run "sh -c cmd" as multirun does without builtins, return the wait status.
+int Spawn(const string& cmd)
+{
+    char* argv[] = {const_cast<char*>("sh"), const_cast<char*>("-c"), const_cast<char*>(cmd.c_str()), NULL};
+    pid_t child;
+    int status = -1;
+    if (posix_spawn(&child, "/bin/sh", NULL, NULL, argv, environ) == 0)
+    {
+        waitpid(child, &status, 0);
+    }
+    return status;
+}
+
+//  Touch then remove n files in a temporary directory, by FileBuiltin and
+//  by forking a shell, report microseconds per command.
+void BenchBuiltin(size_type n)
+{
+    char dir[] = "/tmp/multirun_bench.XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        cerr << "mkdtemp error" << endl;
+        exit(1);
+    }
+    double us[2][2];
+    for (int forked=0; forked<2; ++forked)
+    {
+        for (int op=0; op<2; ++op)
+        {
+            const char* prog = op == 0 ? "touch" : "rm";
+            uint64_t t0 = NowNs();
+            for (size_type i=0; i<n; ++i)
+            {
+                char file[64];
+                snprintf(file, sizeof(file), "%s/f%zu", dir, i);
+                int status = -1;
+                if (forked)
+                {
+                    status = Spawn(string(prog) + " " + file);
+                }
+                else
+                {
+                    char* argv[] = {const_cast<char*>(prog), file, NULL};
+                    FileBuiltin::Run(argv, status);
+                }
+                if (status != 0)
+                {
+                    cerr << prog << " failed: " << file << endl;
+                    exit(1);
+                }
+            }
+            us[forked][op] = (NowNs() - t0) / 1e3 / n;
+        }
+    }
+    rmdir(dir);
+    char buf[256];
+    for (int op=0; op<2; ++op)
+    {
+        snprintf(buf, sizeof(buf), "%10s %12.2f %12.2f %10.0fx", op == 0 ? "touch" : "rm", us[0][op], us[1][op],
+            us[1][op] / us[0][op]);
+        cout << buf << endl;
+    }
+}
+
+//  An annotated command file of about size bytes, indented as by hand.
+string CommandFile(size_type size)
+{
+    string text;
+    char buf[256];
+    for (size_type i=0; text.size()<size; ++i)
+    {
+        if (i % 2 == 0)
+        {
+            snprintf(buf, sizeof(buf), "  #@ priority=%zu cwd=/data/run%zu stdout=/data/out/%zu.txt idempotent\n", i % 7, i % 13, i);
+        }
+        else
+        {
+            snprintf(buf, sizeof(buf), "    gzip -9 /path/to/input/file%zu.txt   \n", i);
+        }
+        text += buf;
+    }
+    return text;
+}
+
+//  Split text into lines, trim them, look for directives and split the
+//  words of annotations, as multirun does for each input line, by the
+//  std::string helpers or by the StringView ones. Return the words found.
+size_type ParseLines(const string& text, bool view)
+{
+    size_type num = 0;
+    string line;
+    vector<string> words;
+    vector<NSStringHelper::StringView> views;
+    for (size_type begin=0, end; begin<text.size(); begin=end+1)
+    {
+        end = text.find('\n', begin);
+        line.assign(text, begin, end - begin);
+        if (view)
+        {
+            NSStringHelper::Trim(line);
+            if (NSStringHelper::StartsWith(line, "#foreach ") || !NSStringHelper::StartsWith(line, "#@"))
+            {
+                continue;
+            }
+            views.clear();
+            NSStringHelper::SplitSpaceView(NSStringHelper::StringView(line).substr(2), back_inserter(views));
+            num += views.size();
+        }
+        else
+        {
+            NSStringHelper::Trim<char>(line);
+            if (NSStringHelper::StartsWith(line, string("#foreach ")) || !NSStringHelper::StartsWith(line, string("#@")))
+            {
+                continue;
+            }
+            words.clear();
+            NSStringHelper::SplitSpace<string>(line.substr(2), back_inserter(words));
+            num += words.size();
+        }
+    }
+    return num;
+}
+
+//  Report MB/s of parsing an annotated command file, and of scanning long
+//  runs of blanks, against memchr over the same bytes as the bound.
+void BenchParse(size_type size)
+{
+    string text = CommandFile(size);
+    double mbs[3];
+    size_type num[2];
+    for (int k=0; k<3; ++k)
+    {
+        uint64_t t0 = NowNs();
+        if (k < 2)
+        {
+            num[k] = ParseLines(text, k == 1);
+        }
+        else if (memchr(text.data(), '\0', text.size()) != NULL)
+        {
+            cerr << "memchr error" << endl;
+        }
+        mbs[k] = text.size() / 1e6 / ((NowNs() - t0) * 1e-9);
+    }
+    if (num[0] != num[1])
+    {
+        cerr << "parse error: words " << num[0] << " != " << num[1] << endl;
+        exit(1);
+    }
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%10s %12.0f %12.0f %12.0f", "commands", mbs[0], mbs[1], mbs[2]);
+    cout << buf << endl;
+    //  long blank runs, e.g. aligned columns
+    string blanks(size, ' ');
+    blanks += 'x';
+    uint64_t t0 = NowNs();
+    size_type pos = blanks.find_first_not_of(" \r\n\t");
+    uint64_t t1 = NowNs();
+    const char* p = NSStringHelper::SkipBlank(blanks.data(), blanks.data() + blanks.size());
+    uint64_t t2 = NowNs();
+    const void* q = memchr(blanks.data(), 'x', blanks.size());
+    uint64_t t3 = NowNs();
+    if (pos != static_cast<size_type>(p - blanks.data()) || q != p)
+    {
+        cerr << "blank scan error" << endl;
+        exit(1);
+    }
+    snprintf(buf, sizeof(buf), "%10s %12.0f %12.0f %12.0f", "blanks", size * 1e3 / (t1 - t0), size * 1e3 / (t2 - t1),
+        size * 1e3 / (t3 - t2));
+    cout << buf << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    size_type max = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000000;
+    cout << "CommandHeap, fill then drain, random priorities:" << endl;
+    cout << "    queued      push(ns)      pop(ns) pop/log2(n)(ns)" << endl;
+    for (size_type n=1000; n<=max; n*=4)
+    {
+        BenchHeap(n);
+    }
+    cout << "CommandHeap, pop one and push one at a steady size:" << endl;
+    cout << "    queued  pop+push(ns)" << endl;
+    for (size_type n=1000; n<=max; n*=4)
+    {
+        BenchSteady(n);
+    }
+    cout << "FileBuiltin against sh -c, 2000 files:" << endl;
+    cout << "   command   builtin(us)  forked(us)   speedup" << endl;
+    BenchBuiltin(2000);
+    cout << "Parsing command files, 64 MB, by std::string and StringView helpers:" << endl;
+    cout << "     input  string(MB/s)   view(MB/s) memchr(MB/s)" << endl;
+    BenchParse(64 << 20);
+    return 0;
+}
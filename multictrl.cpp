@@ -0,0 +1,94 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include "StatusTable.h"
+
+using namespace std;
+using namespace NSVirgo;
+
+typedef string::size_type size_type;
+
+void Usage(int /* argc */, char* argv[])
+{
+    cerr << "Usage:" << endl;
+    cerr << "    " << argv[0] << " status NAME" << endl;
+    cerr << "Function:" << endl;
+    cerr << "    Control a running multirun." << endl;
+    cerr << "Command:" << endl;
+    cerr << "    status NAME          Print the counters and the running commands of the" << endl;
+    cerr << "                         multirun started with --status NAME, from shared" << endl;
+    cerr << "                         memory, without locking or signaling it." << endl;
+}
+
+//  Print seconds between two realtime nanoseconds, 0 if end is before start.
+void PrintSeconds(uint64_t start, uint64_t end)
+{
+    cout << fixed << setprecision(3) << (end > start ? (end - start) * 1e-9 : 0.0) << "s";
+}
+
+int Status(const string& name)
+{
+    errno = 0;
+    StatusTable* table = StatusTable::Open(name);
+    if (table == NULL)
+    {
+        cerr << "can not open status table " << name << ": " << (errno != 0 ? strerror(errno) : "invalid") << endl;
+        return 1;
+    }
+    StatusTable::Counters counters;
+    table->ReadCounters(counters);
+    uint64_t now = StatusTable::RealNs();
+    //  the table stays after a crash, tell whether the writer is alive
+    bool alive = kill(table->Pid(), 0) == 0 || errno == EPERM;
+    cout << "multirun pid " << table->Pid() << (alive ? "" : " (exited)") << ", up ";
+    PrintSeconds(table->Start(), now);
+    cout << ", updated ";
+    PrintSeconds(counters.updated, now);
+    cout << " ago" << endl;
+    static const char* const names[StatusTable::FIELD_NUM] = {"queued", "running", "completed", "failed",
+        "interrupted", "barriers"};
+    for (size_type i=0; i<StatusTable::FIELD_NUM; ++i)
+    {
+        cout << (i == 0 ? "" : "  ") << names[i] << " " << counters.value[i];
+    }
+    cout << endl;
+    cout << "thread\tpid\tinput\tnumber\telapsed\tcommand" << endl;
+    StatusTable::Slot slot;
+    for (size_type i=0; i<table->Slots(); ++i)
+    {
+        table->ReadSlot(i, slot);
+        cout << i << "\t";
+        if (slot.start == 0)
+        {
+            cout << "-\t-\t-\t-\tidle" << endl;
+            continue;
+        }
+        if (slot.pid != 0)
+        {
+            cout << slot.pid;
+        }
+        else
+        {
+            cout << "-";
+        }
+        cout << "\t" << slot.input << "\t" << slot.number << "\t";
+        PrintSeconds(slot.start, now);
+        cout << "\t" << slot.text << endl;
+    }
+    delete table;
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 3 && string(argv[1]) == "status")
+    {
+        return Status(argv[2]);
+    }
+    Usage(argc, argv);
+    return 1;
+}
@@ -4,57 +4,637 @@
 #include <string>
 #include <vector>
 #include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <ctime>
 #include <unistd.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include "StringHelper.h"
+#include "CommandArena.h"
+#include "ScheduleSimulator.h"
+#include "DedupFilter.h"
+#include "FileBuiltin.h"
+#include "LineMerger.h"
+#include "CompiledFile.h"
+#include "StatusTable.h"
+#include "SharedQueue.h"
+#include "JobServer.h"
+#include "TokenBucket.h"
 
 using namespace std;
 using namespace NSVirgo;
 
 typedef string::size_type size_type;
 
+//  Buffered line reader on a raw non-blocking descriptor.
+struct LineReader
+{
+    int fd;             //  -1 if not open
+    bool eof;
+    size_type begin;
+    size_type end;
+    string partial;     //  incomplete line before buf[begin]
+    char buf[65536];
+};
+
+//  Collects the stdout of a group of commands, each captured to its own
+//  file, into one output while they finish: CAT appends them in input
+//  order, MERGE merges sorted ones, see #reduce and #pipepart. Never freed
+//  before exit.
+struct Reducer
+{
+    enum Mode { CAT, MERGE } mode;
+    string output;
+    int out_fd;
+    size_type field;                //  MERGE: key field from 1, 0 for the whole line
+    bool numeric;
+    pthread_mutex_t mutex;          //  protects the following
+    size_type count;                //  commands given
+    deque<char> done;               //  CAT: per command from next, its output is complete
+    size_type next;                 //  CAT: next command to append
+    vector<string> runs;            //  MERGE: sorted files not merged yet
+    size_type merged;               //  MERGE: intermediate files made
+    size_type merging;              //  MERGE: merges in progress
+    size_type pending;              //  commands not done
+    bool closed;                    //  no more commands
+    bool finished;
+};
+
+//  A file split by #pipepart into newline-aligned parts, shared by the
+//  commands of its parts. Never freed before exit.
+struct PipePart
+{
+    string path;
+    int fd;                         //  the parts are spliced from it
+    const char* data;               //  mapped, for finding cut points
+    uint64_t size;
+    uint64_t block;                 //  nominal bytes per part
+    Reducer* reducer;               //  of OUTPUT, NULL for none
+    pthread_mutex_t mutex;          //  protects ends
+    vector<uint64_t> ends;          //  per part found, where it ends
+};
+
+//  One level of "#foreach VAR in SOURCE", iterated lazily.
+struct ForeachLoop
+{
+    enum { RANGE, LIST, PATH, STDIN, PART } type;
+    string var;
+    string value;                   //  current value
+    long long first, last, step;    //  RANGE
+    long long cur;
+    vector<string> words;           //  LIST
+    size_type index;
+    string path;                    //  PATH, "-" for STDIN
+    LineReader reader;              //  PATH and STDIN, filled by MainLoop
+    PipePart* part;                 //  PART, the current part is [begin, end)
+    uint64_t begin, end;
+    ForeachLoop() : type(LIST), part(NULL), begin(0), end(0)
+    {
+        reader.fd = -1;
+        reader.eof = false;
+        reader.begin = reader.end = 0;
+    }
+    ~ForeachLoop()
+    {
+        if (type == PATH && reader.fd >= 0)
+        {
+            close(reader.fd);
+        }
+    }
+};
+
+//  Results of moving a #foreach loop: no more values, the next value, or
+//  waiting for its input to be read.
+enum { FOREACH_END, FOREACH_VALUE, FOREACH_WAIT };
+
+//  How a #foreach loop moves: to its first value, to the first value of
+//  the input it waits for, or to its next value.
+enum { MOVE_FIRST, MOVE_READ, MOVE_NEXT };
+
+//  Flags of queued commands, the stages of a pipeline but one are kept
+//  above CMD_STAGE_SHIFT.
+enum { CMD_SYNC = 1, CMD_IDEMPOTENT = 2, CMD_BUILTIN = 4, CMD_STAGE_SHIFT = 8 };
+
+//  Annotations of a command, given by a #@ line before it.
+struct Annotation
+{
+    int priority;                   //  higher first
+    bool idempotent;                //  may be run twice, see --speculate
+    uint32_t spec;                  //  index in g_vSpec, 0 for none
+    uint64_t item;                  //  the part, or the command of the reducer, see ExecSpec
+    Annotation() : priority(0), idempotent(false), spec(0), item(0) {}
+};
+
+//  How to execute a command, from the annotations cwd, env, stdin, stdout
+//  and stderr, shared by the commands with equal ones. The commands of a
+//  #pipepart or #reduce group share one too, each tells its part or its
+//  place in the group by an item kept in its CommandRecord. Never freed.
+struct ExecSpec
+{
+    string cwd;                     //  empty for the current one
+    vector<string> env;             //  NAME=VALUE, overriding the environment
+    string redirect[3];             //  files of stdin, stdout, stderr, "&1" for stdout
+    bool append[3];                 //  append to stdout, stderr
+    vector<string> environ_all;     //  the environment with env applied
+    vector<char*> envp;             //  pointers to environ_all, NULL terminated
+    PipePart* part;                 //  stdin is part item of part, if not NULL
+    Reducer* reducer;               //  stdout is command reduce_base + item of reducer, if not NULL
+    size_type reduce_base;
+    size_type rate;                 //  1 + index in g_vRateGroup of rate=NAME, 0 for none
+    ExecSpec() : part(NULL), reducer(NULL), reduce_base(0), rate(0)
+    {
+        append[0] = append[1] = append[2] = false;
+    }
+};
+
+//  Commands of one job class of a source, protected by g_MutexQueue. The
+//  commands before the first #sync are in a priority queue, the rest wait
+//  in order until the #sync is passed.
+struct Lane
+{
+    CommandHeap ready;
+    CommandRing later;              //  from the first #sync on
+    size_type deficit;              //  commands left in this round
+    size_type bypassed;             //  times the head was passed over for locality
+    size_type start;                //  index in ready of the command to start, see Dispatchable
+    Lane() : deficit(0), bypassed(0), start(0) {}
+};
+
+//  One input command file or FIFO, with a queue (lane) per job class, see
+//  MainLoop and PickSource. A #sync is queued in every lane.
+struct Source
+{
+    size_type id;
+    string path;
+    size_type weight;               //  commands per scheduling round
+    LineReader reader;
+    bool exited;                    //  #exit is read
+    string line;
+    string pending;                 //  command waiting for room in queue
+    bool has_pending;
+    unsigned pending_flags;
+    Annotation pending_annot;
+    Annotation next_annot;          //  of #@, for the next command or template
+    vector<ForeachLoop*> loops;     //  #foreach for the next command
+    string tmpl;
+    Annotation tmpl_annot;
+    bool expanding;                 //  loops hold the next expansion of tmpl
+    size_type moving;               //  the loop to move, npos if none, see MoveLoops
+    int move;                       //  how it moves
+    string key;                     //  locality key of #locality, empty to infer
+    size_type cls;                  //  job class of #class
+    bool builtin;                   //  run simple file commands in process, see #builtin
+    Reducer* reducer;               //  of the open #reduce group, or NULL
+    uint32_t reduce_from;           //  the spec of the last command given to a reducer
+    uint32_t reduce_spec;           //  and the one it got, see AttachReducer
+    CompiledFile* compiled;         //  of a .mrc input, read instead of reader
+    uint64_t skip;                  //  commands left to skip, see --skip
+    //  protected by g_MutexQueue
+    vector<Lane> lanes;             //  one per job class
+    size_type items;
+    size_type bytes;
+    size_type running;
+    bool full;                      //  producer waits for room
+    bool failed;                    //  a command failed since the last #sync, with --halt segment
+    bool halted;                    //  the rest is cancelled, see CancelSegment
+    //  statistics
+    size_type dispatched;
+    size_type high_items;
+    size_type high_bytes;
+    size_type high_running;
+    size_type stalls;
+    double busy;                    //  slot-seconds
+    Source() : id(0), weight(1), exited(false), has_pending(false), pending_flags(0), expanding(false),
+        moving(string::npos), move(MOVE_FIRST), cls(0), builtin(false), reducer(NULL), reduce_from(0), reduce_spec(0),
+        compiled(NULL), skip(0), items(0), bytes(0), running(0), full(false),
+        failed(false), halted(false), dispatched(0), high_items(0), high_bytes(0), high_running(0), stalls(0), busy(0)
+    {
+        reader.fd = -1;
+        reader.eof = false;
+        reader.begin = reader.end = 0;
+    }
+};
+
+//  A job class with its own threads and lane in each source, see #class.
+struct JobClass
+{
+    string name;
+    size_type threads;
+    int nice;                       //  added to the nice value of commands
+    int ioprio;                     //  I/O priority of commands, -1 to inherit
+    pthread_cond_t cond;            //  a command of the class is queued
+    //  protected by g_MutexQueue
+    size_type turn;                 //  round robin position in g_vSource
+    size_type active;               //  threads running a command
+    size_type borrowed;             //  slots taken by the other stages of running pipelines
+    size_type dispatched;
+    double busy;                    //  slot-seconds
+    JobClass() : threads(0), nice(0), ioprio(-1), turn(0), active(0), borrowed(0), dispatched(0), busy(0) {}
+};
+
 const bool g_Print = false;
 string g_Program;
 bool g_Verbose = false;
-string g_CmdFile;
+vector<Source*> g_vSource;
+size_type g_SourcesOpen = 0;                //  sources without #exit yet
 vector<pthread_t> g_vThread;
-queue<string> g_qCommand;
+vector<JobClass*> g_vClass;                 //  0 is the default class of ThreadNum threads
+vector<size_type> g_vThreadClass;           //  job class of each thread
+CommandArena g_Arena;                       //  storage of queued commands
+vector<PipePart*> g_vPipePart;              //  of #pipepart, used by the producer and workers
+vector<Reducer*> g_vReducer;                //  of #reduce and #pipepart
+const size_type g_MergeFanIn = 8;           //  runs merged at once before the end of a #reduce group
+vector<ExecSpec*> g_vSpec(1, NULL);         //  execution specs, protected by g_MutexQueue
+unordered_map<string, uint32_t> g_SpecIndex;    //  serialized spec to its index
 pthread_mutex_t g_MutexQueue;
-pthread_mutex_t g_MutexLog;
-pthread_cond_t g_CondSync;
-pthread_cond_t g_CondNotEmpty;
-size_type g_AlreadySync;
+pthread_mutex_t g_MutexLog = PTHREAD_MUTEX_INITIALIZER;
 string g_LogFile;
 bool g_ErrorOccur = false;
+//  cancellation
+sigset_t g_SignalSet;                       //  signals handled by the signal thread
+pthread_t g_SignalThread;
+int g_WakePipe[2] = {-1, -1};               //  wakes the producer, see MainLoop
+volatile sig_atomic_t g_CancelSignal = 0;   //  first caught signal, 0 if not cancelled
+volatile sig_atomic_t g_KillSignal = SIGTERM;   //  signal currently sent to children
+int g_GracePeriod = 5;                      //  seconds between TERM and KILL
+pthread_mutex_t g_MutexChild;
+vector<pid_t> g_vChildPid;                  //  running child (= process group) per thread, 0 if idle
+size_type g_Interrupted = 0;                //  commands interrupted by cancellation
+//  bounded queue per source, 0 means unlimited
+size_type g_QueueMaxItems = 65536;
+size_type g_QueueMaxBytes = 64 << 20;
+size_type g_Dispatched = 0;                 //  commands taken from the queue
+//  live metrics, see MetricsFunction
+typedef atomic<unsigned long long> Counter;
+const double g_LatencyBucket[] = {0.001, 0.01, 0.1, 1, 10, 60};
+const size_type g_LatencyBucketNum = sizeof(g_LatencyBucket) / sizeof(g_LatencyBucket[0]);
+struct Metrics
+{
+    Counter queued;                 //  gauges
+    Counter running;
+    Counter completed;              //  counters
+    Counter failed;
+    Counter interrupted;
+    Counter barriers;               //  #sync passed
+    Counter barrier_waits;          //  a thread went idle because of a #sync
+    Counter producer_stalls;
+    Counter builtins;               //  commands run in process by FileBuiltin
+    Counter speculated;             //  speculative copies launched
+    Counter speculation_wins;       //  ... which finished before the original
+    Counter locality_tries;         //  dispatches to a thread with a previous key
+    Counter locality_hits;          //  ... of a command with the same key
+    Counter latency[g_LatencyBucketNum + 1];    //  enqueue to start, last is +Inf
+    Counter latency_sum;            //  nanoseconds
+} g_Metrics;
+Counter* g_pSlotBusy = NULL;                //  nanoseconds busy per thread
+Counter* g_pSlotStart = NULL;               //  start of running command per thread, 0 if idle
+uint64_t g_StartTime = 0;
+string g_MetricsFile;                       //  Prometheus textfile
+int g_MetricsPort = 0;                      //  HTTP listener on localhost
+int g_MetricsInterval = 5;                  //  seconds between textfile rewrites
+int g_PipeSize = 1 << 20;                   //  buffer of pipes between pipeline stages
+bool g_Builtins = false;                    //  #builtin for all inputs
+uint64_t g_Skip = 0;                        //  commands to skip at the start of each input
+string g_CompileInput;                      //  --compile, text command file
+string g_CompileOutput;                     //  --compile, compiled file
+string g_StatusName;                        //  --status, shared memory name
+StatusTable* g_pStatus = NULL;              //  NULL without --status
+pthread_mutex_t g_MutexStatus = PTHREAD_MUTEX_INITIALIZER;  //  one writer of the status counters
+string g_ShareName;                         //  --share, shared queue name
+SharedQueue* g_pShare = NULL;               //  NULL without --share
+int g_ShareMember = -1;                     //  of this process in g_pShare
+vector<uint64_t> g_vShareTicket;            //  of the shared command running per thread
+Counter g_SharePushed(0);                   //  commands this process pushed to g_pShare
+atomic<bool> g_ShareProduced(false);        //  ... and it pushes no more
+const size_type g_ShareCapacity = 1024;     //  cells of a new shared queue
+const uint64_t g_ShareLease = 10000000000ull;//  nanoseconds without heartbeat before a member is reaped
+int g_SharePipe[2] = {-1, -1};              //  stops the lease thread
+pthread_t g_ShareThread;
+string g_JobServerMode;                     //  --jobserver, fifo or pipe to serve, off, empty to join only
+JobServer* g_pJobServer = NULL;             //  slots shared with make, NULL if none
+//  failure policy, see CheckHalt and CancelSegment
+enum { HALT_NEVER, HALT_SOON, HALT_NOW };
+int g_HaltWhen = HALT_NEVER;                //  --halt now or soon, what a trigger does
+unsigned long long g_HaltFailures = 1;      //  failed commands that trigger it
+double g_HaltPercent = 0;                   //  ... or their percentage of finished ones, if not 0
+bool g_HaltSegment = false;                 //  --halt segment
+volatile sig_atomic_t g_Halted = HALT_NEVER; //  triggered, stop dispatching
+size_type g_HaltCancelled = 0;              //  queued commands dropped by segment, protected by g_MutexQueue
+//  start rate limits, see WaitRate
+TokenBucket* g_pRate = NULL;                //  --rate N/s for all commands, NULL if none
+vector<pair<string, TokenBucket*> > g_vRateGroup; //  --rate NAME=N/s, for #@ rate=NAME
+const size_type g_RateWindow = 64;          //  queued commands looked at past a head waiting for its group
+uint64_t g_RateDue = 0;                     //  when a token waited for by a head comes, 0 for none
+//  speculation, see FindStraggler
+double g_SpeculateFactor = 0;               //  copy commands running this times the median, 0 to disable
+const size_type g_DurationSamples = 31;     //  recent durations kept per program
+struct DurationSample
+{
+    float seconds[g_DurationSamples];
+    size_type num;
+    size_type next;
+    DurationSample() : num(0), next(0) {}
+};
+unordered_map<string, DurationSample> g_Durations;  //  per program, protected by g_MutexQueue
+//  The command running on a thread, protected by g_MutexQueue, kept with --speculate.
+struct SlotRun
+{
+    Source* src;                    //  NULL if idle
+    string cmd;
+    uint64_t start;
+    int nice;
+    const ExecSpec* spec;
+    uint64_t item;
+    bool idempotent;
+    bool copy;                      //  a speculative copy
+    bool lost;                      //  the other attempt finished first
+    size_type peer;                 //  thread of the other attempt, npos if none
+    SlotRun() : src(NULL), start(0), nice(0), spec(NULL), item(0), idempotent(false), copy(false), lost(false),
+        peer(string::npos) {}
+};
+vector<SlotRun> g_vSlotRun;
+vector<char> g_vChildLost;                  //  kill the child of a thread at spawn, protected by g_MutexChild
+size_type g_SpeculateLost = 0;              //  won by the original
+double g_SpeculateWasted = 0;               //  slot-seconds of killed attempts
+double g_SpeculateSaved = 0;                //  original minus copy elapsed, when the copy won
+//  priority, see Score
+uint64_t g_AgingNs = 60000000000ull;        //  waiting time worth one priority level, 0 for no aging
+//  locality, see PopLocal
+size_type g_LocalityWindow = 0;             //  0 to disable
+uint32_t* g_pSlotKey = NULL;                //  key of the last command per thread
+//  duplicate suppression, used by the producer only
+bool g_Dedup = false;
+size_type g_DedupMemory = 64 << 20;
+DedupFilter* g_pDedup = NULL;
+size_type g_DedupSkipped = 0;
+//  offline simulation, see Simulate
+vector<size_type> g_vSimulateSlots;         //  slot counts to simulate, empty to run
+vector<string> g_vHistoryFile;
+unordered_map<string, pair<double, size_type> > g_History;  //  seconds sum and count per command
+double g_HistoryMean = 0;                   //  duration of commands not in history
+size_type g_SimulateKnown = 0;
+size_type g_SimulateUnknown = 0;
+ScheduleSimulator g_Simulator;
+//  Chrome trace, see TraceBuffer
+string g_TraceFile;
+int g_TraceFd = -1;
+pthread_mutex_t g_MutexTrace = PTHREAD_MUTEX_INITIALIZER;
+int g_MetricsListen = -1;
+int g_MetricsPipe[2] = {-1, -1};            //  stops the metrics thread
+pthread_t g_MetricsThread;
+
+#ifdef ALLOC_STATS
+//  Count heap allocations, to check that dispatching a command does not
+//  allocate once warmed up, see "make test".
+atomic<size_type> g_AllocCount(0);
+size_type g_AllocWarm = 0;
+const size_type g_WarmCommands = 1000;
+
+void* operator new(size_t size)
+{
+    g_AllocCount.fetch_add(1, memory_order_relaxed);
+    void* p = malloc(size);
+    if (p == NULL)
+    {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+#endif
 
 ///////////////////////////////////////////////////////////////////////////
 
-void Usage(int argc, char* argv[])
+void Usage(int /* argc */, char* argv[])
 {
     cerr << "Usage:" << endl;
     cerr << "    " << argv[0] << " CmdFile ThreadNum [OPTION]" << endl;
     cerr << "Function:" << endl;
     cerr << "    Read command from pipe file, multi-run commands." << endl;
     cerr << "Option:" << endl;
-    cerr << "    CmdFile              The input command file." << endl;
+    cerr << "    CmdFile              The input command file, as FILE[:WEIGHT], - for none" << endl;
+    cerr << "                         with --share." << endl;
     cerr << "    ThreadNum            The thread number to run." << endl;
+    cerr << "    -i, --input [F[:W]]  Another input command file or FIFO, read concurrently." << endl;
+    cerr << "                         Each input has its own queue, and gets W (default 1)" << endl;
+    cerr << "                         commands per round of the fair-share scheduler." << endl;
     cerr << "        --help           Display this message and exit." << endl;
     cerr << "        --verbose        Verbose mode." << endl;
     cerr << "    -l, --log-file [F]   Output log file. If not specified, ignored." << endl;
+    cerr << "    -q, --queue-size [N] Maximum queued commands per input, 0 for unlimited," << endl;
+    cerr << "                         default 65536." << endl;
+    cerr << "        --queue-bytes [B]" << endl;
+    cerr << "                         Maximum queued command bytes per input, 0 for unlimited," << endl;
+    cerr << "                         default 64M. An input is not read while its queue is full." << endl;
+    cerr << "        --class [NAME:N[:NICE[:IOPRIO]]]" << endl;
+    cerr << "                         Add a job class with its own N threads and queue, for" << endl;
+    cerr << "                         commands after #class NAME. Its commands get NICE added" << endl;
+    cerr << "                         to their nice value and I/O priority IOPRIO, which is" << endl;
+    cerr << "                         idle, be[/LEVEL] or rt[/LEVEL]. ThreadNum is the number" << endl;
+    cerr << "                         of threads of the default class." << endl;
+    cerr << "        --aging [S]      Seconds of waiting that raise a command by one priority" << endl;
+    cerr << "                         level, default 60, 0 for strict priority." << endl;
+    cerr << "        --builtins       Run simple rm, mkdir, mv, cp and touch commands in" << endl;
+    cerr << "                         process, as #builtin in every input." << endl;
+    cerr << "        --skip [N]       Skip the first N commands of each input, e.g. to resume," << endl;
+    cerr << "                         a template counts as one. Directives apply as usual." << endl;
+    cerr << "        --compile [IN] [OUT]" << endl;
+    cerr << "                         Compile the command file IN to OUT, which should end in" << endl;
+    cerr << "                         .mrc, and exit. Inputs ending in .mrc are read as such:" << endl;
+    cerr << "                         mapped, pre-parsed, indexed for --skip, and checksummed." << endl;
+    cerr << "        --status [NAME]  Publish counters and running commands in the shared" << endl;
+    cerr << "                         memory NAME, read by \"multictrl status NAME\". Fails" << endl;
+    cerr << "                         if NAME is in use by a running process." << endl;
+    cerr << "        --share [NAME]   Push the commands to the shared memory queue NAME, and" << endl;
+    cerr << "                         run those of every multirun attached to it, which may" << endl;
+    cerr << "                         come and go. A #sync waits for all commands pushed" << endl;
+    cerr << "                         before by this process. Not with --class, --halt," << endl;
+    cerr << "                         --speculate, annotations of cwd, env, redirection or" << endl;
+    cerr << "                         rate, or #reduce." << endl;
+    cerr << "        --jobserver [MODE]" << endl;
+    cerr << "                         Take a slot of the GNU make jobserver in MAKEFLAGS for" << endl;
+    cerr << "                         each command, which is done by default. Without one," << endl;
+    cerr << "                         serve ThreadNum slots in a fifo (make 4.4) or a pipe" << endl;
+    cerr << "                         as MODE, shared by children that understand it, e.g." << endl;
+    cerr << "                         make -j or multirun. off ignores MAKEFLAGS." << endl;
+    cerr << "        --speculate [F]  Run a copy of an idempotent command on an idle thread" << endl;
+    cerr << "                         when its input waits at #sync and it has run F times" << endl;
+    cerr << "                         the median of recent runs of its program, the first" << endl;
+    cerr << "                         attempt to finish is taken and the other killed. Not" << endl;
+    cerr << "                         for commands with stdout or stderr redirected." << endl;
+    cerr << "        --locality [W]   Prefer giving a thread commands with the locality key of" << endl;
+    cerr << "                         its previous one, looking W commands ahead of the queue" << endl;
+    cerr << "                         head, which is passed over at most W times. The key is" << endl;
+    cerr << "                         set by #locality or is the first argument of a command." << endl;
+    cerr << "        --dedup          Skip commands identical to one seen before in this run." << endl;
+    cerr << "        --dedup-memory [B]" << endl;
+    cerr << "                         Memory for --dedup, default 64M. Beyond half of it a Bloom" << endl;
+    cerr << "                         filter of the other half is used, which may skip a new" << endl;
+    cerr << "                         command rarely." << endl;
+    cerr << "        --metrics-file [F]" << endl;
+    cerr << "                         Rewrite metrics in Prometheus text format to F." << endl;
+    cerr << "        --metrics-port [P]" << endl;
+    cerr << "                         Serve metrics by HTTP on 127.0.0.1:P." << endl;
+    cerr << "        --metrics-interval [S]" << endl;
+    cerr << "                         Seconds between rewrites of the metrics file, default 5." << endl;
+    cerr << "        --trace [F]      Write the schedule as Chrome trace-event JSON to F, one" << endl;
+    cerr << "                         track per thread, viewable in chrome://tracing or Perfetto." << endl;
+    cerr << "        --simulate [N[,N...]]" << endl;
+    cerr << "                         Do not run, predict makespan, utilization and barrier" << endl;
+    cerr << "                         idle time with N threads, ThreadNum may be omitted." << endl;
+    cerr << "        --history [F]    Command durations for --simulate, a log file of multirun" << endl;
+    cerr << "                         or lines of SECONDS<TAB>COMMAND, may be repeated." << endl;
+    cerr << "        --rate [[NAME=]N/s[:B]]" << endl;
+    cerr << "                         Start at most N commands per second, or per minute or" << endl;
+    cerr << "                         hour with /m or /h, after a burst of B, default 1." << endl;
+    cerr << "                         With NAME only those annotated rate=NAME, may be" << endl;
+    cerr << "                         repeated. A command waiting for a token of its group" << endl;
+    cerr << "                         is passed by those behind it, but not by those after" << endl;
+    cerr << "                         a #sync; for the global limit a thread waits." << endl;
+    cerr << "        --halt [POLICY]  What to do when commands fail, comma separated: now to" << endl;
+    cerr << "                         kill the running commands and stop, soon to stop" << endl;
+    cerr << "                         dispatching and let them finish, after-N-failures or" << endl;
+    cerr << "                         after-X%-failures to trigger on a count, default 1, or" << endl;
+    cerr << "                         a rate; segment to cancel the rest of an input after" << endl;
+    cerr << "                         the #sync that ends a segment with a failed command." << endl;
+    cerr << "                         The exit status is then the number of failed commands," << endl;
+    cerr << "                         101 for more than 100." << endl;
+    cerr << "    -g, --grace-period [S]" << endl;
+    cerr << "                         Seconds to wait after forwarding SIGTERM to running" << endl;
+    cerr << "                         commands before sending SIGKILL, default 5." << endl;
     cerr << "Note:" << endl;
     cerr << "    Special commands begin with #:" << endl;
-    cerr << "    #sync    Synchronize commands" << endl;
+    cerr << "    #sync    Wait until all previous commands of the same input finished." << endl;
     cerr << "    #exit    End this multirun program." << endl;
+    cerr << "    #@ KEY=VALUE ..." << endl;
+    cerr << "             Annotate the next command or #foreach template, KEY is:" << endl;
+    cerr << "             priority  Higher runs first, default 0, equal ones in order." << endl;
+    cerr << "                       A negative one also raises the nice value. Only" << endl;
+    cerr << "                       queued commands are reordered, not those behind a" << endl;
+    cerr << "                       full queue (see -q); give urgent ones their own -i." << endl;
+    cerr << "             idempotent  May run twice at once, see --speculate." << endl;
+    cerr << "             rate=NAME Limit the start rate as --rate NAME=N/s." << endl;
+    cerr << "             cwd=DIR   Run in directory DIR." << endl;
+    cerr << "             env=NAME=VALUE" << endl;
+    cerr << "                       Set an environment variable, may be repeated." << endl;
+    cerr << "             stdin=F, stdout=F, stderr=F" << endl;
+    cerr << "                       Redirect from or to file F, stdout+=F and stderr+=F" << endl;
+    cerr << "                       append, stderr=&1 to stdout. Relative to cwd." << endl;
+    cerr << "    #class NAME" << endl;
+    cerr << "             Run the following commands of the same input in job class" << endl;
+    cerr << "             NAME, an empty NAME for the default class." << endl;
+    cerr << "    A #| B   Run the pipeline of commands A and B, not special to /bin/sh:" << endl;
+    cerr << "             both start together, each stage takes a thread of its class," << endl;
+    cerr << "             and the stdout of A is the stdin of B by a pipe." << endl;
+    cerr << "    #builtin [on|off]" << endl;
+    cerr << "             Run the following simple rm [-f], mkdir [-p], mv, cp and touch" << endl;
+    cerr << "             commands of the same input in process, without a shell." << endl;
+    cerr << "    #locality KEY" << endl;
+    cerr << "             Set the locality key of the following commands of the same" << endl;
+    cerr << "             input, an empty KEY infers it from the command again." << endl;
+    cerr << "    #foreach VAR in SOURCE" << endl;
+    cerr << "             Run the next command line once per value of VAR, with {VAR}" << endl;
+    cerr << "             (or {} for the innermost VAR) replaced. SOURCE is a range" << endl;
+    cerr << "             FIRST..LAST[..STEP], @FILE or @- (stdin) for one value per" << endl;
+    cerr << "             line, or a list of words. Consecutive #foreach lines sweep" << endl;
+    cerr << "             their Cartesian product, expanded lazily." << endl;
+    cerr << "    #pipepart FILE [BLOCK [OUTPUT]]" << endl;
+    cerr << "             Run the next command line once per part of FILE, newline aligned" << endl;
+    cerr << "             parts of about BLOCK bytes (one per thread by default), with the" << endl;
+    cerr << "             part on stdin and {part} replaced by its number. The outputs are" << endl;
+    cerr << "             concatenated to OUTPUT in order if given." << endl;
+    cerr << "    #reduce cat|merge OUTPUT [FIELD[n]] ... #reduce end" << endl;
+    cerr << "             Reduce the stdout of the commands in between to OUTPUT while" << endl;
+    cerr << "             they run: cat concatenates them in input order, merge merges" << endl;
+    cerr << "             sorted outputs by the whole line or by blank separated FIELD," << endl;
+    cerr << "             numerically with n." << endl;
+    cerr << "    On SIGINT/SIGTERM/SIGHUP dispatching stops and running commands are" << endl;
+    cerr << "    terminated, a second signal kills them at once. Exit status is 0 if" << endl;
+    cerr << "    all commands succeeded, 1 if any failed, 128+SIGNAL if interrupted." << endl;
     exit(1);
 }
 
+//  Monotonic clock in nanoseconds.
+uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//  Append decimal integer to string without ostringstream.
+void AppendInteger(string& str, unsigned long long value, bool negative = false)
+{
+    char buf[24];
+    char* p = buf + sizeof(buf);
+    do
+    {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    if (negative)
+    {
+        *--p = '-';
+    }
+    str.append(p, buf + sizeof(buf) - p);
+}
+
+/** Replacement of ostringstream for log lines, which does not allocate
+ *  once its buffer has grown to the longest line.
+ */
+class LogStream
+{
+public:
+    LogStream& operator<<(const char* s) { m_Str += s; return *this; }
+    LogStream& operator<<(const string& s) { m_Str += s; return *this; }
+    LogStream& operator<<(char c) { m_Str += c; return *this; }
+    LogStream& operator<<(int v) { return *this << static_cast<long long>(v); }
+    LogStream& operator<<(long v) { return *this << static_cast<long long>(v); }
+    LogStream& operator<<(long long v)
+    {
+        AppendInteger(m_Str, v < 0 ? -static_cast<unsigned long long>(v) : v, v < 0);
+        return *this;
+    }
+    LogStream& operator<<(unsigned int v) { AppendInteger(m_Str, v); return *this; }
+    LogStream& operator<<(unsigned long v) { AppendInteger(m_Str, v); return *this; }
+    LogStream& operator<<(unsigned long long v) { AppendInteger(m_Str, v); return *this; }
+    LogStream& operator<<(double v)
+    {
+        char buf[32];
+        m_Str.append(buf, snprintf(buf, sizeof(buf), "%.6g", v));
+        return *this;
+    }
+    const string& str() const { return m_Str; }
+    void str(const char* s) { m_Str.assign(s); }
+private:
+    string m_Str;
+};
+
 void LogFile(const string& content)
 {
-    static ofstream fout;
+    static int fd = -1;
     if (g_LogFile.empty())
     {
         return;
@@ -63,428 +643,4659 @@ void LogFile(const string& content)
     {
         return;
     }
-    //int ret;
+    int ret;
     //  lock g_MutexLog
-    //ret = pthread_mutex_lock(&g_MutexLog);
-    //if (ret != 0)
-    //{
-    //    cerr << "pthread_mutex_lock error: g_MutexLog: error=" << ret << endl;
-    //    exit(1);
-    //}
+    ret = pthread_mutex_lock(&g_MutexLog);
+    if (ret != 0)
+    {
+        cerr << "pthread_mutex_lock error: g_MutexLog: error=" << ret << endl;
+        exit(1);
+    }
     //  open
-    if (!fout.is_open())
+    if (fd < 0)
     {
-        fout.open(g_LogFile.c_str());
-        if (!fout.good())
+        fd = open(g_LogFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
         {
             cerr << g_Program << ": open file error: " << g_LogFile << endl;
             exit(1);
         }
     }
-    //  write
-    if (!content.empty())
+    //  write, one line per call
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(content.data());
+    iov[0].iov_len = content.size();
+    iov[1].iov_base = const_cast<char*>("\n");
+    iov[1].iov_len = 1;
+    if (writev(fd, iov, 2) < 0)
     {
-        fout << content << endl;
+        cerr << g_Program << ": write file error: " << g_LogFile << endl;
+    }
+    //  unlock g_MutexLog
+    ret = pthread_mutex_unlock(&g_MutexLog);
+    if (ret != 0)
+    {
+        cerr << "pthread_mutex_unlock error: g_MutexLog: error=" << ret << endl;
+        exit(1);
     }
-    ////  unlock g_MutexLog
-    //ret = pthread_mutex_unlock(&g_MutexLog);
-    //if (ret != 0)
-    //{
-    //    cerr << "pthread_mutex_unlock error: g_MutexLog: error=" << ret << endl;
-    //    exit(1);
-    //}
-}
-
-int ExecCommand(const string& cmd)
-{
-    return system(cmd.c_str());
 }
 
-void* ThreadFunction(void* arg)
+//  Write whole buffer, return false on error.
+bool WriteAll(int fd, const char* buf, size_type len)
 {
-    int ret;
-    string cmd;
-    bool runflag = true;
-    size_type pid = *static_cast<size_type*>(arg);
-    while (runflag)
+    while (len > 0)
     {
-        cmd = "";
-        //  lock g_MutexQueue
-        ret = pthread_mutex_lock(&g_MutexQueue);
-        if (ret != 0)
-        {
-            cerr << "pthread_mutex_lock error: g_MutexQueue: error=" << ret << endl;
-            exit(1);
-        }
-        //  wait g_CondNotEmpty
-        if (g_Print)
-        {
-            cerr << "thread " << pid << ": enter g_qCommand.empty()" << endl;
-        }
-        while (g_qCommand.empty())
+        ssize_t n = write(fd, buf, len);
+        if (n < 0)
         {
-            if (g_Print)
-            {
-                cerr << "thread " << pid << ": enter pthread_cond_wait g_CondNotEmpty" << endl;
-            }
-            ret = pthread_cond_wait(&g_CondNotEmpty, &g_MutexQueue);
-            if (ret != 0)
-            {
-                cerr << "pthread_cond_wait error: g_CondNotEmpty: error=" << ret << endl;
-                exit(1);
-            }
-            if (g_Print)
+            if (errno == EINTR)
             {
-                cerr << "thread " << pid << ": leave pthread_cond_wait g_CondNotEmpty" << endl;
+                continue;
             }
+            return false;
         }
-        if (g_Print)
-        {
-            cerr << "thread " << pid << ": leave g_qCommand.empty()" << endl;
-        }
-        //  get command
-        assert(!g_qCommand.empty());
-        cmd = g_qCommand.front();
-        ostringstream log_oss;
-        log_oss << "thread " << pid << ": get command: &" << cmd << "&";
-        LogFile(log_oss.str().c_str());
-        //  process
-        if (cmd == "#exit")
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+//  One trace event, name is static or an offset into TraceBuffer::names.
+struct TraceEvent
+{
+    char phase;             //  'X' complete, 'i' instant
+    const char* name;       //  NULL if in names
+    uint32_t name_off;
+    uint32_t name_len;
+    uint64_t ts;            //  nanoseconds since start
+    uint64_t dur;
+    uint64_t source;
+    uint64_t depth;         //  queue depth, for queue events
+};
+
+//  Trace events buffered per thread, written to g_TraceFd in batches, so
+//  that threads do not contend while running.
+struct TraceBuffer
+{
+    uint32_t tid;           //  0 for producer, slot + 1 for threads
+    vector<TraceEvent> events;
+    string names;
+};
+vector<TraceBuffer*> g_vTrace;              //  slots, then producer
+
+void AppendJsonString(string& out, const char* str, size_type len)
+{
+    out += '"';
+    for (size_type i=0; i<len; ++i)
+    {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\')
         {
-            runflag = false;
+            out += '\\';
+            out += c;
         }
-        else if (cmd == "#sync")
+        else if (c < 0x20)
         {
-            ++g_AlreadySync;
-            if (g_AlreadySync >= g_vThread.size())
-            {
-                //  last sync thread
-                g_AlreadySync = 0;
-                ret = pthread_cond_broadcast(&g_CondSync);
-                if (ret != 0)
-                {
-                    cerr << "pthread_cond_broadcast error: g_CondSync: error=" << ret << endl;
-                    exit(1);
-                }
-                g_qCommand.pop();
-            }
-            else
-            {
-                //  not last sync thread
-                ret = pthread_cond_wait(&g_CondSync, &g_MutexQueue);
-                if (ret != 0)
-                {
-                    cerr << "pthread_cond_wait error: g_CondSync: error=" << ret << endl;
-                    exit(1);
-                }
-            }
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
         }
         else
         {
-            g_qCommand.pop();
-        }
-        //  unlock g_MutexQueue
-        ret = pthread_mutex_unlock(&g_MutexQueue);
-        if (ret != 0)
-        {
-            cerr << "pthread_mutex_unlock error: g_MutexQueue: error=" << ret << endl;
-            exit(1);
-        }
-        //  exec
-        assert(!cmd.empty());
-        if (cmd[0] != '#')
-        {
-            ostringstream log_oss;
-            if (0 == ExecCommand(cmd.c_str()))
-            {
-                log_oss << "thread " << pid << ": execute done command: &" << cmd << "&";
-            }
-            else
-            {
-                log_oss << "thread " << pid << ": execute failed command: &" << cmd << "&";
-                g_ErrorOccur = true;
-            }
-            LogFile(log_oss.str());
+            out += c;
         }
     }
-    if (g_Print)
-    {
-        cerr << "thread " << pid << ": leave ThreadFunction" << endl;
-    }
-    return NULL;
+    out += '"';
 }
 
-void InitOption(int argc, char* argv[])
+//  Append nanoseconds as microseconds with one decimal.
+void AppendMicros(string& out, uint64_t ns)
 {
-    g_Program = argv[0];
-    for (int i=1; i<argc; ++i)
+    AppendInteger(out, ns / 1000);
+    out += '.';
+    out += static_cast<char>('0' + ns / 100 % 10);
+}
+
+//  Write buffered events to the trace file and clear the buffer.
+void FlushTrace(TraceBuffer* buf)
+{
+    if (g_TraceFd < 0 || buf->events.empty())
     {
-        const string arg = argv[i];
-        if (arg == "--help")
+        return;
+    }
+    string out;
+    for (size_type i=0; i<buf->events.size(); ++i)
+    {
+        const TraceEvent& e = buf->events[i];
+        out += ",\n{\"ph\":\"";
+        out += e.phase;
+        out += "\",\"pid\":1,\"tid\":";
+        AppendInteger(out, buf->tid);
+        out += ",\"ts\":";
+        AppendMicros(out, e.ts);
+        out += ",\"name\":";
+        if (e.name != NULL)
         {
-            Usage(argc, argv);
+            AppendJsonString(out, e.name, strlen(e.name));
         }
-        else if (arg == "--verbose")
+        else
         {
-            g_Verbose = true;
+            AppendJsonString(out, buf->names.data() + e.name_off, e.name_len);
         }
-        else if (arg == "-l" || arg == "--log-file")
+        if (e.phase == 'X')
         {
-            ++i;
-            if (i >= argc)
-            {
-                cerr << argv[0] << ": missing argument for option " << arg << endl;
-                exit(1);
-            }
-            g_LogFile = argv[i];
+            out += ",\"dur\":";
+            AppendMicros(out, e.dur);
         }
-        else if (arg[0] == '-')
+        else
         {
-            cerr << argv[0] << ": invalid option: " << arg << endl;
-            exit(1);
+            out += ",\"s\":\"t\"";
         }
-        else
+        out += ",\"args\":{\"source\":";
+        AppendInteger(out, e.source);
+        if (e.phase != 'X')
         {
-            if (g_CmdFile.empty())
-            {
-                g_CmdFile = arg;
-            }
-            else if (g_vThread.empty())
-            {
-                int threadnum = atoi(arg.c_str());
-                g_vThread.resize(threadnum, static_cast<pthread_t>(-1));
-            }
-            else 
-            {
-                cerr << argv[0] << ": extra operand: " << arg << endl;
-                exit(1);
-            }
+            out += ",\"depth\":";
+            AppendInteger(out, e.depth);
         }
+        out += "}}";
     }
-    if (g_CmdFile.empty() || g_vThread.empty())
+    pthread_mutex_lock(&g_MutexTrace);
+    WriteAll(g_TraceFd, out.data(), out.size());
+    pthread_mutex_unlock(&g_MutexTrace);
+    buf->events.clear();
+    buf->names.clear();
+}
+
+void TraceAdd(TraceBuffer* buf, const TraceEvent& e)
+{
+    buf->events.push_back(e);
+    if (buf->events.size() >= 16384)
     {
-        Usage(argc, argv);
+        FlushTrace(buf);
     }
-    g_AlreadySync = 0;
-    ////  mkfifo
-    //if (mkfifo(g_CmdFile.c_str(), S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH))
-    //{
-    //    if (errno == EEXIST)
-    //    {
-    //        cerr << "mkfifo error: file exist [ignored]: " << g_CmdFile << endl;
-    //    }
-    //    else
-    //    {
-    //        cerr << "mkfifo error: " << g_CmdFile << endl;
-    //        exit(1);
-    //    }
-    //}
-    if (g_Verbose)
+}
+
+//  A span of a command on a thread, from dispatch to exit.
+void TraceSpan(size_type pid, uint64_t start, uint64_t finish, const string& cmd, size_type source)
+{
+    if (g_TraceFd < 0)
     {
-        cerr << "g_Verbose        : " << g_Verbose << endl;
-        cerr << "g_CmdFile        : " << g_CmdFile << endl;
-        cerr << "g_vThread.size() : " << g_vThread.size() << endl;
-        cerr << "g_LogFile        : " << g_LogFile << endl;
+        return;
     }
+    TraceBuffer* buf = g_vTrace[pid];
+    TraceEvent e;
+    e.phase = 'X';
+    e.name = NULL;
+    e.name_off = buf->names.size();
+    e.name_len = cmd.size();
+    e.ts = start - g_StartTime;
+    e.dur = finish - start;
+    e.source = source;
+    e.depth = 0;
+    buf->names += cmd;
+    TraceAdd(buf, e);
 }
 
-void InitThread()
+//  An instant event of thread pid, or of the producer if pid is g_vThread.size().
+void TraceInstant(size_type pid, const char* name, size_type source, size_type depth)
 {
-    assert(!g_vThread.empty());
-    int ret;
-    size_type i;
-    //  init mutex 
-    ret = pthread_mutex_init(&g_MutexQueue, NULL);
-    if (ret != 0)
+    if (g_TraceFd < 0)
     {
-        cerr << "pthread_mutex_init error: g_MutexQueue: error=" << ret << endl;
-        exit(1);
+        return;
     }
-    ret = pthread_mutex_init(&g_MutexLog, NULL);
-    if (ret != 0)
+    TraceEvent e;
+    e.phase = 'i';
+    e.name = name;
+    e.name_off = e.name_len = 0;
+    e.ts = NowNs() - g_StartTime;
+    e.dur = 0;
+    e.source = source;
+    e.depth = depth;
+    TraceAdd(g_vTrace[pid], e);
+}
+
+void InitTrace()
+{
+    if (g_TraceFile.empty())
     {
-        cerr << "pthread_mutex_init error: g_MutexLog: error=" << ret << endl;
+        return;
+    }
+    g_TraceFd = open(g_TraceFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (g_TraceFd < 0)
+    {
+        cerr << g_Program << ": open file error: " << g_TraceFile << endl;
         exit(1);
     }
-    //  init cond
-    ret = pthread_cond_init(&g_CondSync, NULL);
+    LogStream out;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+        << "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"multirun\"}},\n"
+        << "{\"ph\":\"M\",\"pid\":1,\"tid\":0,\"name\":\"thread_name\",\"args\":{\"name\":\"producer\"}}";
+    for (size_type i=0; i<=g_vThread.size(); ++i)
+    {
+        TraceBuffer* buf = new TraceBuffer();
+        buf->tid = (i < g_vThread.size()) ? i + 1 : 0;
+        g_vTrace.push_back(buf);
+        if (i < g_vThread.size())
+        {
+            out << ",\n{\"ph\":\"M\",\"pid\":1,\"tid\":" << buf->tid
+                << ",\"name\":\"thread_name\",\"args\":{\"name\":\"slot " << i << "\"}}";
+        }
+    }
+    WriteAll(g_TraceFd, out.str().data(), out.str().size());
+}
+
+void UninitTrace()
+{
+    if (g_TraceFd < 0)
+    {
+        return;
+    }
+    for (size_type i=0; i<g_vTrace.size(); ++i)
+    {
+        FlushTrace(g_vTrace[i]);
+        delete g_vTrace[i];
+    }
+    g_vTrace.clear();
+    const char tail[] = "\n]}\n";
+    WriteAll(g_TraceFd, tail, sizeof(tail) - 1);
+    close(g_TraceFd);
+    g_TraceFd = -1;
+}
+
+void LockMutex(pthread_mutex_t* mutex, const char* name)
+{
+    int ret = pthread_mutex_lock(mutex);
     if (ret != 0)
     {
-        cerr << "pthread_cond_init error: g_CondSync: error=" << ret << endl;
+        cerr << "pthread_mutex_lock error: " << name << ": error=" << ret << endl;
         exit(1);
     }
-    ret = pthread_cond_init(&g_CondNotEmpty, NULL);
+}
+
+void UnlockMutex(pthread_mutex_t* mutex, const char* name)
+{
+    int ret = pthread_mutex_unlock(mutex);
     if (ret != 0)
     {
-        cerr << "pthread_cond_init error: g_CondNotEmpty: error=" << ret << endl;
+        cerr << "pthread_mutex_unlock error: " << name << ": error=" << ret << endl;
         exit(1);
     }
-    //  create thread
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
-    for (i=0; i<g_vThread.size(); ++i)
+}
+
+//  Send signal to the process groups of all running children, return how many.
+size_type KillChildren(int sig)
+{
+    size_type num = 0;
+    LockMutex(&g_MutexChild, "g_MutexChild");
+    g_KillSignal = sig;
+    for (size_type i=0; i<g_vChildPid.size(); ++i)
     {
-        size_type* p = new size_type;
-        *p = i;
-        ret = pthread_create(&g_vThread[i], &attr, ThreadFunction, p);
-        if (ret != 0)
+        if (g_vChildPid[i] > 0)
         {
-            cerr << "pthread_create error: error=" << ret << "    i=" << i << endl;
-            exit(1);
+            kill(-g_vChildPid[i], sig);
+            ++num;
         }
-        ostringstream log_oss;
-        log_oss << "main thread: create g_vThread[" << i << "]=" << g_vThread[i];
+    }
+    UnlockMutex(&g_MutexChild, "g_MutexChild");
+    return num;
+}
+
+size_type RunningChildren()
+{
+    size_type num = 0;
+    LockMutex(&g_MutexChild, "g_MutexChild");
+    for (size_type i=0; i<g_vChildPid.size(); ++i)
+    {
+        if (g_vChildPid[i] > 0)
+        {
+            ++num;
+        }
+    }
+    UnlockMutex(&g_MutexChild, "g_MutexChild");
+    return num;
+}
+
+//  Whether cmd can be run without a shell: words of plain characters only,
+//  the first one neither an assignment nor a shell builtin or keyword.
+bool SimpleCommand(const string& cmd)
+{
+    static const char* builtin[] = {".", ":", "alias", "bg", "break", "cd", "command", "continue", "eval", "exec",
+        "exit", "export", "fc", "fg", "getopts", "hash", "jobs", "read", "readonly", "return", "set", "shift",
+        "source", "time", "times", "trap", "type", "ulimit", "umask", "unalias", "unset", "wait"};
+    size_type first = cmd.find_first_not_of(' ');
+    if (first == string::npos)
+    {
+        return false;
+    }
+    size_type end = cmd.find(' ', first);
+    if (end == string::npos)
+    {
+        end = cmd.size();
+    }
+    for (size_type i=first; i<cmd.size(); ++i)
+    {
+        char ch = cmd[i];
+        if (!isalnum(static_cast<unsigned char>(ch)) && strchr(" _-./,:+@%=", ch) == NULL)
+        {
+            return false;
+        }
+        if (ch == '=' && i < end)
+        {
+            return false;
+        }
+    }
+    for (size_type k=0; k<sizeof(builtin)/sizeof(builtin[0]); ++k)
+    {
+        if (cmd.compare(first, end - first, builtin[k]) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//  Split a simple command into argv, words points into it, both keep their capacity.
+void SplitWords(const string& cmd, string& words, vector<char*>& argv)
+{
+    words.assign(cmd);
+    argv.clear();
+    for (size_type i=0; i<words.size(); ++i)
+    {
+        if (words[i] == ' ')
+        {
+            words[i] = '\0';
+        }
+        else if (i == 0 || words[i - 1] == '\0')
+        {
+            argv.push_back(&words[i]);
+        }
+    }
+    argv.push_back(NULL);
+}
+
+//  The file of the output of command index of reducer, or of intermediate
+//  merge index if merge.
+void ReduceFile(const Reducer* reducer, size_type index, bool merge, string& file)
+{
+    file = reducer->output;
+    file += merge ? ".merge" : ".part";
+    AppendInteger(file, index);
+}
+
+//  Merge files to out, reporting errors, with no lock held.
+void MergeFiles(const Reducer* reducer, const vector<string>& files, int out)
+{
+    FILE* fp = fdopen(dup(out), "w");
+    LineMerger merger(reducer->field, reducer->numeric);
+    if (fp == NULL || !merger.Merge(files, fp) || fflush(fp) != 0)
+    {
+        cerr << "merge error: errno=" << errno << "    output=" << reducer->output << endl;
+    }
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+    for (size_type k=0; k<files.size(); ++k)
+    {
+        unlink(files[k].c_str());
+    }
+}
+
+//  Make progress on reducer, with its mutex locked, which may be released
+//  while merging. CAT appends the outputs done in order. MERGE merges
+//  g_MergeFanIn runs at a time while commands are running, and the rest
+//  once the group is closed and all are done.
+void Reduce(Reducer* reducer)
+{
+    string file;
+    if (reducer->mode == Reducer::CAT)
+    {
+        for (; !reducer->done.empty() && reducer->done.front(); ++reducer->next)
+        {
+            reducer->done.pop_front();
+            ReduceFile(reducer, reducer->next, false, file);
+            int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                cerr << "open error: errno=" << errno << "    file=" << file << endl;
+                continue;
+            }
+            if (!FileBuiltin::Copy(fd, reducer->out_fd))
+            {
+                cerr << "copy error: errno=" << errno << "    file=" << file << endl;
+            }
+            close(fd);
+            unlink(file.c_str());
+        }
+        return;
+    }
+    while (!reducer->finished)
+    {
+        bool last = reducer->closed && reducer->pending == 0;
+        if (last && reducer->merging > 0)
+        {
+            //  the last merge in progress finishes it
+            return;
+        }
+        if (!last && reducer->runs.size() < g_MergeFanIn)
+        {
+            return;
+        }
+        vector<string> files;
+        files.swap(reducer->runs);
+        if (last)
+        {
+            reducer->finished = true;
+            UnlockMutex(&reducer->mutex, "Reducer::mutex");
+            MergeFiles(reducer, files, reducer->out_fd);
+            LockMutex(&reducer->mutex, "Reducer::mutex");
+            return;
+        }
+        ReduceFile(reducer, reducer->merged++, true, file);
+        ++reducer->merging;
+        UnlockMutex(&reducer->mutex, "Reducer::mutex");
+        int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0)
+        {
+            cerr << "open error: errno=" << errno << "    file=" << file << endl;
+        }
+        else
+        {
+            MergeFiles(reducer, files, fd);
+            close(fd);
+        }
+        LockMutex(&reducer->mutex, "Reducer::mutex");
+        --reducer->merging;
+        reducer->runs.push_back(file);
+    }
+}
+
+//  Command index of reducer is done.
+void ReduceDone(Reducer* reducer, size_type index)
+{
+    LockMutex(&reducer->mutex, "Reducer::mutex");
+    --reducer->pending;
+    if (reducer->mode == Reducer::CAT)
+    {
+        reducer->done[index - reducer->next] = 1;
+    }
+    else
+    {
+        string file;
+        ReduceFile(reducer, index, false, file);
+        reducer->runs.push_back(file);
+    }
+    Reduce(reducer);
+    UnlockMutex(&reducer->mutex, "Reducer::mutex");
+}
+
+//  Create a reducer to output, exit on error.
+Reducer* NewReducer(Reducer::Mode mode, const string& output, size_type field, bool numeric)
+{
+    if (!g_vSimulateSlots.empty())
+    {
+        //  nothing is run, the groups are only checked and OUTPUT is not touched
+        static Reducer placeholder;
+        return &placeholder;
+    }
+    Reducer* reducer = new Reducer();
+    reducer->mode = mode;
+    reducer->output = output;
+    reducer->out_fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (reducer->out_fd < 0)
+    {
+        cerr << g_Program << ": open file error: " << output << endl;
+        exit(1);
+    }
+    reducer->field = field;
+    reducer->numeric = numeric;
+    pthread_mutex_init(&reducer->mutex, NULL);
+    reducer->count = 0;
+    reducer->next = 0;
+    reducer->merged = 0;
+    reducer->merging = 0;
+    reducer->pending = 0;
+    reducer->closed = false;
+    reducer->finished = false;
+    g_vReducer.push_back(reducer);
+    return reducer;
+}
+
+//  No more commands are added to reducer, the final merge runs here if
+//  they are all done already.
+void CloseReducer(Reducer* reducer)
+{
+    if (!g_vSimulateSlots.empty())
+    {
+        return;
+    }
+    LockMutex(&reducer->mutex, "Reducer::mutex");
+    reducer->closed = true;
+    Reduce(reducer);
+    UnlockMutex(&reducer->mutex, "Reducer::mutex");
+}
+
+//  The range [begin, end) of part item of part.
+void PartRange(PipePart* part, uint64_t item, uint64_t& begin, uint64_t& end)
+{
+    LockMutex(&part->mutex, "PipePart::mutex");
+    begin = item > 0 ? part->ends[item - 1] : 0;
+    end = part->ends[item];
+    UnlockMutex(&part->mutex, "PipePart::mutex");
+}
+
+//  Buffers of ExecCommand, kept by each thread for their capacity.
+struct ExecBuffer
+{
+    string output;                  //  the file capturing stdout for a reducer
+    string words;                   //  argv of a simple command
+    vector<char*> argv;
+    vector<string> stages;          //  of a pipeline
+    vector<pid_t> children;
+};
+
+//  Split a pipeline "A #| B #| C" into its stages.
+void SplitPipeline(const string& cmd, vector<string>& stages)
+{
+    stages.clear();
+    size_type begin = 0;
+    for (size_type pos=cmd.find(" #| "); pos!=string::npos; pos=cmd.find(" #| ", begin))
+    {
+        stages.push_back(cmd.substr(begin, pos - begin));
+        begin = pos + 4;
+    }
+    stages.push_back(cmd.substr(begin));
+}
+
+//  The number of stages of a pipeline, 1 for a plain command.
+size_type PipelineStages(const string& cmd)
+{
+    size_type num = 1;
+    for (size_type pos=cmd.find(" #| "); pos!=string::npos; pos=cmd.find(" #| ", pos + 4))
+    {
+        ++num;
+    }
+    return num;
+}
+
+//  Spawn one command, directly if simple, else by "/bin/sh -c". Return the
+//  error of posix_spawn.
+int SpawnCommand(const string& cmd, const posix_spawn_file_actions_t* actions, const posix_spawnattr_t* attr,
+    char** envp, ExecBuffer& buf, pid_t& child)
+{
+    int ret = -1;
+    if (SimpleCommand(cmd))
+    {
+        SplitWords(cmd, buf.words, buf.argv);
+        ret = posix_spawnp(&child, buf.argv[0], actions, attr, &buf.argv[0], envp);
+    }
+    if (ret != 0)
+    {
+        //  not simple, or failed, e.g. not found, which the shell reports with its exit status
+        char* shargv[] = {const_cast<char*>("sh"), const_cast<char*>("-c"), const_cast<char*>(cmd.c_str()), NULL};
+        ret = posix_spawn(&child, "/bin/sh", actions, attr, shargv, envp);
+    }
+    return ret;
+}
+
+//  Run command like system(), but the child leads its own process group so
+//  that cancellation can reach the whole job tree. A simple command is run
+//  directly, others by "/bin/sh -c". spec, if not NULL, gives the working
+//  directory, environment and redirections, and with item the part of
+//  #pipepart and the place in a reducer of the command. A builtin one is run in
+//  process by FileBuiltin if it can. The stages of a pipeline "A #| B" are
+//  started together in one process group, the stdout of each connected to
+//  the stdin of the next by a pipe, and the status is the last failed one.
+int ExecCommand(const string& cmd, size_type pid, int nice, const ExecSpec* spec, uint64_t item, bool builtin,
+    ExecBuffer& buf)
+{
+    int ret;
+    const bool pipeline = cmd.find(" #| ") != string::npos;
+    if (!pipeline && builtin && spec == NULL && g_CancelSignal == 0 && SimpleCommand(cmd))
+    {
+        int status;
+        SplitWords(cmd, buf.words, buf.argv);
+        if (FileBuiltin::Run(&buf.argv[0], status))
+        {
+            g_Metrics.builtins.fetch_add(1, memory_order_relaxed);
+            return status;
+        }
+    }
+    if (pipeline)
+    {
+        SplitPipeline(cmd, buf.stages);
+    }
+    const size_type num = pipeline ? buf.stages.size() : 1;
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &g_SignalSet);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    char** envp = spec != NULL && !spec->env.empty() ? const_cast<char**>(&spec->envp[0]) : environ;
+    pid_t leader = 0;       //  process group of all stages
+    int in = -1;            //  read end of the pipe from the previous stage
+    int part_out = -1;      //  write end of the pipe of a part of #pipepart
+    ret = 0;
+    buf.children.clear();
+    if (spec != NULL && spec->reducer != NULL)
+    {
+        ReduceFile(spec->reducer, spec->reduce_base + item, false, buf.output);
+    }
+    if (spec != NULL && spec->part != NULL)
+    {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0)
+        {
+            ret = errno;
+        }
+        else
+        {
+            fcntl(fds[1], F_SETPIPE_SZ, g_PipeSize);
+            in = fds[0];
+            part_out = fds[1];
+        }
+    }
+    for (size_type k=0; k<num && ret==0; ++k)
+    {
+        int fds[2] = {-1, -1};
+        if (k + 1 < num)
+        {
+            if (pipe2(fds, O_CLOEXEC) != 0)
+            {
+                ret = errno;
+                break;
+            }
+            fcntl(fds[1], F_SETPIPE_SZ, g_PipeSize);
+        }
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        if (spec != NULL && !spec->cwd.empty())
+        {
+            posix_spawn_file_actions_addchdir_np(&actions, spec->cwd.c_str());
+        }
+        for (int fd=0; fd<3; ++fd)
+        {
+            if (fd == 0 && in >= 0)
+            {
+                posix_spawn_file_actions_adddup2(&actions, in, 0);
+            }
+            else if (fd == 1 && fds[1] >= 0)
+            {
+                posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
+            }
+            else if (fd == 1 && spec != NULL && spec->reducer != NULL)
+            {
+                posix_spawn_file_actions_addopen(&actions, 1, buf.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            }
+            else if (spec != NULL && spec->redirect[fd] == "&1")
+            {
+                posix_spawn_file_actions_adddup2(&actions, 1, fd);
+            }
+            else if (spec != NULL && !spec->redirect[fd].empty())
+            {
+                int flags = fd == 0 ? O_RDONLY : O_WRONLY | O_CREAT | (spec->append[fd] ? O_APPEND : O_TRUNC);
+                posix_spawn_file_actions_addopen(&actions, fd, spec->redirect[fd].c_str(), flags, 0666);
+            }
+        }
+        posix_spawnattr_setpgroup(&attr, leader);
+        pid_t child;
+        ret = SpawnCommand(pipeline ? buf.stages[k] : cmd, &actions, &attr, envp, buf, child);
+        posix_spawn_file_actions_destroy(&actions);
+        if (in >= 0)
+        {
+            close(in);
+        }
+        if (fds[1] >= 0)
+        {
+            close(fds[1]);
+        }
+        in = fds[0];
+        if (ret != 0)
+        {
+            break;
+        }
+        if (leader == 0)
+        {
+            leader = child;
+        }
+        buf.children.push_back(child);
+        //  register the group, cancellation may have started during spawn
+        LockMutex(&g_MutexChild, "g_MutexChild");
+        g_vChildPid[pid] = leader;
+        if (g_pStatus != NULL)
+        {
+            g_pStatus->SetSlotPid(pid, leader);
+        }
+        if (g_pShare != NULL)
+        {
+            g_pShare->SetLeader(g_vShareTicket[pid], leader);
+        }
+        if (g_CancelSignal != 0 || g_Halted == HALT_NOW)
+        {
+            kill(-leader, g_KillSignal);
+        }
+        else if (!g_vChildLost.empty() && g_vChildLost[pid])
+        {
+            //  the other attempt of a speculated command finished first
+            kill(-leader, SIGTERM);
+        }
+        UnlockMutex(&g_MutexChild, "g_MutexChild");
+    }
+    if (in >= 0)
+    {
+        close(in);
+    }
+    if (part_out >= 0)
+    {
+        //  feed the part from the file without copying to user space, until
+        //  done or the command stops reading
+        uint64_t begin, end;
+        PartRange(spec->part, item, begin, end);
+        loff_t off = begin;
+        while (ret == 0 && off < static_cast<loff_t>(end))
+        {
+            ssize_t n = splice(spec->part->fd, &off, part_out, NULL, end - off, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n <= 0 && !(n < 0 && errno == EINTR))
+            {
+                break;
+            }
+        }
+        close(part_out);
+    }
+    posix_spawnattr_destroy(&attr);
+    if (ret != 0)
+    {
+        cerr << "posix_spawn error: error=" << ret << "    cmd=" << cmd << endl;
+    }
+    if (nice > 0 && leader != 0)
+    {
+        //  the group of the children, they may have started their own; it may be gone already
+        errno = 0;
+        int prio = getpriority(PRIO_PROCESS, leader);
+        if (errno == 0)
+        {
+            setpriority(PRIO_PGRP, leader, min(prio + nice, 19));
+        }
+    }
+    //  wait all stages, the last failed one decides
+    int status = ret != 0 ? -1 : 0;
+    for (size_type k=0; k<buf.children.size(); ++k)
+    {
+        int stage_status = -1;
+        while (waitpid(buf.children[k], &stage_status, 0) < 0)
+        {
+            if (errno != EINTR)
+            {
+                cerr << "waitpid error: errno=" << errno << "    pid=" << buf.children[k] << endl;
+                stage_status = -1;
+                break;
+            }
+        }
+        if (stage_status != 0 && status != -1)
+        {
+            status = stage_status;
+        }
+    }
+    //  once cancelled, the rest of the group, e.g. children ignoring
+    //  SIGTERM, is still counted as running until it is gone or sent SIGKILL
+    while (leader != 0 && (g_CancelSignal != 0 || g_Halted == HALT_NOW) && kill(-leader, 0) == 0
+        && g_KillSignal != SIGKILL)
+    {
+        usleep(50000);
+    }
+    LockMutex(&g_MutexChild, "g_MutexChild");
+    g_vChildPid[pid] = 0;
+    UnlockMutex(&g_MutexChild, "g_MutexChild");
+    if (spec != NULL && spec->reducer != NULL)
+    {
+        ReduceDone(spec->reducer, spec->reduce_base + item);
+    }
+    return status;
+}
+
+//  Count a command taken from the queue, with g_MutexQueue locked.
+void CountDispatch()
+{
+    ++g_Dispatched;
+#ifdef ALLOC_STATS
+    if (g_Dispatched == g_WarmCommands)
+    {
+        g_AllocWarm = g_AllocCount.load(memory_order_relaxed);
+    }
+#endif
+}
+
+//  Add a dispatch latency, from enqueue to start, to the histogram.
+void ObserveLatency(uint64_t ns)
+{
+    size_type i = 0;
+    while (i < g_LatencyBucketNum && ns > g_LatencyBucket[i] * 1e9)
+    {
+        ++i;
+    }
+    g_Metrics.latency[i].fetch_add(1, memory_order_relaxed);
+    g_Metrics.latency_sum.fetch_add(ns, memory_order_relaxed);
+}
+
+//  Copy the counters to the status table, if any.
+void PublishStatus()
+{
+    if (g_pStatus == NULL)
+    {
+        return;
+    }
+    uint64_t value[StatusTable::FIELD_NUM];
+    value[StatusTable::QUEUED] = g_Metrics.queued.load(memory_order_relaxed);
+    value[StatusTable::RUNNING] = g_Metrics.running.load(memory_order_relaxed);
+    value[StatusTable::COMPLETED] = g_Metrics.completed.load(memory_order_relaxed);
+    value[StatusTable::FAILED] = g_Metrics.failed.load(memory_order_relaxed);
+    value[StatusTable::INTERRUPTED] = g_Metrics.interrupted.load(memory_order_relaxed);
+    value[StatusTable::BARRIERS] = g_Metrics.barriers.load(memory_order_relaxed);
+    LockMutex(&g_MutexStatus, "g_MutexStatus");
+    g_pStatus->SetCounters(value);
+    UnlockMutex(&g_MutexStatus, "g_MutexStatus");
+}
+
+//  Wake the producer from poll(), the pipe is non-blocking.
+void WakeProducer()
+{
+    ssize_t n = write(g_WakePipe[1], "x", 1);
+    (void)n;
+}
+
+//  Wake a thread of job class c, with g_MutexQueue locked.
+void WakeWorker(size_type c)
+{
+    int ret = pthread_cond_signal(&g_vClass[c]->cond);
+    if (ret != 0)
+    {
+        cerr << "pthread_cond_signal error: JobClass::cond: error=" << ret << endl;
+        exit(1);
+    }
+}
+
+//  Wake all waiting threads, with g_MutexQueue locked.
+void WakeAllWorkers()
+{
+    for (size_type c=0; c<g_vClass.size(); ++c)
+    {
+        pthread_cond_broadcast(&g_vClass[c]->cond);
+    }
+}
+
+//  Whether lane is headed by a #sync.
+bool SyncAtHead(const Lane& lane)
+{
+    return lane.ready.empty() && !lane.later.empty() && (lane.later.front().Flags() & CMD_SYNC) != 0;
+}
+
+//  The heap score of a command: its priority, raised by one level per
+//  g_AgingNs of waiting. As all commands age alike, it does not change
+//  while waiting.
+int64_t Score(const CommandHandle& handle)
+{
+    if (g_AgingNs == 0)
+    {
+        return handle.Priority();
+    }
+    return handle.Priority() * static_cast<int64_t>(g_AgingNs) - static_cast<int64_t>(handle.Stamp() - g_StartTime);
+}
+
+//  Pop the index-th ready command of lane c of src, or the #sync at its
+//  head, with g_MutexQueue locked. The record returns to g_Arena when the
+//  handle is destroyed.
+CommandHandle PopCommand(Source* src, size_type c, size_type pid, size_type index = 0)
+{
+    Lane& lane = src->lanes[c];
+    CommandHandle handle = lane.ready.empty() ? lane.later.pop() : lane.ready.take(index);
+    TraceInstant(pid, "pop", src->id, src->items - 1);
+    --src->items;
+    src->bytes -= handle.Size();
+    if ((handle.Flags() & CMD_SYNC) == 0)
+    {
+        g_Metrics.queued.fetch_sub(1, memory_order_relaxed);
+    }
+    if (src->full)
+    {
+        src->full = false;
+        WakeProducer();
+    }
+    return handle;
+}
+
+//  Move the commands up to the next #sync of lane to its priority queue.
+void RefillLane(Lane& lane)
+{
+    while (!lane.later.empty() && (lane.later.front().Flags() & CMD_SYNC) == 0)
+    {
+        CommandHandle handle = lane.later.pop();
+        int64_t score = Score(handle);
+        lane.ready.push(std::move(handle), score);
+    }
+}
+
+//  Whether a thread of cls may start a command of the given stages, with
+//  g_MutexQueue locked: each stage takes a slot, a pipeline longer than the
+//  class takes all of it and runs alone.
+bool HasRoom(const JobClass* cls, size_type stages = 1)
+{
+    return cls->active + cls->borrowed + min(stages, cls->threads) <= cls->threads;
+}
+
+//  The number of stages of a queued command, 1 for a plain command.
+size_type CommandStages(const CommandHandle& handle)
+{
+    return (handle.Flags() >> CMD_STAGE_SHIFT) + 1;
+}
+
+//  The time the token of the rate group of a queued command is there, 0 if
+//  it has none.
+uint64_t RateDue(const CommandHandle& handle)
+{
+    const ExecSpec* spec = g_vSpec[handle.Spec()];
+    return spec != NULL && spec->rate != 0 ? g_vRateGroup[spec->rate - 1].second->Due() : 0;
+}
+
+//  Pop a command of lane c of src for thread pid with g_MutexQueue locked,
+//  the one found by Dispatchable. With --locality, a command of no lower
+//  priority with the key of the previous command of pid within the window
+//  is preferred to it, unless the top was passed over g_LocalityWindow
+//  times already.
+CommandHandle PopLocal(Source* src, size_type c, size_type pid)
+{
+    Lane& lane = src->lanes[c];
+    uint32_t key = g_LocalityWindow > 0 ? g_pSlotKey[pid] : 0;
+    if (key == 0)
+    {
+        CommandHandle handle = PopCommand(src, c, pid, lane.start);
+        if (g_LocalityWindow > 0)
+        {
+            g_pSlotKey[pid] = handle.Key();
+        }
+        return handle;
+    }
+    g_Metrics.locality_tries.fetch_add(1, memory_order_relaxed);
+    size_type index = lane.start;
+    const CommandHandle& top = lane.ready.at(lane.start);
+    const uint64_t now = NowNs();
+    if (top.Key() != key && lane.bypassed < g_LocalityWindow)
+    {
+        for (size_type i=1; i<=g_LocalityWindow && i<lane.ready.size(); ++i)
+        {
+            const CommandHandle& handle = lane.ready.at(i);
+            if (i != lane.start && handle.Key() == key && handle.Priority() >= top.Priority()
+                && HasRoom(g_vClass[c], CommandStages(handle)) && RateDue(handle) <= now)
+            {
+                index = i;
+                break;
+            }
+        }
+    }
+    if (index == lane.start)
+    {
+        lane.bypassed = 0;
+    }
+    else
+    {
+        ++lane.bypassed;
+    }
+    CommandHandle handle = PopCommand(src, c, pid, index);
+    if (handle.Key() == key)
+    {
+        g_Metrics.locality_hits.fetch_add(1, memory_order_relaxed);
+    }
+    g_pSlotKey[pid] = handle.Key();
+    return handle;
+}
+
+//  With --halt segment, drop the queued commands of src after the #sync
+//  that ends a segment with a failed command, and have the producer stop
+//  reading src, with g_MutexQueue locked.
+void CancelSegment(Source* src, size_type pid)
+{
+    size_type num = 0;
+    for (size_type l=0; l<src->lanes.size(); ++l)
+    {
+        Lane& lane = src->lanes[l];
+        while (!lane.ready.empty() || !lane.later.empty())
+        {
+            CommandHandle handle = PopCommand(src, l, pid);
+            num += (handle.Flags() & CMD_SYNC) == 0 ? 1 : 0;
+        }
+    }
+    src->halted = true;
+    g_HaltCancelled += num;
+    WakeProducer();
+    LogStream log_oss;
+    log_oss << "thread " << pid << ": a command of source " << src->id << " failed before #sync, cancel the "
+        << num << " queued commands after it and stop reading " << src->path;
+    LogFile(log_oss.str());
+}
+
+//  Whether lane c of src has a command to dispatch, with g_MutexQueue locked,
+//  its index in the ready queue is kept in the lane for PopLocal. A pipeline
+//  at the head waits there until the class has a slot for each stage. A
+//  head whose rate group has no token yet is passed by the first of the
+//  next g_RateWindow commands that may start, so that it does not hold a
+//  thread while waiting; g_RateDue is lowered to when its token comes. A
+//  #sync is passed once all commands of src before it are finished, i.e.
+//  nothing of src is running and every lane is headed by the #sync.
+bool Dispatchable(Source* src, size_type c, size_type pid)
+{
+    vector<Lane>& lanes = src->lanes;
+    while (SyncAtHead(lanes[c]))
+    {
+        if (src->running > 0)
+        {
+            return false;
+        }
+        for (size_type l=0; l<lanes.size(); ++l)
+        {
+            if (!SyncAtHead(lanes[l]))
+            {
+                return false;
+            }
+        }
+        if (src->failed)
+        {
+            CancelSegment(src, pid);
+            return false;
+        }
+        for (size_type l=0; l<lanes.size(); ++l)
+        {
+            PopCommand(src, l, pid);
+            RefillLane(lanes[l]);
+        }
+        TraceInstant(pid, "barrier", src->id, src->items);
+        g_Metrics.barriers.fetch_add(1, memory_order_relaxed);
+        LogStream log_oss;
+        log_oss << "thread " << pid << ": pass barrier of source " << src->id << ": &#sync&";
+        LogFile(log_oss.str());
+        if (lanes.size() > 1)
+        {
+            //  the other classes may go on
+            WakeAllWorkers();
+        }
+    }
+    Lane& lane = lanes[c];
+    lane.start = 0;
+    if (lane.ready.empty() || !HasRoom(g_vClass[c], CommandStages(lane.ready.top())))
+    {
+        return false;
+    }
+    uint64_t due = RateDue(lane.ready.top());
+    if (due == 0)
+    {
+        return true;
+    }
+    const uint64_t now = NowNs();
+    for (size_type i=0; i<=g_RateWindow && i<lane.ready.size(); ++i)
+    {
+        const CommandHandle& handle = lane.ready.at(i);
+        uint64_t next = RateDue(handle);
+        if (next <= now && HasRoom(g_vClass[c], CommandStages(handle)))
+        {
+            lane.start = i;
+            return true;
+        }
+        if (next > now && (g_RateDue == 0 || next < g_RateDue))
+        {
+            g_RateDue = next;
+        }
+    }
+    return false;
+}
+
+//  Pick the source of the next command of the job class of thread pid by
+//  deficit round robin, each source gets weight commands per round, with
+//  g_MutexQueue locked.
+Source* PickSource(size_type pid)
+{
+    const size_type c = g_vThreadClass[pid];
+    g_RateDue = 0;
+    size_type& turn = g_vClass[c]->turn;
+    for (size_type k=0; k<g_vSource.size(); ++k)
+    {
+        Source* src = g_vSource[turn];
+        Lane& lane = src->lanes[c];
+        if (Dispatchable(src, c, pid))
+        {
+            if (lane.deficit == 0)
+            {
+                lane.deficit = src->weight;
+            }
+            if (--lane.deficit == 0)
+            {
+                turn = (turn + 1) % g_vSource.size();
+            }
+            return src;
+        }
+        lane.deficit = 0;
+        turn = (turn + 1) % g_vSource.size();
+    }
+    return NULL;
+}
+
+//  Whether some source waits at a #sync, with g_MutexQueue locked.
+bool BarrierBlocked()
+{
+    for (size_type i=0; i<g_vSource.size(); ++i)
+    {
+        const Source* src = g_vSource[i];
+        for (size_type c=0; c<src->lanes.size() && src->running>0; ++c)
+        {
+            if (SyncAtHead(src->lanes[c]))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//  Whether all sources are exited and their commands dispatched, with g_MutexQueue locked.
+bool InputDone()
+{
+    if (g_SourcesOpen > 0)
+    {
+        return false;
+    }
+    for (size_type i=0; i<g_vSource.size(); ++i)
+    {
+        if (g_vSource[i]->items > 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//  The program of cmd, i.e. its first word, durations are kept per program.
+void ProgramOf(const string& cmd, string& program)
+{
+    program.assign(cmd, 0, cmd.find(' '));
+}
+
+//  Add a successful run of cmd to its recent durations, with g_MutexQueue locked.
+void RecordDuration(const string& program, double seconds)
+{
+    DurationSample& sample = g_Durations[program];
+    sample.seconds[sample.next] = seconds;
+    sample.next = (sample.next + 1) % g_DurationSamples;
+    sample.num = min(sample.num + 1, g_DurationSamples);
+}
+
+//  The median of recent durations of program, 0 if too few, with g_MutexQueue locked.
+double MedianDuration(const string& program)
+{
+    unordered_map<string, DurationSample>::const_iterator it = g_Durations.find(program);
+    if (it == g_Durations.end() || it->second.num < 3)
+    {
+        return 0;
+    }
+    float buf[g_DurationSamples];
+    const size_type n = it->second.num;
+    copy(it->second.seconds, it->second.seconds + n, buf);
+    nth_element(buf, buf + n / 2, buf + n);
+    return buf[n / 2];
+}
+
+//  Find a straggler for the idle thread pid to copy, with g_MutexQueue
+//  locked: an idempotent command of the same job class without a copy,
+//  whose input waits at a #sync, running g_SpeculateFactor times longer
+//  than the median of its program. Return its thread, or npos.
+size_type FindStraggler(size_type pid, string& program)
+{
+    const uint64_t now = NowNs();
+    size_type best = string::npos;
+    uint64_t longest = 0;
+    for (size_type i=0; i<g_vSlotRun.size(); ++i)
+    {
+        const SlotRun& run = g_vSlotRun[i];
+        if (run.src == NULL || !run.idempotent || run.copy || run.peer != string::npos
+            || g_vThreadClass[i] != g_vThreadClass[pid] || now - run.start <= longest
+            || !HasRoom(g_vClass[g_vThreadClass[pid]], PipelineStages(run.cmd)))
+        {
+            continue;
+        }
+        bool barrier = false;
+        for (size_type l=0; l<run.src->lanes.size() && !barrier; ++l)
+        {
+            barrier = SyncAtHead(run.src->lanes[l]);
+        }
+        ProgramOf(run.cmd, program);
+        double median = MedianDuration(program);
+        if (barrier && median > 0 && (now - run.start) * 1e-9 > g_SpeculateFactor * median)
+        {
+            best = i;
+            longest = now - run.start;
+        }
+    }
+    return best;
+}
+
+
+//  Set the nice value and I/O priority of the calling thread for job class
+//  cls, they are inherited by the commands it spawns.
+void SetThreadPriority(const JobClass* cls)
+{
+    pid_t tid = syscall(SYS_gettid);
+    if (cls->nice != 0)
+    {
+        errno = 0;
+        int prio = getpriority(PRIO_PROCESS, tid);
+        if (errno != 0 || setpriority(PRIO_PROCESS, tid, prio + cls->nice) != 0)
+        {
+            cerr << "setpriority error: class " << cls->name << ": errno=" << errno << endl;
+            exit(1);
+        }
+    }
+    if (cls->ioprio >= 0 && syscall(SYS_ioprio_set, 1, tid, cls->ioprio) != 0)    //  IOPRIO_WHO_PROCESS
+    {
+        cerr << "ioprio_set error: class " << cls->name << ": errno=" << errno << endl;
+        exit(1);
+    }
+}
+
+//  Stop dispatching once the failures trigger --halt, with now stop the
+//  running commands too, as a signal does but without cancelling the run.
+void CheckHalt(size_type pid)
+{
+    if (g_HaltWhen == HALT_NEVER || g_Halted != HALT_NEVER)
+    {
+        return;
+    }
+    unsigned long long failed = g_Metrics.failed.load(memory_order_relaxed);
+    unsigned long long finished = failed + g_Metrics.completed.load(memory_order_relaxed);
+    if (g_HaltPercent > 0)
+    {
+        //  a rate needs 100 / X finished commands to mean anything
+        if (finished * g_HaltPercent < 100 || failed * 100 < finished * g_HaltPercent)
+        {
+            return;
+        }
+    }
+    else if (failed < g_HaltFailures)
+    {
+        return;
+    }
+    LockMutex(&g_MutexQueue, "g_MutexQueue");
+    bool first = g_Halted == HALT_NEVER;
+    g_Halted = g_HaltWhen;
+    WakeAllWorkers();
+    UnlockMutex(&g_MutexQueue, "g_MutexQueue");
+    if (!first)
+    {
+        return;
+    }
+    WakeProducer();
+    LogStream log_oss;
+    log_oss << "thread " << pid << ": " << failed << " of " << finished << " commands failed, halt "
+        << (g_HaltWhen == HALT_NOW ? "now" : "soon") << ", stop dispatching";
+    LogFile(log_oss.str());
+    if (g_HaltWhen != HALT_NOW)
+    {
+        return;
+    }
+    size_type num = KillChildren(SIGTERM);
+    log_oss.str("");
+    log_oss << "thread " << pid << ": halt now, sent SIGTERM to " << num << " running commands";
+    LogFile(log_oss.str());
+    time_t deadline = time(NULL) + g_GracePeriod;
+    while (RunningChildren() > 0 && time(NULL) < deadline)
+    {
+        usleep(50000);
+    }
+    if (RunningChildren() > 0)
+    {
+        num = KillChildren(SIGKILL);
+        log_oss.str("");
+        log_oss << "thread " << pid << ": grace period expired, sent SIGKILL to " << num << " running commands";
+        LogFile(log_oss.str());
+    }
+}
+
+//  The token of the rate group of spec, reserved at dispatch with
+//  g_MutexQueue locked: the time it is there, 0 if spec has no group.
+uint64_t ReserveRate(const ExecSpec* spec)
+{
+    return spec != NULL && spec->rate != 0 ? g_vRateGroup[spec->rate - 1].second->Reserve(NowNs()) : 0;
+}
+
+//  Wait until a command may start by --rate, with no lock held: until due,
+//  when the token of its group is there, then for a token of the global
+//  limit. Return false if cancelled meanwhile, or halted now.
+bool WaitRate(uint64_t due)
+{
+    if (g_pRate == NULL && due == 0)
+    {
+        return true;
+    }
+    uint64_t start = max(due, NowNs());
+    if (g_pRate != NULL)
+    {
+        start = g_pRate->Reserve(start);
+    }
+    while (g_CancelSignal == 0 && g_Halted != HALT_NOW)
+    {
+        uint64_t now = NowNs();
+        if (now >= start)
+        {
+            return true;
+        }
+        //  in steps, to see cancellation
+        struct timespec ts = {0, static_cast<long>(min<uint64_t>(start - now, 100000000))};
+        nanosleep(&ts, NULL);
+    }
+    return false;
+}
+
+void* ThreadFunction(void* arg)
+{
+    int ret;
+    string cmd;         //  reused, keeps its capacity
+    string program;     //  of cmd, with --speculate
+    ExecBuffer exec_buf;
+    LogStream log_oss;
+    size_type pid = reinterpret_cast<size_type>(arg);
+    const size_type c = g_vThreadClass[pid];
+    JobClass* cls = g_vClass[c];
+    SetThreadPriority(cls);
+    while (true)
+    {
+        //  lock g_MutexQueue
+        ret = pthread_mutex_lock(&g_MutexQueue);
+        if (ret != 0)
+        {
+            cerr << "pthread_mutex_lock error: g_MutexQueue: error=" << ret << endl;
+            exit(1);
+        }
+        //  wait cond of the job class
+        Source* src = NULL;
+        size_type victim = string::npos;    //  thread of the straggler to copy
+        while (g_CancelSignal == 0 && g_Halted == HALT_NEVER && (src = HasRoom(cls) ? PickSource(pid) : NULL) == NULL && !InputDone())
+        {
+            bool blocked = BarrierBlocked();
+            if (blocked && g_SpeculateFactor > 0 && HasRoom(cls) && (victim = FindStraggler(pid, program)) != string::npos)
+            {
+                src = g_vSlotRun[victim].src;
+                break;
+            }
+            if (blocked)
+            {
+                g_Metrics.barrier_waits.fetch_add(1, memory_order_relaxed);
+            }
+            if (g_Print)
+            {
+                cerr << "thread " << pid << ": enter pthread_cond_wait " << cls->name << endl;
+            }
+            //  look for stragglers again later, or for a command whose rate token has come
+            uint64_t now = NowNs();
+            uint64_t wait = blocked && g_SpeculateFactor > 0 ? 100000000 : 0;
+            if (g_RateDue > now)
+            {
+                wait = wait == 0 ? g_RateDue - now : min(wait, g_RateDue - now);
+            }
+            g_RateDue = 0;
+            if (wait > 0)
+            {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += wait / 1000000000;
+                ts.tv_nsec += wait % 1000000000;
+                if (ts.tv_nsec >= 1000000000)
+                {
+                    ++ts.tv_sec;
+                    ts.tv_nsec -= 1000000000;
+                }
+                ret = pthread_cond_timedwait(&cls->cond, &g_MutexQueue, &ts);
+                if (ret == ETIMEDOUT)
+                {
+                    ret = 0;
+                }
+            }
+            else
+            {
+                ret = pthread_cond_wait(&cls->cond, &g_MutexQueue);
+            }
+            if (ret != 0)
+            {
+                cerr << "pthread_cond_wait error: JobClass::cond: error=" << ret << endl;
+                exit(1);
+            }
+            if (g_Print)
+            {
+                cerr << "thread " << pid << ": leave pthread_cond_wait " << cls->name << endl;
+            }
+        }
+        //  cancelled, or all input is done
+        if (src == NULL)
+        {
+            UnlockMutex(&g_MutexQueue, "g_MutexQueue");
+            break;
+        }
+        //  get command, or copy the straggler
+        CommandHandle handle;
+        int nice = 0;
+        const ExecSpec* spec = NULL;
+        uint64_t item = 0;
+        bool idempotent = false;
+        bool builtin = false;
+        if (victim != string::npos)
+        {
+            SlotRun& orig = g_vSlotRun[victim];
+            cmd = orig.cmd;
+            nice = orig.nice;
+            spec = orig.spec;
+            item = orig.item;
+            idempotent = true;
+            orig.peer = pid;
+            g_Metrics.speculated.fetch_add(1, memory_order_relaxed);
+        }
+        else
+        {
+            handle = PopLocal(src, c, pid);
+            handle.Text(cmd);
+            //  negative priority runs nicer, by at most 19
+            nice = handle.Priority() < 0 ? min(-handle.Priority(), 19) : 0;
+            idempotent = (handle.Flags() & CMD_IDEMPOTENT) != 0;
+            spec = g_vSpec[handle.Spec()];
+            item = handle.Item();
+            builtin = (handle.Flags() & CMD_BUILTIN) != 0;
+            if (g_vClass.size() > 1 && InputDone())
+            {
+                //  threads of other classes may be waiting for more input
+                WakeAllWorkers();
+            }
+            ++src->dispatched;
+            ++cls->dispatched;
+            CountDispatch();
+        }
+        //  the other stages of a pipeline take slots of the class too
+        size_type borrowed = min(PipelineStages(cmd), cls->threads) - 1;
+        cls->borrowed += borrowed;
+        ++cls->active;
+        ++src->running;
+        src->high_running = max(src->high_running, src->running);
+        uint64_t number = src->dispatched;
+        if (g_SpeculateFactor > 0)
+        {
+            SlotRun& run = g_vSlotRun[pid];
+            run.src = src;
+            run.cmd = cmd;
+            run.start = NowNs();
+            run.nice = nice;
+            run.spec = spec;
+            run.item = item;
+            //  a copy would write the same output file at the same time, or
+            //  clobber the captured output of #reduce
+            run.idempotent = idempotent && (spec == NULL || (spec->reducer == NULL && spec->redirect[1].empty()
+                && spec->redirect[2].empty()));
+            run.copy = victim != string::npos;
+            run.lost = false;
+            run.peer = victim;
+            LockMutex(&g_MutexChild, "g_MutexChild");
+            g_vChildLost[pid] = 0;
+            UnlockMutex(&g_MutexChild, "g_MutexChild");
+        }
+        //  the token of its rate group, there now as Dispatchable checked, unless a copy
+        uint64_t due = ReserveRate(spec);
+        //  unlock g_MutexQueue
+        ret = pthread_mutex_unlock(&g_MutexQueue);
+        if (ret != 0)
+        {
+            cerr << "pthread_mutex_unlock error: g_MutexQueue: error=" << ret << endl;
+            exit(1);
+        }
+        //  the start time of --rate, then a slot of the jobserver, given up if cancelled
+        int token = JobServer::NONE;
+        bool slot = WaitRate(due) && (g_pJobServer == NULL || g_pJobServer->Acquire(token, g_CancelSignal));
+        uint64_t start = NowNs();
+        if (victim == string::npos)
+        {
+            ObserveLatency(start - handle.Stamp());
+            handle.Reset();
+        }
+        g_Metrics.running.fetch_add(1, memory_order_relaxed);
+        g_pSlotStart[pid].store(start, memory_order_relaxed);
+        if (g_pStatus != NULL)
+        {
+            g_pStatus->StartSlot(pid, src->id, number, cmd.data(), cmd.size());
+            PublishStatus();
+        }
+        log_oss.str("");
+        if (victim != string::npos)
+        {
+            log_oss << "thread " << pid << ": speculate command of thread " << victim << ": &" << cmd << "&";
+        }
+        else
+        {
+            log_oss << "thread " << pid << ": get command: &" << cmd << "&";
+        }
+        LogFile(log_oss.str());
+        //  exec
+        assert(!cmd.empty());
+        int status = slot ? ExecCommand(cmd, pid, nice, spec, item, builtin, exec_buf) : -1;
+        if (g_pJobServer != NULL)
+        {
+            g_pJobServer->Release(token);
+        }
+        uint64_t finish = NowNs();
+        double elapsed = (finish - start) * 1e-9;
+        g_pSlotStart[pid].store(0, memory_order_relaxed);
+        if (g_pStatus != NULL)
+        {
+            g_pStatus->ClearSlot(pid);
+        }
+        g_pSlotBusy[pid].fetch_add(finish - start, memory_order_relaxed);
+        TraceSpan(pid, start, finish, cmd, src->id);
+        g_Metrics.running.fetch_sub(1, memory_order_relaxed);
+        //  finish, release the barrier of src if this is the last one before it
+        LockMutex(&g_MutexQueue, "g_MutexQueue");
+        bool lost = false;
+        if (g_SpeculateFactor > 0)
+        {
+            SlotRun& run = g_vSlotRun[pid];
+            lost = run.lost;
+            if (lost)
+            {
+                g_SpeculateWasted += elapsed;
+            }
+            else if (run.peer != string::npos)
+            {
+                //  first to finish, kill the other attempt
+                SlotRun& other = g_vSlotRun[run.peer];
+                other.lost = true;
+                LockMutex(&g_MutexChild, "g_MutexChild");
+                g_vChildLost[run.peer] = 1;
+                if (g_vChildPid[run.peer] != 0)
+                {
+                    kill(-g_vChildPid[run.peer], SIGTERM);
+                }
+                UnlockMutex(&g_MutexChild, "g_MutexChild");
+                if (run.copy)
+                {
+                    g_Metrics.speculation_wins.fetch_add(1, memory_order_relaxed);
+                    g_SpeculateSaved += (finish - other.start) * 1e-9 - elapsed;
+                }
+                else
+                {
+                    ++g_SpeculateLost;
+                }
+            }
+            if (!lost && status == 0 && g_CancelSignal == 0)
+            {
+                ProgramOf(cmd, program);
+                RecordDuration(program, elapsed);
+            }
+            run.src = NULL;
+            run.peer = string::npos;
+        }
+        if (g_HaltSegment && status != 0 && !lost && g_CancelSignal == 0)
+        {
+            src->failed = true;
+        }
+        --src->running;
+        src->busy += elapsed;
+        cls->busy += elapsed;
+        --cls->active;
+        if (borrowed > 0)
+        {
+            cls->borrowed -= borrowed;
+            WakeAllWorkers();
+        }
+        if (src->running == 0)
+        {
+            for (size_type l=0; l<src->lanes.size(); ++l)
+            {
+                if (SyncAtHead(src->lanes[l]))
+                {
+                    WakeAllWorkers();
+                    break;
+                }
+            }
+        }
+        UnlockMutex(&g_MutexQueue, "g_MutexQueue");
+        log_oss.str("");
+        if (lost)
+        {
+            log_oss << "thread " << pid << ": killed speculated command, the other attempt finished first: &" << cmd << "& elapsed=" << elapsed;
+        }
+        else if (g_CancelSignal != 0 || g_Halted == HALT_NOW)
+        {
+            log_oss << "thread " << pid << ": interrupted command";
+            if (status != -1 && WIFSIGNALED(status))
+            {
+                log_oss << " (signal " << WTERMSIG(status) << ")";
+            }
+            log_oss << ": &" << cmd << "&";
+            LockMutex(&g_MutexChild, "g_MutexChild");
+            ++g_Interrupted;
+            UnlockMutex(&g_MutexChild, "g_MutexChild");
+            g_Metrics.interrupted.fetch_add(1, memory_order_relaxed);
+        }
+        else if (0 == status)
+        {
+            g_Metrics.completed.fetch_add(1, memory_order_relaxed);
+            log_oss << "thread " << pid << ": execute done command: &" << cmd << "& elapsed=" << elapsed;
+        }
+        else
+        {
+            log_oss << "thread " << pid << ": execute failed command: &" << cmd << "& elapsed=" << elapsed;
+            if (status != -1 && WIFEXITED(status))
+            {
+                log_oss << " exit=" << WEXITSTATUS(status);
+            }
+            else if (status != -1 && WIFSIGNALED(status))
+            {
+                log_oss << " signal=" << WTERMSIG(status);
+            }
+            g_ErrorOccur = true;
+            g_Metrics.failed.fetch_add(1, memory_order_relaxed);
+        }
+        PublishStatus();
+        LogFile(log_oss.str());
+        if (!lost)
+        {
+            CheckHalt(pid);
+        }
+    }
+    if (g_Print)
+    {
+        cerr << "thread " << pid << ": leave ThreadFunction" << endl;
+    }
+    return NULL;
+}
+
+//  Whether a worker with --share may stop: this process pushes no more and
+//  all it pushed is done, and nobody pushes to the queue and all in it is
+//  done, as commands of a member gone come back when it is reaped.
+bool ShareFinished()
+{
+    return g_ShareProduced.load() && g_pShare->Finished(g_ShareMember) >= g_SharePushed.load()
+        && g_pShare->Closed() && g_pShare->Drained();
+}
+
+//  A worker with --share: run the commands of any member of the shared queue.
+void* ShareWorkerFunction(void* arg)
+{
+    string cmd;         //  reused, keeps its capacity
+    ExecBuffer exec_buf;
+    LogStream log_oss;
+    size_type pid = reinterpret_cast<size_type>(arg);
+    SetThreadPriority(g_vClass[0]);
+    SharedQueue::Task task;
+    useconds_t idle = 0;
+    while (g_CancelSignal == 0)
+    {
+        if (!g_pShare->Take(g_ShareMember, task, cmd))
+        {
+            if (ShareFinished())
+            {
+                break;
+            }
+            //  poll, backing off up to 10ms
+            idle = min<useconds_t>(max<useconds_t>(idle * 2, 100), 10000);
+            usleep(idle);
+            continue;
+        }
+        idle = 0;
+        g_vShareTicket[pid] = task.ticket;
+        int token = JobServer::NONE;
+        bool slot = WaitRate(0) && (g_pJobServer == NULL || g_pJobServer->Acquire(token, g_CancelSignal));
+        uint64_t start = NowNs();
+        g_Metrics.running.fetch_add(1, memory_order_relaxed);
+        g_pSlotStart[pid].store(start, memory_order_relaxed);
+        if (g_pStatus != NULL)
+        {
+            g_pStatus->StartSlot(pid, task.producer, task.ticket, cmd.data(), cmd.size());
+            PublishStatus();
+        }
+        log_oss.str("");
+        log_oss << "thread " << pid << ": get shared command of member " << task.producer << ": &" << cmd << "&";
+        LogFile(log_oss.str());
+        int status = slot ? ExecCommand(cmd, pid, 0, NULL, 0, (task.flags & CMD_BUILTIN) != 0, exec_buf) : -1;
+        if (g_pJobServer != NULL)
+        {
+            g_pJobServer->Release(token);
+        }
+        uint64_t finish = NowNs();
+        double elapsed = (finish - start) * 1e-9;
+        g_pSlotStart[pid].store(0, memory_order_relaxed);
+        if (g_pStatus != NULL)
+        {
+            g_pStatus->ClearSlot(pid);
+        }
+        g_pSlotBusy[pid].fetch_add(finish - start, memory_order_relaxed);
+        TraceSpan(pid, start, finish, cmd, task.producer);
+        g_Metrics.running.fetch_sub(1, memory_order_relaxed);
+        log_oss.str("");
+        if (g_CancelSignal != 0)
+        {
+            //  give it back to the other members
+            g_pShare->Release(g_ShareMember, task);
+            log_oss << "thread " << pid << ": interrupted shared command, given back: &" << cmd << "&";
+            LockMutex(&g_MutexChild, "g_MutexChild");
+            ++g_Interrupted;
+            UnlockMutex(&g_MutexChild, "g_MutexChild");
+            g_Metrics.interrupted.fetch_add(1, memory_order_relaxed);
+        }
+        else
+        {
+            bool counted = g_pShare->Done(g_ShareMember, task, status != 0);
+            log_oss << "thread " << pid << ": execute " << (status == 0 ? "done" : "failed") << " command: &" << cmd
+                << "& elapsed=" << elapsed;
+            if (!counted)
+            {
+                log_oss << " (lease lost, run again by others)";
+            }
+            g_Metrics.completed.fetch_add(status == 0 ? 1 : 0, memory_order_relaxed);
+            g_Metrics.failed.fetch_add(status == 0 ? 0 : 1, memory_order_relaxed);
+        }
+        LogFile(log_oss.str());
+        PublishStatus();
+        //  a #sync of the producer may pass
+        WakeProducer();
+    }
+    return NULL;
+}
+
+//  The lease thread of --share: renew the lease of this process, and give
+//  back the commands of members gone, every second.
+void* ShareFunction(void* /* arg */)
+{
+    LogStream log_oss;
+    while (true)
+    {
+        if (!g_pShare->Heartbeat(g_ShareMember))
+        {
+            //  reaped while alive, e.g. stopped, others run its commands again
+            log_oss.str("");
+            log_oss << "lease thread: lease of shared queue " << g_ShareName << " lost, stop";
+            LogFile(log_oss.str());
+            cerr << g_Program << ": " << log_oss.str() << endl;
+            kill(getpid(), SIGTERM);
+            break;
+        }
+        size_type reaped = g_pShare->Reap(g_ShareLease);
+        if (reaped > 0)
+        {
+            log_oss.str("");
+            log_oss << "lease thread: gave back " << reaped << " shared commands of members gone";
+            LogFile(log_oss.str());
+        }
+        struct pollfd pfd;
+        pfd.fd = g_SharePipe[0];
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 1000) > 0)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+//  Stop dispatching: wake up waiting threads and the producer.
+void CancelDispatch(int sig)
+{
+    LockMutex(&g_MutexQueue, "g_MutexQueue");
+    g_CancelSignal = sig;
+    WakeAllWorkers();
+    UnlockMutex(&g_MutexQueue, "g_MutexQueue");
+    WakeProducer();
+}
+
+void* SignalFunction(void* /* arg */)
+{
+    int sig = 0;
+    while (sigwait(&g_SignalSet, &sig) != 0)
+    {
+    }
+    LogStream log_oss;
+    log_oss << "signal thread: caught signal " << sig << " (" << strsignal(sig) << "), stop dispatching";
+    LogFile(log_oss.str());
+    CancelDispatch(sig);
+    size_type num = KillChildren(SIGTERM);
+    log_oss.str("");
+    log_oss << "signal thread: sent SIGTERM to " << num << " running commands";
+    LogFile(log_oss.str());
+    //  escalate on second signal or when grace period expires
+    time_t deadline = time(NULL) + g_GracePeriod;
+    const char* reason = NULL;
+    while (reason == NULL && RunningChildren() > 0)
+    {
+        struct timespec ts = {0, 50 * 1000 * 1000};
+        if (sigtimedwait(&g_SignalSet, NULL, &ts) > 0)
+        {
+            reason = "second signal";
+        }
+        else if (time(NULL) >= deadline)
+        {
+            reason = "grace period expired";
+        }
+    }
+    if (reason != NULL)
+    {
+        num = KillChildren(SIGKILL);
+        log_oss.str("");
+        log_oss << "signal thread: " << reason << ", sent SIGKILL to " << num << " running commands";
+        LogFile(log_oss.str());
+    }
+    //  swallow further signals until exit
+    while (true)
+    {
+        sigwait(&g_SignalSet, &sig);
+    }
+    return NULL;
+}
+
+//  Add an input source given as FILE[:WEIGHT].
+void AddSource(const string& arg)
+{
+    Source* src = new Source();
+    src->id = g_vSource.size();
+    src->path = arg;
+    size_type pos = arg.rfind(':');
+    if (pos != string::npos && pos > 0 && pos + 1 < arg.size()
+        && arg.find_first_not_of("0123456789", pos + 1) == string::npos)
+    {
+        src->path = arg.substr(0, pos);
+        src->weight = atoi(arg.c_str() + pos + 1);
+        if (src->weight == 0)
+        {
+            cerr << g_Program << ": invalid weight of input: " << arg << endl;
+            exit(1);
+        }
+    }
+    g_vSource.push_back(src);
+}
+
+//  Return the index of the job class, or string::npos.
+size_type FindClass(const string& name)
+{
+    for (size_type c=0; c<g_vClass.size(); ++c)
+    {
+        if (g_vClass[c]->name == name)
+        {
+            return c;
+        }
+    }
+    return string::npos;
+}
+
+//  Create a job class, the default one has no priority.
+JobClass* NewClass(const string& name)
+{
+    JobClass* cls = new JobClass();
+    cls->name = name;
+    int ret = pthread_cond_init(&cls->cond, NULL);
+    if (ret != 0)
+    {
+        cerr << "pthread_cond_init error: JobClass::cond: error=" << ret << endl;
+        exit(1);
+    }
+    g_vClass.push_back(cls);
+    return cls;
+}
+
+//  Add a job class of NAME:THREADS[:NICE[:IOPRIO]], IOPRIO is idle, be[/N] or rt[/N].
+void AddClass(const string& arg)
+{
+    vector<string> fields;
+    NSStringHelper::SplitChar<string>(arg, back_inserter(fields), ':', true);
+    if (fields.size() < 2 || fields.size() > 4 || fields[0].empty() || FindClass(fields[0]) != string::npos)
+    {
+        cerr << g_Program << ": invalid job class: " << arg << endl;
+        exit(1);
+    }
+    JobClass* cls = NewClass(fields[0]);
+    int threads = atoi(fields[1].c_str());
+    if (threads <= 0)
+    {
+        cerr << g_Program << ": invalid thread number of job class: " << arg << endl;
+        exit(1);
+    }
+    cls->threads = threads;
+    if (fields.size() > 2)
+    {
+        cls->nice = atoi(fields[2].c_str());
+    }
+    if (fields.size() > 3)
+    {
+        //  IOPRIO_PRIO_VALUE(class, level)
+        const string& io = fields[3];
+        string::size_type slash = io.find('/');
+        const string name = io.substr(0, slash);
+        int level = slash == string::npos ? 4 : atoi(io.c_str() + slash + 1);
+        int ioclass = name == "rt" ? 1 : name == "be" ? 2 : name == "idle" ? 3 : 0;
+        if (ioclass == 0 || level < 0 || level > 7)
+        {
+            cerr << g_Program << ": invalid I/O priority of job class: " << arg << endl;
+            exit(1);
+        }
+        cls->ioprio = (ioclass << 13) | (ioclass == 3 ? 0 : level);
+    }
+}
+
+//  Return the index of the rate limit group, or string::npos.
+size_type FindRate(const string& name)
+{
+    for (size_type g=0; g<g_vRateGroup.size(); ++g)
+    {
+        if (g_vRateGroup[g].first == name)
+        {
+            return g;
+        }
+    }
+    return string::npos;
+}
+
+//  Add a start rate limit of [NAME=]N/UNIT[:BURST], UNIT is s, m or h, for
+//  all commands without NAME, else for those annotated rate=NAME.
+void AddRate(const string& arg)
+{
+    size_type eq = arg.find('=');
+    const string name = eq == string::npos ? "" : arg.substr(0, eq);
+    const string limit = arg.substr(eq == string::npos ? 0 : eq + 1);
+    char* end = NULL;
+    double num = strtod(limit.c_str(), &end);
+    double seconds = 0;
+    long burst = 1;
+    if (end[0] == '/')
+    {
+        seconds = end[1] == 's' ? 1 : end[1] == 'm' ? 60 : end[1] == 'h' ? 3600 : 0;
+        end += seconds > 0 ? 2 : 0;
+    }
+    if (seconds > 0 && end[0] == ':')
+    {
+        burst = strtol(end + 1, &end, 10);
+    }
+    if (!(num > 0) || seconds == 0 || *end != '\0' || burst < 1 || num / seconds > 1e9)
+    {
+        cerr << g_Program << ": invalid rate limit: " << arg << endl;
+        exit(1);
+    }
+    if (eq == string::npos ? g_pRate != NULL : name.empty() || FindRate(name) != string::npos)
+    {
+        cerr << g_Program << ": duplicate rate limit: " << arg << endl;
+        exit(1);
+    }
+    TokenBucket* bucket = new TokenBucket(num / seconds, burst);
+    if (eq == string::npos)
+    {
+        g_pRate = bucket;
+    }
+    else
+    {
+        g_vRateGroup.push_back(make_pair(name, bucket));
+    }
+}
+
+//  Set the failure policy of --halt, a comma separated list of now, soon,
+//  after-N-failures, after-X%-failures and segment.
+void SetHalt(const string& arg)
+{
+    vector<string> fields;
+    NSStringHelper::SplitChar<string>(arg, back_inserter(fields), ',', true);
+    bool trigger = false;
+    for (size_type i=0; i<fields.size(); ++i)
+    {
+        const string& field = fields[i];
+        const size_type prefix = strlen("after-");
+        const size_type suffix = strlen("-failures");
+        if (field == "now" || field == "soon")
+        {
+            g_HaltWhen = field == "now" ? HALT_NOW : HALT_SOON;
+        }
+        else if (field == "segment")
+        {
+            g_HaltSegment = true;
+        }
+        else if (field.size() > prefix + suffix && field.compare(0, prefix, "after-") == 0
+            && field.compare(field.size() - suffix, suffix, "-failures") == 0)
+        {
+            string num = field.substr(prefix, field.size() - prefix - suffix);
+            bool percent = num[num.size() - 1] == '%';
+            if (percent)
+            {
+                num.erase(num.size() - 1);
+            }
+            char* end = NULL;
+            double value = strtod(num.c_str(), &end);
+            if (num.empty() || *end != '\0' || value <= 0 || (percent ? value > 100 : value != static_cast<unsigned long long>(value)))
+            {
+                cerr << g_Program << ": invalid failure threshold of --halt: " << field << endl;
+                exit(1);
+            }
+            g_HaltPercent = percent ? value : 0;
+            g_HaltFailures = percent ? 1 : static_cast<unsigned long long>(value);
+            trigger = true;
+        }
+        else
+        {
+            cerr << g_Program << ": invalid policy of --halt: " << arg << endl;
+            exit(1);
+        }
+    }
+    if (trigger && g_HaltWhen == HALT_NEVER)
+    {
+        g_HaltWhen = HALT_SOON;
+    }
+}
+
+void MetricHeader(LogStream& out, const char* name, const char* type, const char* help)
+{
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+}
+
+void MetricValue(LogStream& out, const char* name, unsigned long long value)
+{
+    out << name << " " << value << "\n";
+}
+
+//  Format all metrics in Prometheus text format.
+void FormatMetrics(LogStream& out)
+{
+    out.str("");
+    uint64_t now = NowNs();
+    MetricHeader(out, "multirun_uptime_seconds", "gauge", "Seconds since multirun started.");
+    out << "multirun_uptime_seconds " << (now - g_StartTime) * 1e-9 << "\n";
+    MetricHeader(out, "multirun_threads", "gauge", "Number of worker threads (slots).");
+    MetricValue(out, "multirun_threads", g_vThread.size());
+    MetricHeader(out, "multirun_queued", "gauge", "Commands waiting in queues.");
+    MetricValue(out, "multirun_queued", g_Metrics.queued.load(memory_order_relaxed));
+    MetricHeader(out, "multirun_running", "gauge", "Commands running.");
+    MetricValue(out, "multirun_running", g_Metrics.running.load(memory_order_relaxed));
+    MetricHeader(out, "multirun_completed_total", "counter", "Commands finished successfully.");
+    MetricValue(out, "multirun_completed_total", g_Metrics.completed.load(memory_order_relaxed));
+    MetricHeader(out, "multirun_failed_total", "counter", "Commands finished with non-zero status.");
+    MetricValue(out, "multirun_failed_total", g_Metrics.failed.load(memory_order_relaxed));
+    MetricHeader(out, "multirun_interrupted_total", "counter", "Commands interrupted by cancellation.");
+    MetricValue(out, "multirun_interrupted_total", g_Metrics.interrupted.load(memory_order_relaxed));
+    MetricHeader(out, "multirun_barriers_total", "counter", "#sync barriers passed.");
+    MetricValue(out, "multirun_barriers_total", g_Metrics.barriers.load(memory_order_relaxed));
+    MetricHeader(out, "multirun_barrier_waits_total", "counter", "Times a thread went idle while a #sync was pending.");
+    MetricValue(out, "multirun_barrier_waits_total", g_Metrics.barrier_waits.load(memory_order_relaxed));
+    MetricHeader(out, "multirun_producer_stalls_total", "counter", "Times an input was not read because its queue was full.");
+    MetricValue(out, "multirun_producer_stalls_total", g_Metrics.producer_stalls.load(memory_order_relaxed));
+    MetricHeader(out, "multirun_builtins_total", "counter", "Commands run in process without a shell.");
+    MetricValue(out, "multirun_builtins_total", g_Metrics.builtins.load(memory_order_relaxed));
+    MetricHeader(out, "multirun_speculated_total", "counter", "Speculative copies of straggling commands launched.");
+    MetricValue(out, "multirun_speculated_total", g_Metrics.speculated.load(memory_order_relaxed));
+    MetricHeader(out, "multirun_speculation_wins_total", "counter", "Speculative copies that finished before the original.");
+    MetricValue(out, "multirun_speculation_wins_total", g_Metrics.speculation_wins.load(memory_order_relaxed));
+    MetricHeader(out, "multirun_locality_tries_total", "counter", "Dispatches to a thread whose previous command had a locality key.");
+    MetricValue(out, "multirun_locality_tries_total", g_Metrics.locality_tries.load(memory_order_relaxed));
+    MetricHeader(out, "multirun_locality_hits_total", "counter", "Dispatches of a command with the locality key of the previous one of its thread.");
+    MetricValue(out, "multirun_locality_hits_total", g_Metrics.locality_hits.load(memory_order_relaxed));
+    //  histogram
+    MetricHeader(out, "multirun_dispatch_latency_seconds", "histogram", "Time from enqueue to start of commands.");
+    unsigned long long count = 0;
+    for (size_type i=0; i<=g_LatencyBucketNum; ++i)
+    {
+        count += g_Metrics.latency[i].load(memory_order_relaxed);
+        out << "multirun_dispatch_latency_seconds_bucket{le=\"";
+        if (i < g_LatencyBucketNum)
+        {
+            out << g_LatencyBucket[i];
+        }
+        else
+        {
+            out << "+Inf";
+        }
+        out << "\"} " << count << "\n";
+    }
+    out << "multirun_dispatch_latency_seconds_sum " << g_Metrics.latency_sum.load(memory_order_relaxed) * 1e-9 << "\n";
+    out << "multirun_dispatch_latency_seconds_count " << count << "\n";
+    //  slots
+    MetricHeader(out, "multirun_slot_busy_ratio", "gauge", "Fraction of uptime each thread was running a command.");
+    for (size_type i=0; i<g_vThread.size(); ++i)
+    {
+        uint64_t busy = g_pSlotBusy[i].load(memory_order_relaxed);
+        uint64_t start = g_pSlotStart[i].load(memory_order_relaxed);
+        if (start != 0 && now > start)
+        {
+            busy += now - start;
+        }
+        out << "multirun_slot_busy_ratio{slot=\"" << i << "\"} " << (now > g_StartTime ? static_cast<double>(busy) / (now - g_StartTime) : 0.0) << "\n";
+    }
+    //  sources, a snapshot under g_MutexQueue
+    MetricHeader(out, "multirun_source_queued", "gauge", "Queue entries of each input.");
+    LockMutex(&g_MutexQueue, "g_MutexQueue");
+    for (size_type i=0; i<g_vSource.size(); ++i)
+    {
+        out << "multirun_source_queued{source=\"" << i << "\"} " << g_vSource[i]->items << "\n";
+    }
+    MetricHeader(out, "multirun_source_running", "gauge", "Commands running of each input.");
+    for (size_type i=0; i<g_vSource.size(); ++i)
+    {
+        out << "multirun_source_running{source=\"" << i << "\"} " << g_vSource[i]->running << "\n";
+    }
+    MetricHeader(out, "multirun_source_dispatched_total", "counter", "Commands dispatched of each input.");
+    for (size_type i=0; i<g_vSource.size(); ++i)
+    {
+        out << "multirun_source_dispatched_total{source=\"" << i << "\"} " << g_vSource[i]->dispatched << "\n";
+    }
+    UnlockMutex(&g_MutexQueue, "g_MutexQueue");
+}
+
+//  Replace the metrics file atomically, as expected by textfile collectors.
+void WriteMetricsFile(const LogStream& out)
+{
+    string tmp = g_MetricsFile + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        cerr << g_Program << ": open file error: " << tmp << endl;
+        return;
+    }
+    bool ok = WriteAll(fd, out.str().data(), out.str().size());
+    close(fd);
+    if (!ok || rename(tmp.c_str(), g_MetricsFile.c_str()) != 0)
+    {
+        cerr << g_Program << ": write file error: " << g_MetricsFile << endl;
+    }
+}
+
+//  Answer one HTTP request with the metrics, whatever its path.
+void ServeMetrics(LogStream& out)
+{
+    int fd = accept4(g_MetricsListen, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+    //  read the request head, briefly
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    char buf[4096];
+    if (poll(&pfd, 1, 1000) > 0)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        (void)n;
+    }
+    FormatMetrics(out);
+    LogStream head;
+    head << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+        << out.str().size() << "\r\nConnection: close\r\n\r\n";
+    if (WriteAll(fd, head.str().data(), head.str().size()))
+    {
+        WriteAll(fd, out.str().data(), out.str().size());
+    }
+    close(fd);
+}
+
+void* MetricsFunction(void* /* arg */)
+{
+    LogStream out;
+    uint64_t next = NowNs();
+    while (true)
+    {
+        int timeout = -1;
+        if (!g_MetricsFile.empty())
+        {
+            uint64_t now = NowNs();
+            if (now >= next)
+            {
+                FormatMetrics(out);
+                WriteMetricsFile(out);
+                next = now + g_MetricsInterval * 1000000000ull;
+            }
+            timeout = (next - now) / 1000000 + 1;
+        }
+        struct pollfd fds[2];
+        fds[0].fd = g_MetricsPipe[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = g_MetricsListen;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        if (poll(fds, g_MetricsListen >= 0 ? 2 : 1, timeout) > 0)
+        {
+            if (fds[0].revents != 0)
+            {
+                break;
+            }
+            if (fds[1].revents != 0)
+            {
+                ServeMetrics(out);
+            }
+        }
+    }
+    return NULL;
+}
+
+//  Parse a number of bytes with an optional K/M/G suffix, return false if invalid.
+bool ParseBytes(const char* str, unsigned long long& v)
+{
+    char* endp = NULL;
+    v = strtoull(str, &endp, 10);
+    if (*endp == 'K' || *endp == 'k') { v <<= 10; ++endp; }
+    else if (*endp == 'M' || *endp == 'm') { v <<= 20; ++endp; }
+    else if (*endp == 'G' || *endp == 'g') { v <<= 30; ++endp; }
+    return endp != str && *endp == '\0';
+}
+
+void InitOption(int argc, char* argv[])
+{
+    g_Program = argv[0];
+    bool cmdfile = false;
+    NewClass("default");
+    for (int i=1; i<argc; ++i)
+    {
+        const string arg = argv[i];
+        if (arg == "--help")
+        {
+            Usage(argc, argv);
+        }
+        else if (arg == "--verbose")
+        {
+            g_Verbose = true;
+        }
+        else if (arg == "-l" || arg == "--log-file")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            g_LogFile = argv[i];
+        }
+        else if (arg == "-i" || arg == "--input")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            AddSource(argv[i]);
+        }
+        else if (arg == "--class")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            AddClass(argv[i]);
+        }
+        else if (arg == "--aging")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            double aging = atof(argv[i]);
+            if (aging < 0)
+            {
+                cerr << argv[0] << ": invalid aging: " << argv[i] << endl;
+                exit(1);
+            }
+            g_AgingNs = static_cast<uint64_t>(aging * 1e9);
+        }
+        else if (arg == "--builtins")
+        {
+            g_Builtins = true;
+        }
+        else if (arg == "--skip")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            char* endp = NULL;
+            g_Skip = strtoull(argv[i], &endp, 10);
+            if (endp == argv[i] || *endp != '\0')
+            {
+                cerr << argv[0] << ": invalid argument for option " << arg << ": " << argv[i] << endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--compile")
+        {
+            i += 2;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            g_CompileInput = argv[i - 1];
+            g_CompileOutput = argv[i];
+        }
+        else if (arg == "--jobserver")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            g_JobServerMode = argv[i];
+            if (g_JobServerMode != "fifo" && g_JobServerMode != "pipe" && g_JobServerMode != "off")
+            {
+                cerr << argv[0] << ": invalid argument for option " << arg << ": " << argv[i] << endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--rate")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            AddRate(argv[i]);
+        }
+        else if (arg == "--halt")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            SetHalt(argv[i]);
+        }
+        else if (arg == "--share")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            g_ShareName = argv[i];
+        }
+        else if (arg == "--status")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            g_StatusName = argv[i];
+        }
+        else if (arg == "--speculate")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            g_SpeculateFactor = atof(argv[i]);
+            if (g_SpeculateFactor < 0)
+            {
+                cerr << argv[0] << ": invalid speculation factor: " << argv[i] << endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--locality")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            int window = atoi(argv[i]);
+            if (window < 0)
+            {
+                cerr << argv[0] << ": invalid locality window: " << argv[i] << endl;
+                exit(1);
+            }
+            g_LocalityWindow = window;
+        }
+        else if (arg == "--dedup")
+        {
+            g_Dedup = true;
+        }
+        else if (arg == "-q" || arg == "--queue-size" || arg == "--queue-bytes" || arg == "--dedup-memory")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            //  accept K/M/G suffix
+            unsigned long long v;
+            if (!ParseBytes(argv[i], v))
+            {
+                cerr << argv[0] << ": invalid argument for option " << arg << ": " << argv[i] << endl;
+                exit(1);
+            }
+            if (arg == "--queue-bytes")
+            {
+                g_QueueMaxBytes = v;
+            }
+            else if (arg == "--dedup-memory")
+            {
+                g_Dedup = true;
+                g_DedupMemory = v;
+            }
+            else
+            {
+                g_QueueMaxItems = v;
+            }
+        }
+        else if (arg == "--metrics-file" || arg == "--metrics-port" || arg == "--metrics-interval")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            if (arg == "--metrics-file")
+            {
+                g_MetricsFile = argv[i];
+            }
+            else if (arg == "--metrics-port")
+            {
+                g_MetricsPort = atoi(argv[i]);
+                if (g_MetricsPort <= 0 || g_MetricsPort > 65535)
+                {
+                    cerr << argv[0] << ": invalid port: " << argv[i] << endl;
+                    exit(1);
+                }
+            }
+            else
+            {
+                g_MetricsInterval = atoi(argv[i]);
+                if (g_MetricsInterval <= 0)
+                {
+                    cerr << argv[0] << ": invalid interval: " << argv[i] << endl;
+                    exit(1);
+                }
+            }
+        }
+        else if (arg == "--trace")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            g_TraceFile = argv[i];
+        }
+        else if (arg == "--simulate")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            vector<string> counts;
+            NSStringHelper::SplitChar<string>(argv[i], back_inserter(counts), ',');
+            for (size_type k=0; k<counts.size(); ++k)
+            {
+                int slots = atoi(counts[k].c_str());
+                if (slots <= 0)
+                {
+                    cerr << argv[0] << ": invalid thread number: " << counts[k] << endl;
+                    exit(1);
+                }
+                g_vSimulateSlots.push_back(slots);
+            }
+        }
+        else if (arg == "--history")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            g_vHistoryFile.push_back(argv[i]);
+        }
+        else if (arg == "-g" || arg == "--grace-period")
+        {
+            ++i;
+            if (i >= argc)
+            {
+                cerr << argv[0] << ": missing argument for option " << arg << endl;
+                exit(1);
+            }
+            g_GracePeriod = atoi(argv[i]);
+            if (g_GracePeriod < 0)
+            {
+                cerr << argv[0] << ": invalid grace period: " << argv[i] << endl;
+                exit(1);
+            }
+        }
+        else if (arg[0] == '-' && arg != "-")
+        {
+            cerr << argv[0] << ": invalid option: " << arg << endl;
+            exit(1);
+        }
+        else
+        {
+            if (!cmdfile)
+            {
+                //  - for none, to only run shared commands
+                if (arg != "-")
+                {
+                    AddSource(arg);
+                }
+                cmdfile = true;
+            }
+            else if (g_vThread.empty())
+            {
+                int threadnum = atoi(arg.c_str());
+                g_vThread.resize(threadnum, static_cast<pthread_t>(-1));
+            }
+            else 
+            {
+                cerr << argv[0] << ": extra operand: " << arg << endl;
+                exit(1);
+            }
+        }
+    }
+    if (!g_vSimulateSlots.empty() && !g_vThread.empty())
+    {
+        g_vSimulateSlots.push_back(g_vThread.size());
+    }
+    if (!g_CompileOutput.empty())
+    {
+        return;
+    }
+    if (!cmdfile || (g_vThread.empty() && g_vSimulateSlots.empty()))
+    {
+        Usage(argc, argv);
+    }
+    if (g_vSource.empty() && g_ShareName.empty())
+    {
+        cerr << argv[0] << ": no input, - needs --share" << endl;
+        exit(1);
+    }
+    if (!g_ShareName.empty() && (g_vClass.size() > 1 || g_SpeculateFactor > 0 || g_HaltWhen != HALT_NEVER || g_HaltSegment))
+    {
+        cerr << argv[0] << ": --share can not be used with --class, --speculate or --halt" << endl;
+        exit(1);
+    }
+    g_SourcesOpen = g_vSource.size();
+    //  threads of the default class first, then of the other classes
+    g_vClass[0]->threads = g_vThread.size();
+    g_vThreadClass.clear();
+    for (size_type c=0; c<g_vClass.size(); ++c)
+    {
+        g_vThreadClass.resize(g_vThreadClass.size() + g_vClass[c]->threads, c);
+    }
+    g_vThread.resize(g_vThreadClass.size(), static_cast<pthread_t>(-1));
+    for (size_type k=0; k<g_vSource.size(); ++k)
+    {
+        g_vSource[k]->lanes.resize(g_vClass.size());
+        g_vSource[k]->builtin = g_Builtins;
+        g_vSource[k]->skip = g_Skip;
+    }
+    if (g_Dedup)
+    {
+        g_pDedup = new DedupFilter(g_DedupMemory);
+    }
+    ////  mkfifo
+    //if (mkfifo(g_CmdFile.c_str(), S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH))
+    //{
+    //    if (errno == EEXIST)
+    //    {
+    //        cerr << "mkfifo error: file exist [ignored]: " << g_CmdFile << endl;
+    //    }
+    //    else
+    //    {
+    //        cerr << "mkfifo error: " << g_CmdFile << endl;
+    //        exit(1);
+    //    }
+    //}
+    if (g_Verbose)
+    {
+        cerr << "g_Verbose        : " << g_Verbose << endl;
+        for (size_type i=0; i<g_vSource.size(); ++i)
+        {
+            cerr << "g_vSource[" << i << "]      : " << g_vSource[i]->path << ":" << g_vSource[i]->weight << endl;
+        }
+        cerr << "g_vThread.size() : " << g_vThread.size() << endl;
+        cerr << "g_LogFile        : " << g_LogFile << endl;
+        cerr << "g_QueueMaxItems  : " << g_QueueMaxItems << endl;
+        cerr << "g_QueueMaxBytes  : " << g_QueueMaxBytes << endl;
+        cerr << "g_GracePeriod    : " << g_GracePeriod << endl;
+        for (size_type c=0; c<g_vClass.size(); ++c)
+        {
+            cerr << "g_vClass[" << c << "]       : " << g_vClass[c]->name << ":" << g_vClass[c]->threads
+                << ":" << g_vClass[c]->nice << ":" << g_vClass[c]->ioprio << endl;
+        }
+        cerr << "g_AgingNs        : " << g_AgingNs << endl;
+        cerr << "g_LocalityWindow : " << g_LocalityWindow << endl;
+        cerr << "g_Dedup          : " << g_Dedup << endl;
+        cerr << "g_DedupMemory    : " << g_DedupMemory << endl;
+    }
+}
+
+void InitSignal()
+{
+    //  block in all threads, handled synchronously by the signal thread
+    sigemptyset(&g_SignalSet);
+    sigaddset(&g_SignalSet, SIGINT);
+    sigaddset(&g_SignalSet, SIGTERM);
+    sigaddset(&g_SignalSet, SIGHUP);
+    int ret = pthread_sigmask(SIG_BLOCK, &g_SignalSet, NULL);
+    if (ret != 0)
+    {
+        cerr << "pthread_sigmask error: error=" << ret << endl;
+        exit(1);
+    }
+    //  a command may stop reading its part of #pipepart, then splice fails by EPIPE
+    sigset_t pipe_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, NULL);
+    if (pipe2(g_WakePipe, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        cerr << "pipe2 error: errno=" << errno << endl;
+        exit(1);
+    }
+}
+
+void InitThread()
+{
+    assert(!g_vThread.empty());
+    int ret;
+    size_type i;
+    //  init mutex 
+    ret = pthread_mutex_init(&g_MutexQueue, NULL);
+    if (ret != 0)
+    {
+        cerr << "pthread_mutex_init error: g_MutexQueue: error=" << ret << endl;
+        exit(1);
+    }
+    ret = pthread_mutex_init(&g_MutexLog, NULL);
+    if (ret != 0)
+    {
+        cerr << "pthread_mutex_init error: g_MutexLog: error=" << ret << endl;
+        exit(1);
+    }
+    ret = pthread_mutex_init(&g_MutexChild, NULL);
+    if (ret != 0)
+    {
+        cerr << "pthread_mutex_init error: g_MutexChild: error=" << ret << endl;
+        exit(1);
+    }
+    g_vChildPid.resize(g_vThread.size(), 0);
+    if (g_SpeculateFactor > 0)
+    {
+        g_vChildLost.resize(g_vThread.size(), 0);
+        g_vSlotRun.resize(g_vThread.size());
+    }
+    g_pSlotKey = new uint32_t[g_vThread.size()]();
+    //  metrics
+    g_StartTime = NowNs();
+    InitTrace();
+    g_pSlotBusy = new Counter[g_vThread.size()];
+    g_pSlotStart = new Counter[g_vThread.size()];
+    for (i=0; i<g_vThread.size(); ++i)
+    {
+        g_pSlotBusy[i].store(0);
+        g_pSlotStart[i].store(0);
+    }
+    if (!g_StatusName.empty())
+    {
+        g_pStatus = StatusTable::Create(g_StatusName, g_vThread.size());
+        if (g_pStatus == NULL)
+        {
+            cerr << g_Program << ": can not create status table " << g_StatusName << ": "
+                << (errno == EEXIST ? "in use by another process" : strerror(errno)) << endl;
+            exit(1);
+        }
+        PublishStatus();
+    }
+    if (!g_ShareName.empty())
+    {
+        g_pShare = SharedQueue::Attach(g_ShareName, g_ShareCapacity);
+        if (g_pShare == NULL)
+        {
+            cerr << g_Program << ": can not attach shared queue " << g_ShareName << ": " << strerror(errno) << endl;
+            exit(1);
+        }
+        g_ShareMember = g_pShare->Join(!g_vSource.empty());
+        if (g_ShareMember < 0)
+        {
+            cerr << g_Program << ": too many members of shared queue " << g_ShareName << endl;
+            exit(1);
+        }
+        g_ShareProduced.store(g_vSource.empty());
+        g_vShareTicket.resize(g_vThread.size(), 0);
+    }
+    //  join the jobserver of make, or serve one
+    if (g_JobServerMode != "off")
+    {
+        string error;
+        const char* makeflags = getenv("MAKEFLAGS");
+        g_pJobServer = JobServer::Client(makeflags, error);
+        LogStream log_oss;
+        if (!error.empty())
+        {
+            log_oss << "main thread: " << error;
+            LogFile(log_oss.str());
+        }
+        if (g_pJobServer != NULL)
+        {
+            log_oss.str("");
+            log_oss << "main thread: join the jobserver of MAKEFLAGS=" << makeflags;
+            LogFile(log_oss.str());
+        }
+        else if (!g_JobServerMode.empty())
+        {
+            g_pJobServer = JobServer::Server(g_vThread.size(), g_JobServerMode == "fifo", error);
+            if (g_pJobServer == NULL)
+            {
+                cerr << g_Program << ": " << error << endl;
+                exit(1);
+            }
+            string flags = g_pJobServer->MakeFlags(makeflags, g_vThread.size());
+            setenv("MAKEFLAGS", flags.c_str(), 1);
+            log_oss.str("");
+            log_oss << "main thread: serve " << g_vThread.size() << " jobserver slots, MAKEFLAGS=" << flags;
+            LogFile(log_oss.str());
+        }
+    }
+    if (g_MetricsPort > 0)
+    {
+        //  localhost only
+        g_MetricsListen = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int on = 1;
+        setsockopt(g_MetricsListen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(g_MetricsPort);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (g_MetricsListen < 0 || bind(g_MetricsListen, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+            || listen(g_MetricsListen, 16) != 0)
+        {
+            cerr << g_Program << ": can not listen on 127.0.0.1:" << g_MetricsPort << ": errno=" << errno << endl;
+            exit(1);
+        }
+    }
+    //  create thread
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
+    for (i=0; i<g_vThread.size(); ++i)
+    {
+        ret = pthread_create(&g_vThread[i], &attr, g_pShare != NULL ? ShareWorkerFunction : ThreadFunction,
+            reinterpret_cast<void*>(i));
+        if (ret != 0)
+        {
+            cerr << "pthread_create error: error=" << ret << "    i=" << i << endl;
+            exit(1);
+        }
+        LogStream log_oss;
+        log_oss << "main thread: create g_vThread[" << i << "]=" << g_vThread[i];
         LogFile(log_oss.str().c_str());
     }
+    //  create signal thread
+    ret = pthread_create(&g_SignalThread, &attr, SignalFunction, NULL);
+    if (ret != 0)
+    {
+        cerr << "pthread_create error: g_SignalThread: error=" << ret << endl;
+        exit(1);
+    }
+    pthread_detach(g_SignalThread);
+    //  create metrics thread
+    if (!g_MetricsFile.empty() || g_MetricsListen >= 0)
+    {
+        if (pipe2(g_MetricsPipe, O_CLOEXEC) != 0)
+        {
+            cerr << "pipe2 error: errno=" << errno << endl;
+            exit(1);
+        }
+        ret = pthread_create(&g_MetricsThread, &attr, MetricsFunction, NULL);
+        if (ret != 0)
+        {
+            cerr << "pthread_create error: g_MetricsThread: error=" << ret << endl;
+            exit(1);
+        }
+    }
+    //  create lease thread
+    if (g_pShare != NULL)
+    {
+        if (pipe2(g_SharePipe, O_CLOEXEC) != 0)
+        {
+            cerr << "pipe2 error: errno=" << errno << endl;
+            exit(1);
+        }
+        ret = pthread_create(&g_ShareThread, &attr, ShareFunction, NULL);
+        if (ret != 0)
+        {
+            cerr << "pthread_create error: g_ShareThread: error=" << ret << endl;
+            exit(1);
+        }
+    }
+}
+
+void Uninit()
+{
+    size_type i;
+    int ret;
+    ////  unlink file
+    //if (unlink(g_CmdFile.c_str()) != 0)
+    //{
+    //    cerr << "unlink error: " << g_CmdFile << endl;
+    //    exit(1);
+    //}
+    //for (i=0; i<g_vThread.size(); ++i)
+    //{
+    //    ret = pthread_cancel(g_vThread[i]);
+    //    if (ret != 0)
+    //    {
+    //        cerr << "pthread_cancel error: error=" << ret << endl;
+    //        exit(1);
+    //    }
+    //}
+    //  john thread
+    for (i=0; i<g_vThread.size(); ++i)
+    {
+        ret = pthread_join(g_vThread[i], NULL);
+        if (ret != 0)
+        {
+            cerr << "pthread_join error: error=" << ret << "    g_vThread[" << i << "]=" << g_vThread[i] << endl;
+            exit(1);
+        }
+    }
+#ifdef ALLOC_STATS
+    //  allocations after warm-up, up to the last thread exits
+    size_type alloc_num = g_AllocCount.load(memory_order_relaxed) - g_AllocWarm;
+#endif
+    LogStream log_oss;
+    for (i=0; i<g_vThread.size(); ++i)
+    {
+        log_oss.str("");
+        log_oss << "main thread: joined g_vThread[" << i << "]=" << g_vThread[i];
+        LogFile(log_oss.str());
+    }
+#ifdef ALLOC_STATS
+    if (g_Dispatched > g_WarmCommands)
+    {
+        size_type num = alloc_num;
+        log_oss.str("");
+        log_oss << "main thread: " << num << " heap allocations in " << (g_Dispatched - g_WarmCommands)
+            << " commands after warm-up";
+        LogFile(log_oss.str());
+        cerr << log_oss.str() << endl;
+    }
+#endif
+    //  stop metrics thread, and write final metrics
+    if (g_MetricsPipe[1] >= 0)
+    {
+        close(g_MetricsPipe[1]);
+        ret = pthread_join(g_MetricsThread, NULL);
+        if (ret != 0)
+        {
+            cerr << "pthread_join error: g_MetricsThread: error=" << ret << endl;
+            exit(1);
+        }
+        if (!g_MetricsFile.empty())
+        {
+            FormatMetrics(log_oss);
+            WriteMetricsFile(log_oss);
+        }
+    }
+    //  stop lease thread, and leave the shared queue
+    if (g_pShare != NULL)
+    {
+        close(g_SharePipe[1]);
+        ret = pthread_join(g_ShareThread, NULL);
+        if (ret != 0)
+        {
+            cerr << "pthread_join error: g_ShareThread: error=" << ret << endl;
+            exit(1);
+        }
+        uint64_t failed = g_pShare->Failed(g_ShareMember);
+        g_ErrorOccur = g_ErrorOccur || failed > 0;
+        log_oss.str("");
+        log_oss << "main thread: shared queue " << g_ShareName << ": pushed " << g_SharePushed.load() << ", finished "
+            << g_pShare->Finished(g_ShareMember) << ", failed " << failed;
+        LogFile(log_oss.str());
+        g_pShare->Leave(g_ShareMember);
+        delete g_pShare;
+        g_pShare = NULL;
+    }
+    delete g_pJobServer;
+    g_pJobServer = NULL;
+    delete g_pRate;
+    g_pRate = NULL;
+    for (i=0; i<g_vRateGroup.size(); ++i)
+    {
+        delete g_vRateGroup[i].second;
+    }
+    g_vRateGroup.clear();
+    UninitTrace();
+    PublishStatus();
+    delete g_pStatus;
+    g_pStatus = NULL;
+    //  destroy mutex
+    ret = pthread_mutex_destroy(&g_MutexQueue);
+    if (ret != 0)
+    {
+        cerr << "pthread_mutex_destroy error: g_MutexQueue: error=" << ret << endl;
+        exit(1);
+    }
+    //  destroy cond
+    for (i=0; i<g_vClass.size(); ++i)
+    {
+        ret = pthread_cond_destroy(&g_vClass[i]->cond);
+        if (ret != 0)
+        {
+            cerr << "pthread_cond_destroy error: JobClass::cond: error=" << ret << endl;
+            exit(1);
+        }
+    }
+    //  source statistics
+    size_type discarded = 0;
+    double busy = 0;
+    for (i=0; i<g_vSource.size(); ++i)
+    {
+        busy += g_vSource[i]->busy;
+    }
+    for (i=0; i<g_vSource.size(); ++i)
+    {
+        const Source* src = g_vSource[i];
+        discarded += src->items;
+        log_oss.str("");
+        log_oss << "main thread: source " << i << " " << src->path << " (weight " << src->weight << "): "
+            << src->dispatched << " commands, queue high-water mark " << src->high_items << " commands "
+            << src->high_bytes << " bytes, producer blocked " << src->stalls << " times, peak "
+            << src->high_running << " slots, " << static_cast<long long>(src->busy) << " slot-seconds ("
+            << static_cast<long long>(busy > 0 ? 100 * src->busy / busy : 0) << "%)";
+        LogFile(log_oss.str());
+        if (g_Verbose)
+        {
+            cerr << log_oss.str() << endl;
+        }
+    }
+    for (i=0; i<g_vClass.size() && g_vClass.size()>1; ++i)
+    {
+        const JobClass* cls = g_vClass[i];
+        log_oss.str("");
+        log_oss << "main thread: class " << cls->name << ": " << cls->threads << " threads, nice " << cls->nice << ", ioprio ";
+        if (cls->ioprio < 0)
+        {
+            log_oss << "inherited";
+        }
+        else
+        {
+            log_oss << (cls->ioprio >> 13) << "/" << (cls->ioprio & 7);
+        }
+        log_oss << ", " << cls->dispatched << " commands, "
+            << static_cast<long long>(cls->busy) << " slot-seconds ("
+            << static_cast<long long>(busy > 0 ? 100 * cls->busy / busy : 0) << "%)";
+        LogFile(log_oss.str());
+        if (g_Verbose)
+        {
+            cerr << log_oss.str() << endl;
+        }
+    }
+    if (g_LocalityWindow > 0)
+    {
+        unsigned long long tries = g_Metrics.locality_tries.load(memory_order_relaxed);
+        unsigned long long hits = g_Metrics.locality_hits.load(memory_order_relaxed);
+        log_oss.str("");
+        log_oss << "main thread: locality: " << hits << " of " << tries
+            << " dispatches kept the key of the previous command of the thread ("
+            << (tries > 0 ? 100.0 * hits / tries : 0.0) << "%)";
+        LogFile(log_oss.str());
+        if (g_Verbose)
+        {
+            cerr << log_oss.str() << endl;
+        }
+    }
+    if (g_SpeculateFactor > 0)
+    {
+        unsigned long long launched = g_Metrics.speculated.load(memory_order_relaxed);
+        unsigned long long wins = g_Metrics.speculation_wins.load(memory_order_relaxed);
+        log_oss.str("");
+        log_oss << "main thread: speculation: " << launched << " copies launched, " << wins << " won by the copy, "
+            << g_SpeculateLost << " by the original, tail time saved " << g_SpeculateSaved
+            << " seconds (elapsed of originals minus copies), killed attempts used " << g_SpeculateWasted << " slot-seconds";
+        LogFile(log_oss.str());
+        if (g_Verbose)
+        {
+            cerr << log_oss.str() << endl;
+        }
+    }
+    if (g_pDedup != NULL)
+    {
+        log_oss.str("");
+        log_oss << "main thread: dedup: " << g_DedupSkipped << " duplicates skipped, " << g_pDedup->Num()
+            << " distinct commands in " << (g_pDedup->Exact() ? "exact set" : "Bloom filter") << " of "
+            << g_pDedup->Bytes() << " bytes, false-positive rate " << g_pDedup->FalsePositiveRate();
+        LogFile(log_oss.str());
+        if (g_Verbose)
+        {
+            cerr << log_oss.str() << endl;
+        }
+        delete g_pDedup;
+        g_pDedup = NULL;
+    }
+    if (g_HaltWhen != HALT_NEVER || g_HaltSegment)
+    {
+        unsigned long long failed = g_Metrics.failed.load(memory_order_relaxed);
+        log_oss.str("");
+        log_oss << failed << " commands failed, " << g_Metrics.interrupted.load(memory_order_relaxed) << " cancelled, "
+            << g_Metrics.queued.load(memory_order_relaxed) + g_HaltCancelled << " not run";
+        if (g_Halted != HALT_NEVER)
+        {
+            log_oss << ", halted " << (g_Halted == HALT_NOW ? "now" : "soon");
+        }
+        LogFile("main thread: " + log_oss.str());
+        if (failed > 0)
+        {
+            cerr << g_Program << ": " << log_oss.str() << endl;
+        }
+    }
+    //  exit
+    if (g_CancelSignal != 0)
+    {
+        log_oss.str("");
+        log_oss << "main thread: interrupted by signal " << g_CancelSignal << ", " << g_Interrupted
+            << " running commands interrupted, " << discarded << " queued commands discarded, I am exiting, bye";
+        LogFile(log_oss.str());
+    }
+    else if (g_ErrorOccur)
+    {
+        LogFile("main thread: something wrong, anyway, I am exiting, bye");
+    }
+    else
+    {
+        LogFile("main thread: all threads exited normally, I am exiting, bye");
+    }
+    for (i=0; i<g_vSource.size(); ++i)
+    {
+        delete g_vSource[i];
+    }
+    g_vSource.clear();
+    for (i=0; i<g_vClass.size(); ++i)
+    {
+        delete g_vClass[i];
+    }
+    g_vClass.clear();
+    for (i=0; i<g_vSpec.size(); ++i)
+    {
+        delete g_vSpec[i];
+    }
+    g_vSpec.assign(1, NULL);
+    g_SpecIndex.clear();
+    for (i=0; i<g_vPipePart.size(); ++i)
+    {
+        PipePart* part = g_vPipePart[i];
+        if (part->data != NULL)
+        {
+            munmap(const_cast<char*>(part->data), part->size);
+        }
+        close(part->fd);
+        pthread_mutex_destroy(&part->mutex);
+        delete part;
+    }
+    g_vPipePart.clear();
+    for (i=0; i<g_vReducer.size(); ++i)
+    {
+        close(g_vReducer[i]->out_fd);
+        pthread_mutex_destroy(&g_vReducer[i]->mutex);
+        delete g_vReducer[i];
+    }
+    g_vReducer.clear();
+    ret = pthread_mutex_destroy(&g_MutexLog);
+    if (ret != 0)
+    {
+        cerr << "pthread_mutex_destroy error: g_MutexLog: error=" << ret << endl;
+        exit(1);
+    }
+}
+
+//  Take the next line from the buffer of reader, return false if more data
+//  has to be read. At end of file the last line may lack its newline.
+bool NextLine(LineReader& reader, string& line)
+{
+    const char* p = static_cast<const char*>(memchr(reader.buf + reader.begin, '\n', reader.end - reader.begin));
+    if (p != NULL)
+    {
+        line.assign(reader.partial);
+        line.append(reader.buf + reader.begin, p - reader.buf - reader.begin);
+        reader.partial.clear();
+        reader.begin = p - reader.buf + 1;
+        return true;
+    }
+    reader.partial.append(reader.buf + reader.begin, reader.end - reader.begin);
+    reader.begin = reader.end = 0;
+    if (reader.eof && !reader.partial.empty())
+    {
+        line.assign(reader.partial);
+        reader.partial.clear();
+        return true;
+    }
+    return false;
+}
+
+//  Read available data into the consumed buffer of reader.
+void FillReader(LineReader& reader, const string& path)
+{
+    assert(reader.begin == reader.end);
+    ssize_t n = read(reader.fd, reader.buf, sizeof(reader.buf));
+    if (n < 0)
+    {
+        if (errno == EINTR || errno == EAGAIN)
+        {
+            return;
+        }
+        cerr << "read error: errno=" << errno << "    file=" << path << endl;
+        exit(1);
+    }
+    if (n == 0)
+    {
+        reader.eof = true;
+    }
+    reader.begin = 0;
+    reader.end = n;
+}
+
+//  Non-blocking open, so that waiting for a FIFO writer does not block other sources.
+void OpenSource(Source* src)
+{
+    if (CompiledFile::Named(src->path))
+    {
+        src->compiled = new CompiledFile();
+        if (!src->compiled->Open(src->path))
+        {
+            cerr << g_Program << ": not a valid compiled command file: " << src->path << endl;
+            exit(1);
+        }
+        src->reader.fd = -1;
+        return;
+    }
+    src->reader.fd = open(src->path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (src->reader.fd < 0)
+    {
+        cerr << "open error: " << src->path << endl;
+        exit(1);
+    }
+    src->reader.eof = false;
+    src->reader.begin = src->reader.end = 0;
+}
+
+void CloseSource(Source* src)
+{
+    delete src->compiled;
+    src->compiled = NULL;
+    if (src->reader.fd >= 0)
+    {
+        close(src->reader.fd);
+        src->reader.fd = -1;
+    }
+}
+
+bool QueueFull(const Source* src, size_type size)
+{
+    if (src->items == 0)
+    {
+        //  always accept one command, however long
+        return false;
+    }
+    return (g_QueueMaxItems != 0 && src->items >= g_QueueMaxItems)
+        || (g_QueueMaxBytes != 0 && src->bytes + size > g_QueueMaxBytes);
+}
+
+//  Add a command of src to the simulation, with its mean duration in history.
+void SimulateCommand(Source* src, const string& line, unsigned flags)
+{
+    if ((flags & CMD_SYNC) != 0)
+    {
+        g_Simulator.AddBarrier(src->id);
+        return;
+    }
+    unordered_map<string, pair<double, size_type> >::const_iterator it = g_History.find(line);
+    if (it != g_History.end())
+    {
+        g_Simulator.AddTask(src->id, it->second.first / it->second.second);
+        ++g_SimulateKnown;
+    }
+    else
+    {
+        g_Simulator.AddTask(src->id, g_HistoryMean);
+        ++g_SimulateUnknown;
+    }
+}
+
+//  The locality key of a command of src: the key of #locality, or the first
+//  argument with a '/', e.g. the input file, else the first argument not
+//  starting with '-'. 0 if none.
+uint32_t LocalityKey(const Source* src, const string& line)
+{
+    const char* begin = src->key.data();
+    const char* end = begin + src->key.size();
+    if (src->key.empty())
+    {
+        //  skip the program and options
+        const char* p = line.data();
+        const char* last = p + line.size();
+        p = static_cast<const char*>(memchr(p, ' ', last - p));
+        while (p != NULL && p < last)
+        {
+            while (p < last && (*p == ' ' || *p == '\t'))
+            {
+                ++p;
+            }
+            const char* q = p;
+            while (q < last && *q != ' ' && *q != '\t')
+            {
+                ++q;
+            }
+            if (q > p && memchr(p, '/', q - p) != NULL)
+            {
+                begin = p;
+                end = q;
+                break;
+            }
+            if (q > p && *p != '-' && begin == end)
+            {
+                begin = p;
+                end = q;
+            }
+            p = q;
+        }
+    }
+    if (begin == end)
+    {
+        return 0;
+    }
+    //  FNV-1a
+    uint32_t h = 2166136261u;
+    for (const char* p=begin; p<end; ++p)
+    {
+        h = (h ^ static_cast<unsigned char>(*p)) * 16777619u;
+    }
+    return h == 0 ? 1 : h;
+}
+
+//  Push one command of src to the shared queue, return false if the queue
+//  is full, or a #sync waits for the commands pushed before it to finish.
+bool ShareCommand(Source* src, const string& line, unsigned flags)
+{
+    if ((flags & CMD_SYNC) != 0)
+    {
+        return g_pShare->Finished(g_ShareMember) >= g_SharePushed.load();
+    }
+    if (src->pending_annot.spec != 0)
+    {
+        cerr << g_Program << ": can not share a command with cwd, env, redirection, rate or #reduce: " << line << endl;
+        exit(1);
+    }
+    if (line.size() >= SharedQueue::TEXT_SIZE)
+    {
+        cerr << g_Program << ": can not share a command longer than " << SharedQueue::TEXT_SIZE - 1 << " bytes: "
+            << line.substr(0, 64) << "..." << endl;
+        exit(1);
+    }
+    if (!g_pShare->Push(g_ShareMember, line.data(), line.size(), src->builtin ? CMD_BUILTIN : 0))
+    {
+        if (!src->full)
+        {
+            src->full = true;
+            ++src->stalls;
+            g_Metrics.producer_stalls.fetch_add(1, memory_order_relaxed);
+        }
+        return false;
+    }
+    src->full = false;
+    g_SharePushed.fetch_add(1);
+    ++src->dispatched;
+    return true;
+}
+
+//  Submit one command to the queue of src, return false if the queue is
+//  full, the producer then stops reading src until a thread pops from it.
+bool PushCommand(Source* src, const string& line, unsigned flags)
+{
+    if (!g_vSimulateSlots.empty())
+    {
+        SimulateCommand(src, line, flags);
+        return true;
+    }
+    if (g_pShare != NULL)
+    {
+        return ShareCommand(src, line, flags);
+    }
+    int ret;
+    //  lock g_MutexQueue
+    ret = pthread_mutex_lock(&g_MutexQueue);
+    if (ret != 0)
+    {
+        cerr << "pthread_mutex_lock error: g_MutexQueue: error=" << ret << endl;
+        exit(1);
+    }
+    if (QueueFull(src, line.size()))
+    {
+        if (!src->full)
+        {
+            src->full = true;
+            ++src->stalls;
+            g_Metrics.producer_stalls.fetch_add(1, memory_order_relaxed);
+            TraceInstant(g_vThread.size(), "producer stall", src->id, src->items);
+        }
+        UnlockMutex(&g_MutexQueue, "g_MutexQueue");
+        return false;
+    }
+    if (src->halted)
+    {
+        //  cancelled by --halt segment, Produce stops reading src
+        g_HaltCancelled += (flags & CMD_SYNC) == 0 ? 1 : 0;
+        UnlockMutex(&g_MutexQueue, "g_MutexQueue");
+        return true;
+    }
+    //  push, a #sync to every lane
+    uint64_t now = NowNs();
+    if ((flags & CMD_SYNC) != 0)
+    {
+        for (size_type c=0; c<src->lanes.size(); ++c)
+        {
+            src->lanes[c].later.push(g_Arena.Create(line.data(), line.size(), flags, now));
+        }
+        src->items += src->lanes.size();
+        src->bytes += line.size() * src->lanes.size();
+    }
+    else
+    {
+        uint32_t key = g_LocalityWindow > 0 ? LocalityKey(src, line) : 0;
+        Lane& lane = src->lanes[src->cls];
+        if (src->pending_annot.idempotent)
+        {
+            flags |= CMD_IDEMPOTENT;
+        }
+        if (src->builtin)
+        {
+            flags |= CMD_BUILTIN;
+        }
+        flags |= (PipelineStages(line) - 1) << CMD_STAGE_SHIFT;
+        CommandHandle handle = g_Arena.Create(line.data(), line.size(), flags, now, key, src->pending_annot.priority,
+            src->pending_annot.spec, src->pending_annot.item);
+        if (lane.later.empty())
+        {
+            int64_t score = Score(handle);
+            lane.ready.push(std::move(handle), score);
+        }
+        else
+        {
+            lane.later.push(std::move(handle));
+        }
+        g_Metrics.queued.fetch_add(1, memory_order_relaxed);
+        PublishStatus();
+        ++src->items;
+        src->bytes += line.size();
+    }
+    TraceInstant(g_vThread.size(), (flags & CMD_SYNC) ? "push #sync" : "push", src->id, src->items);
+    src->high_items = max(src->high_items, src->items);
+    src->high_bytes = max(src->high_bytes, src->bytes);
+    //  unlock g_MutexQueue
+    ret = pthread_mutex_unlock(&g_MutexQueue);
+    if (ret != 0)
+    {
+        cerr << "pthread_mutex_unlock error: g_MutexQueue: error=" << ret << endl;
+        exit(1);
+    }
+    //  signal a thread of the class
+    if ((flags & CMD_SYNC) == 0)
+    {
+        WakeWorker(src->cls);
+    }
+    return true;
+}
+
+void ParseForeach(const string& line, ForeachLoop& loop)
+{
+    //  #foreach VAR in SOURCE
+    vector<string> words;
+    NSStringHelper::SplitSpace<string>(line, back_inserter(words));
+    if (words.size() < 4 || words[2] != "in")
+    {
+        cerr << g_Program << ": invalid directive, expect \"#foreach VAR in SOURCE\": " << line << endl;
+        exit(1);
+    }
+    loop.var = words[1];
+    const string& src = words[3];
+    size_type pos = src.find("..");
+    if (words.size() == 4 && src == "@-")
+    {
+        loop.type = ForeachLoop::STDIN;
+        loop.path = "-";
+    }
+    else if (words.size() == 4 && src[0] == '@')
+    {
+        loop.type = ForeachLoop::PATH;
+        loop.path = src.substr(1);
+    }
+    else if (words.size() == 4 && pos != string::npos && pos > 0)
+    {
+        //  FIRST..LAST or FIRST..LAST..STEP
+        loop.type = ForeachLoop::RANGE;
+        vector<string> nums;
+        NSStringHelper::SplitString<string>(src, back_inserter(nums), "..", true);
+        char* endp = NULL;
+        bool ok = (nums.size() == 2 || nums.size() == 3);
+        for (size_type i=0; ok && i<nums.size(); ++i)
+        {
+            long long v = strtoll(nums[i].c_str(), &endp, 10);
+            ok = !nums[i].empty() && *endp == '\0';
+            if (i == 0) loop.first = v;
+            else if (i == 1) loop.last = v;
+            else loop.step = v;
+        }
+        if (ok && nums.size() == 2)
+        {
+            loop.step = (loop.first <= loop.last) ? 1 : -1;
+        }
+        if (!ok || loop.step == 0 || (loop.step > 0) != (loop.first <= loop.last))
+        {
+            cerr << g_Program << ": invalid range in #foreach: " << src << endl;
+            exit(1);
+        }
+    }
+    else
+    {
+        loop.type = ForeachLoop::LIST;
+        loop.words.assign(words.begin() + 3, words.end());
+    }
+}
+
+void ParsePipePart(const Source* src, const string& line, ForeachLoop& loop)
+{
+    //  #pipepart FILE [BLOCK [OUTPUT]]
+    vector<string> words;
+    NSStringHelper::SplitSpace<string>(line, back_inserter(words));
+    unsigned long long block = 0;
+    if (words.size() < 2 || words.size() > 4 || (words.size() > 2 && (!ParseBytes(words[2].c_str(), block) || block == 0)))
+    {
+        cerr << g_Program << ": invalid directive, expect \"#pipepart FILE [BLOCK [OUTPUT]]\": " << line << endl;
+        exit(1);
+    }
+    PipePart* part = new PipePart();
+    part->path = words[1];
+    part->fd = open(part->path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (part->fd < 0 || fstat(part->fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        cerr << g_Program << ": #pipepart needs a regular file: " << part->path << endl;
+        exit(1);
+    }
+    part->size = st.st_size;
+    part->data = NULL;
+    if (part->size > 0)
+    {
+        void* data = mmap(NULL, part->size, PROT_READ, MAP_SHARED, part->fd, 0);
+        if (data == MAP_FAILED)
+        {
+            cerr << "mmap error: errno=" << errno << "    file=" << part->path << endl;
+            exit(1);
+        }
+        //  only the pages at cut points are read
+        madvise(data, part->size, MADV_RANDOM);
+        part->data = static_cast<const char*>(data);
+    }
+    //  one part per thread by default, per the first thread number of --simulate without ThreadNum
+    uint64_t threads = g_vThread.empty() ? g_vSimulateSlots.front() : g_vThread.size();
+    part->block = block > 0 ? block : max<uint64_t>((part->size + threads - 1) / threads, 1);
+    part->reducer = NULL;
+    pthread_mutex_init(&part->mutex, NULL);
+    if (words.size() == 4)
+    {
+        if (src->reducer != NULL)
+        {
+            cerr << g_Program << ": #pipepart in #reduce outputs to the group, not " << words[3] << endl;
+            exit(1);
+        }
+        part->reducer = NewReducer(Reducer::CAT, words[3], 0, false);
+    }
+    g_vPipePart.push_back(part);
+    loop.type = ForeachLoop::PART;
+    loop.var = "part";
+    loop.part = part;
+}
+
+//  Move to the next part: it ends after the first newline at or after its
+//  nominal end, found by memchr, which is vectorized. Only the producer
+//  adds parts.
+bool PartNext(ForeachLoop& loop)
+{
+    PipePart* part = loop.part;
+    if (loop.end >= part->size)
+    {
+        return false;
+    }
+    loop.begin = loop.end;
+    uint64_t cut = loop.begin + part->block;
+    loop.end = part->size;
+    if (cut < part->size)
+    {
+        const void* nl = memchr(part->data + cut - 1, '\n', part->size - cut + 1);
+        if (nl != NULL)
+        {
+            loop.end = static_cast<const char*>(nl) - part->data + 1;
+        }
+    }
+    ++loop.cur;
+    loop.value.clear();
+    AppendInteger(loop.value, static_cast<unsigned long long>(loop.cur));
+    LockMutex(&part->mutex, "PipePart::mutex");
+    part->ends.push_back(loop.end);
+    UnlockMutex(&part->mutex, "PipePart::mutex");
+    return true;
+}
+
+//  Take the next non-empty line of a PATH/STDIN source into loop.value,
+//  from what MainLoop has read into its reader.
+int ForeachRead(ForeachLoop& loop)
+{
+    while (NextLine(loop.reader, loop.value))
+    {
+        NSStringHelper::Trim(loop.value);
+        if (!loop.value.empty())
+        {
+            return FOREACH_VALUE;
+        }
+    }
+    return loop.reader.eof ? FOREACH_END : FOREACH_WAIT;
+}
+
+//  Move to the first value, FOREACH_END if the source is empty.
+int ForeachFirst(ForeachLoop& loop, bool outermost)
+{
+    switch (loop.type)
+    {
+        case ForeachLoop::RANGE:
+            loop.cur = loop.first;
+            loop.value.clear();
+            AppendInteger(loop.value, loop.cur < 0 ? -static_cast<unsigned long long>(loop.cur) : loop.cur, loop.cur < 0);
+            return FOREACH_VALUE;
+        case ForeachLoop::LIST:
+            loop.index = 0;
+            loop.value = loop.words[0];
+            return FOREACH_VALUE;
+        case ForeachLoop::PATH:
+            if (loop.reader.fd >= 0)
+            {
+                close(loop.reader.fd);
+            }
+            loop.reader.fd = open(loop.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (loop.reader.fd < 0)
+            {
+                cerr << g_Program << ": open file error in #foreach: " << loop.path << endl;
+                exit(1);
+            }
+            loop.reader.eof = false;
+            loop.reader.begin = loop.reader.end = 0;
+            loop.reader.partial.clear();
+            return FOREACH_WAIT;
+        case ForeachLoop::STDIN:
+            if (!outermost)
+            {
+                cerr << g_Program << ": stdin can only be read by the outermost #foreach" << endl;
+                exit(1);
+            }
+            loop.reader.fd = STDIN_FILENO;
+            return ForeachRead(loop);
+        case ForeachLoop::PART:
+            loop.begin = loop.end = 0;
+            loop.cur = -1;
+            return PartNext(loop) ? FOREACH_VALUE : FOREACH_END;
+    }
+    return FOREACH_END;
+}
+
+//  Move to the next value, FOREACH_END if exhausted.
+int ForeachNext(ForeachLoop& loop)
+{
+    switch (loop.type)
+    {
+        case ForeachLoop::RANGE:
+            if ((loop.step > 0 && loop.last - loop.cur < loop.step) || (loop.step < 0 && loop.last - loop.cur > loop.step))
+            {
+                return FOREACH_END;
+            }
+            loop.cur += loop.step;
+            loop.value.clear();
+            AppendInteger(loop.value, loop.cur < 0 ? -static_cast<unsigned long long>(loop.cur) : loop.cur, loop.cur < 0);
+            return FOREACH_VALUE;
+        case ForeachLoop::LIST:
+            if (++loop.index >= loop.words.size())
+            {
+                return FOREACH_END;
+            }
+            loop.value = loop.words[loop.index];
+            return FOREACH_VALUE;
+        case ForeachLoop::PATH:
+        case ForeachLoop::STDIN:
+            return ForeachRead(loop);
+        case ForeachLoop::PART:
+            return PartNext(loop) ? FOREACH_VALUE : FOREACH_END;
+    }
+    return FOREACH_END;
+}
+
+//  Replace {VAR} by its current value, {} by the innermost one.
+void Substitute(const string& tmpl, const vector<ForeachLoop*>& loops, string& cmd)
+{
+    cmd.clear();
+    size_type prevpos = 0, pos;
+    while ((pos = tmpl.find('{', prevpos)) != string::npos)
+    {
+        size_type endpos = tmpl.find('}', pos + 1);
+        if (endpos == string::npos)
+        {
+            break;
+        }
+        const ForeachLoop* loop = NULL;
+        if (endpos == pos + 1)
+        {
+            loop = loops.back();
+        }
+        for (size_type i=0; loop == NULL && i<loops.size(); ++i)
+        {
+            if (tmpl.compare(pos + 1, endpos - pos - 1, loops[i]->var) == 0)
+            {
+                loop = loops[i];
+            }
+        }
+        if (loop == NULL)
+        {
+            //  not a placeholder, e.g. shell brace expansion
+            cmd.append(tmpl, prevpos, pos + 1 - prevpos);
+            prevpos = pos + 1;
+            continue;
+        }
+        cmd.append(tmpl, prevpos, pos - prevpos);
+        cmd += loop->value;
+        prevpos = endpos + 1;
+    }
+    cmd.append(tmpl, prevpos, string::npos);
+}
+
+void ClearTemplate(Source* src)
+{
+    for (size_type i=0; i<src->loops.size(); ++i)
+    {
+        delete src->loops[i];
+    }
+    src->loops.clear();
+    src->moving = string::npos;
+    src->expanding = false;
+}
+
+//  Move the loops of src like an odometer from loop src->moving on, until
+//  they hold the next expansion, are exhausted, or a loop has to wait for
+//  its input, which MainLoop then reads; return false in the last case.
+bool MoveLoops(Source* src)
+{
+    const vector<ForeachLoop*>& loops = src->loops;
+    while (src->moving < loops.size())
+    {
+        const size_type i = src->moving;
+        int ret = src->move == MOVE_FIRST ? ForeachFirst(*loops[i], i == 0)
+            : src->move == MOVE_READ ? ForeachRead(*loops[i]) : ForeachNext(*loops[i]);
+        if (ret == FOREACH_WAIT)
+        {
+            src->move = src->move == MOVE_FIRST ? MOVE_READ : src->move;
+            return false;
+        }
+        if (ret == FOREACH_VALUE)
+        {
+            src->move = MOVE_FIRST;
+            ++src->moving;
+        }
+        else if (src->move != MOVE_NEXT || i == 0)
+        {
+            //  an empty source, or the outermost loop is done
+            ClearTemplate(src);
+            return true;
+        }
+        else
+        {
+            --src->moving;
+        }
+    }
+    src->moving = string::npos;
+    src->expanding = true;
+    return true;
+}
+
+//  Start expanding the Cartesian product of the pending loops of src over
+//  the template, see ExpandNext.
+void StartTemplate(Source* src, const string& tmpl)
+{
+    assert(!src->loops.empty());
+    src->tmpl = tmpl;
+    src->moving = 0;
+    src->move = MOVE_FIRST;
+    MoveLoops(src);
+}
+
+//  Generate one command of the template and advance the loops, innermost
+//  first, so nothing but the current values is kept.
+void ExpandNext(Source* src, string& cmd)
+{
+    assert(src->expanding);
+    Substitute(src->tmpl, src->loops, cmd);
+    NSStringHelper::Trim(cmd);
+    src->expanding = false;
+    src->moving = src->loops.size() - 1;
+    src->move = MOVE_NEXT;
+    MoveLoops(src);
+}
+
+void ExitSource(Source* src)
+{
+    src->exited = true;
+    CloseSource(src);
+    ClearTemplate(src);
+    if (src->reducer != NULL)
+    {
+        CloseReducer(src->reducer);
+        src->reducer = NULL;
+    }
+    LockMutex(&g_MutexQueue, "g_MutexQueue");
+    --g_SourcesOpen;
+    WakeAllWorkers();
+    UnlockMutex(&g_MutexQueue, "g_MutexQueue");
+    LogStream log_oss;
+    log_oss << "main thread: source " << src->id << " exited: " << src->path;
+    LogFile(log_oss.str());
+}
+
+//  Whether cmd is a duplicate to skip, with --dedup.
+bool SkipDuplicate(const Source* src, const string& cmd)
+{
+    if (g_pDedup == NULL || !g_pDedup->Seen(cmd))
+    {
+        return false;
+    }
+    ++g_DedupSkipped;
+    LogStream log_oss;
+    log_oss << "main thread: skip duplicate command of source " << src->id << ": &" << cmd << "&";
+    LogFile(log_oss.str());
+    return true;
+}
+
+//  Build the environment of spec from environ and spec.env.
+void BuildEnviron(ExecSpec& spec)
+{
+    spec.environ_all.clear();
+    spec.envp.clear();
+    if (spec.env.empty())
+    {
+        return;
+    }
+    //  the environment without the names of env, then env, later ones win
+    for (char** e=environ; *e!=NULL; ++e)
+    {
+        const char* eq = strchr(*e, '=');
+        size_type len = eq == NULL ? strlen(*e) : eq - *e;
+        bool overridden = false;
+        for (size_type k=0; k<spec.env.size() && !overridden; ++k)
+        {
+            overridden = spec.env[k].size() > len && spec.env[k][len] == '=' && spec.env[k].compare(0, len, *e, len) == 0;
+        }
+        if (!overridden)
+        {
+            spec.environ_all.push_back(*e);
+        }
+    }
+    for (size_type k=0; k<spec.env.size(); ++k)
+    {
+        size_type len = spec.env[k].find('=');
+        bool later = false;
+        for (size_type j=k+1; j<spec.env.size() && !later; ++j)
+        {
+            later = spec.env[j].compare(0, len + 1, spec.env[k], 0, len + 1) == 0;
+        }
+        if (!later)
+        {
+            spec.environ_all.push_back(spec.env[k]);
+        }
+    }
+    for (size_type k=0; k<spec.environ_all.size(); ++k)
+    {
+        spec.envp.push_back(const_cast<char*>(spec.environ_all[k].c_str()));
+    }
+    spec.envp.push_back(NULL);
+}
+
+//  Add a copy of spec to g_vSpec, return its index.
+uint32_t AddSpec(const ExecSpec& spec)
+{
+    ExecSpec* added = new ExecSpec(spec);
+    BuildEnviron(*added);
+    LockMutex(&g_MutexQueue, "g_MutexQueue");
+    uint32_t index = g_vSpec.size();
+    g_vSpec.push_back(added);
+    UnlockMutex(&g_MutexQueue, "g_MutexQueue");
+    return index;
+}
+
+//  Return the index of an execution spec equal to spec in g_vSpec, adding
+//  it if new. Called by the producer only, which alone uses g_SpecIndex.
+uint32_t InternSpec(const ExecSpec& spec)
+{
+    string serial = spec.cwd;
+    for (size_type k=0; k<spec.env.size(); ++k)
+    {
+        serial += '\0';
+        serial += spec.env[k];
+    }
+    for (int fd=0; fd<3; ++fd)
+    {
+        serial += '\0';
+        serial += spec.append[fd] ? "+" : "";
+        serial += spec.redirect[fd];
+    }
+    serial += '\0';
+    serial.append(reinterpret_cast<const char*>(&spec.rate), sizeof(spec.rate));
+    serial.append(reinterpret_cast<const char*>(&spec.part), sizeof(spec.part));
+    serial.append(reinterpret_cast<const char*>(&spec.reducer), sizeof(spec.reducer));
+    serial.append(reinterpret_cast<const char*>(&spec.reduce_base), sizeof(spec.reduce_base));
+    unordered_map<string, uint32_t>::const_iterator it = g_SpecIndex.find(serial);
+    if (it != g_SpecIndex.end())
+    {
+        return it->second;
+    }
+    uint32_t index = AddSpec(spec);
+    g_SpecIndex[serial] = index;
+    return index;
+}
+
+//  Give the command of the current part of src its part, return false if
+//  its template is not of #pipepart. Called before the loops advance.
+bool AttachPart(Source* src, Annotation& annot)
+{
+    if (src->loops.size() != 1 || src->loops[0]->type != ForeachLoop::PART)
+    {
+        return false;
+    }
+    const ForeachLoop& loop = *src->loops[0];
+    ExecSpec spec;
+    if (annot.spec != 0)
+    {
+        spec = *g_vSpec[annot.spec];
+    }
+    spec.part = loop.part;
+    annot.spec = InternSpec(spec);
+    annot.item = loop.cur;
+    return true;
+}
+
+//  Capture the stdout of a command of src to be queued for its reducer:
+//  that of its #pipepart, or of the open #reduce group.
+void AttachReducer(Source* src, Annotation& annot)
+{
+    const ExecSpec* old = g_vSpec[annot.spec];
+    Reducer* reducer = old != NULL && old->part != NULL && old->part->reducer != NULL ? old->part->reducer : src->reducer;
+    if (reducer == NULL || !g_vSimulateSlots.empty())
+    {
+        return;
+    }
+    LockMutex(&reducer->mutex, "Reducer::mutex");
+    size_type index = reducer->count++;
+    if (reducer->mode == Reducer::CAT)
+    {
+        reducer->done.push_back(0);
+    }
+    ++reducer->pending;
+    UnlockMutex(&reducer->mutex, "Reducer::mutex");
+    //  the parts of a #pipepart are given in order, part k is command
+    //  reduce_base + k; other commands are command item
+    const bool part = old != NULL && old->part != NULL;
+    const uint32_t from = annot.spec;
+    annot.item = part ? annot.item : index;
+    const ExecSpec* last = g_vSpec[src->reduce_spec];
+    if (src->reduce_from == from && last != NULL && last->reducer == reducer && !(part && annot.item == 0))
+    {
+        annot.spec = src->reduce_spec;
+        return;
+    }
+    ExecSpec spec;
+    if (old != NULL)
+    {
+        spec = *old;
+    }
+    spec.reducer = reducer;
+    spec.reduce_base = part ? index : 0;
+    spec.redirect[1].clear();
+    spec.append[1] = false;
+    annot.spec = InternSpec(spec);
+    src->reduce_from = from;
+    src->reduce_spec = annot.spec;
+}
+
+//  "#reduce cat|merge OUTPUT [FIELD[n]]" opens a group, "#reduce end" closes it.
+void ParseReduce(Source* src, const string& line)
+{
+    vector<string> words;
+    NSStringHelper::SplitSpace<string>(line, back_inserter(words));
+    if (words.size() == 2 && words[1] == "end" && src->reducer != NULL)
+    {
+        CloseReducer(src->reducer);
+        src->reducer = NULL;
+        return;
+    }
+    size_type field = 0;
+    bool numeric = false;
+    bool ok = words.size() >= 3 && words.size() <= 4 && (words[1] == "cat" || words[1] == "merge");
+    if (ok && words.size() == 4)
+    {
+        char* end = NULL;
+        field = strtoul(words[3].c_str(), &end, 10);
+        numeric = *end == 'n';
+        ok = words[1] == "merge" && end != words[3].c_str() && field > 0 && (*end == '\0' || (numeric && end[1] == '\0'));
+    }
+    if (!ok || src->reducer != NULL)
+    {
+        cerr << g_Program << ": invalid directive, expect \"#reduce cat|merge OUTPUT [FIELD[n]]\" or \"#reduce end\" after it: "
+            << line << endl;
+        exit(1);
+    }
+    src->reducer = NewReducer(words[1] == "cat" ? Reducer::CAT : Reducer::MERGE, words[2], field, numeric);
+}
+
+//  Parse "#@ KEY=VALUE ..." into annot.
+void ParseAnnotation(const string& line, Annotation& annot)
+{
+    //  one per command in annotated command files, so parsed without copies
+    using NSStringHelper::StringView;
+    vector<StringView> words;
+    NSStringHelper::SplitSpaceView(StringView(line).substr(2), back_inserter(words));
+    ExecSpec spec;
+    if (annot.spec != 0)
+    {
+        spec = *g_vSpec[annot.spec];
+    }
+    bool exec = false;
+    for (size_type i=0; i<words.size(); ++i)
+    {
+        const StringView word = words[i];
+        size_type eq = word.find('=');
+        const StringView key = word.substr(0, eq);
+        const StringView value = eq == StringView::npos ? StringView() : word.substr(eq + 1);
+        if (key == "priority" && !value.empty())
+        {
+            char* endp = NULL;
+            long v = strtol(value.data(), &endp, 10);
+            if (endp != value.end() || v < -1000 || v > 1000)
+            {
+                cerr << g_Program << ": invalid priority, -1000 to 1000: " << line << endl;
+                exit(1);
+            }
+            annot.priority = v;
+        }
+        else if (key == "idempotent" && eq == string::npos)
+        {
+            annot.idempotent = true;
+        }
+        else if (key == "rate" && !value.empty())
+        {
+            //  groups are given at run time, not to --compile
+            size_type group = FindRate(value.str());
+            if (group == string::npos && g_CompileOutput.empty())
+            {
+                cerr << g_Program << ": no --rate for group " << value.str() << ": " << line << endl;
+                exit(1);
+            }
+            spec.rate = group == string::npos ? 0 : group + 1;
+            exec = true;
+        }
+        else if (key == "cwd" && !value.empty())
+        {
+            spec.cwd = value.str();
+            exec = true;
+        }
+        else if (key == "env" && value.find('=') != StringView::npos && value[0] != '=')
+        {
+            spec.env.push_back(value.str());
+            exec = true;
+        }
+        else if ((key == "stdin" || key == "stdout" || key == "stderr" || key == "stdout+" || key == "stderr+")
+            && !value.empty() && (value != "&1" || key == "stderr"))
+        {
+            int fd = key[3] == 'i' ? 0 : key[3] == 'o' ? 1 : 2;
+            spec.redirect[fd] = value.str();
+            spec.append[fd] = key[key.size() - 1] == '+';
+            exec = true;
+        }
+        else
+        {
+            cerr << g_Program << ": invalid annotation: " << word.str() << " in " << line << endl;
+            exit(1);
+        }
+    }
+    if (exec)
+    {
+        annot.spec = InternSpec(spec);
+    }
+}
+
+//  Handle a command line of src, the template of its loops if any.
+void CommandLine(Source* src, string& line)
+{
+    if (src->skip > 0)
+    {
+        //  as if it were not in the input, see --skip
+        --src->skip;
+        src->next_annot = Annotation();
+        ClearTemplate(src);
+        return;
+    }
+    if (!src->loops.empty())
+    {
+        src->tmpl_annot = src->next_annot;
+        src->next_annot = Annotation();
+        StartTemplate(src, line);
+        return;
+    }
+    src->pending_annot = src->next_annot;
+    src->next_annot = Annotation();
+    if (SkipDuplicate(src, line))
+    {
+        return;
+    }
+    AttachReducer(src, src->pending_annot);
+    src->pending.swap(line);
+    src->pending_flags = 0;
+    src->has_pending = true;
 }
 
-void Uninit()
+//  Handle one input line of src, commands are left in src->pending.
+void ProcessLine(Source* src, string& line)
 {
-    size_type i;
-    int ret;
-    ////  unlink file
-    //if (unlink(g_CmdFile.c_str()) != 0)
-    //{
-    //    cerr << "unlink error: " << g_CmdFile << endl;
-    //    exit(1);
-    //}
-    //for (i=0; i<g_vThread.size(); ++i)
-    //{
-    //    ret = pthread_cancel(g_vThread[i]);
-    //    if (ret != 0)
-    //    {
-    //        cerr << "pthread_cancel error: error=" << ret << endl;
-    //        exit(1);
-    //    }
-    //}
-    //  john thread
-    for (i=0; i<g_vThread.size(); ++i)
+    //cout << "Command: " << line << endl;
+    //  empty line
+    NSStringHelper::Trim(line);
+    if (line.empty())
     {
-        ret = pthread_join(g_vThread[i], NULL);
-        if (ret != 0)
+        return;
+    }
+    //  template
+    if (NSStringHelper::StartsWith(line, "#foreach ") || NSStringHelper::StartsWith(line, "#pipepart "))
+    {
+        bool pipepart = line[1] == 'p';
+        if (!src->loops.empty() && (pipepart || src->loops[0]->type == ForeachLoop::PART))
         {
-            cerr << "pthread_join error: error=" << ret << "    g_vThread[" << i << "]=" << g_vThread[i] << endl;
+            cerr << g_Program << ": #pipepart cannot be combined with #foreach: " << line << endl;
             exit(1);
         }
-        ostringstream log_oss;
-        log_oss << "main thread: joined g_vThread[" << i << "]=" << g_vThread[i];
+        src->loops.push_back(new ForeachLoop());
+        if (pipepart)
+        {
+            ParsePipePart(src, line, *src->loops.back());
+        }
+        else
+        {
+            ParseForeach(line, *src->loops.back());
+        }
+        return;
+    }
+    if (!src->loops.empty())
+    {
+        if (line == "#sync" || line == "#exit")
+        {
+            cerr << g_Program << ": #foreach must be followed by a command template, not " << line << endl;
+            exit(1);
+        }
+        if (NSStringHelper::StartsWith(line, "#@"))
+        {
+            ParseAnnotation(line, src->next_annot);
+        }
+        else if (line[0] != '#')
+        {
+            CommandLine(src, line);
+        }
+        return;
+    }
+    if (line == "#exit")
+    {
+        ExitSource(src);
+        return;
+    }
+    if (NSStringHelper::StartsWith(line, "#class") && (line.size() == 6 || line[6] == ' ' || line[6] == '\t'))
+    {
+        string name = line.substr(6);
+        NSStringHelper::Trim(name);
+        src->cls = name.empty() ? 0 : FindClass(name);
+        if (src->cls == string::npos)
+        {
+            cerr << g_Program << ": unknown job class: " << line << endl;
+            exit(1);
+        }
+        return;
+    }
+    if (NSStringHelper::StartsWith(line, "#reduce "))
+    {
+        ParseReduce(src, line);
+        return;
+    }
+    if (line == "#builtin" || line == "#builtin on" || line == "#builtin off")
+    {
+        src->builtin = line != "#builtin off";
+        return;
+    }
+    if (NSStringHelper::StartsWith(line, "#locality") && (line.size() == 9 || line[9] == ' ' || line[9] == '\t'))
+    {
+        src->key.assign(line, 9, string::npos);
+        NSStringHelper::Trim(src->key);
+        return;
+    }
+    if (line == "#sync")
+    {
+        src->pending.swap(line);
+        src->pending_flags = CMD_SYNC;
+        src->has_pending = true;
+        return;
+    }
+    if (NSStringHelper::StartsWith(line, "#@"))
+    {
+        ParseAnnotation(line, src->next_annot);
+        return;
+    }
+    if (line[0] == '#')
+    {
+        //  comment
+        return;
+    }
+    CommandLine(src, line);
+}
+
+//  Handle the next record of the compiled input of src, its end exits the
+//  input. Commands skip ProcessLine, they are trimmed already.
+void NextRecord(Source* src)
+{
+    if (src->skip > 0)
+    {
+        //  seek by the index, applying the directives before
+        vector<CompiledFile::Record> directives;
+        if (!src->compiled->Seek(src->skip, directives))
+        {
+            cerr << g_Program << ": corrupt compiled command file: " << src->path << endl;
+            exit(1);
+        }
+        LogStream log_oss;
+        log_oss << "main thread: source " << src->id << " skipped " << min(src->skip, src->compiled->Commands())
+            << " commands";
         LogFile(log_oss.str());
+        src->skip = 0;
+        for (size_type k=0; k<directives.size() && !src->exited; ++k)
+        {
+            src->line.assign(directives[k].text, directives[k].size);
+            ProcessLine(src, src->line);
+        }
+        return;
     }
-    //  destroy mutex
-    ret = pthread_mutex_destroy(&g_MutexQueue);
-    if (ret != 0)
+    CompiledFile::Record rec;
+    if (!src->compiled->Next(rec))
     {
-        cerr << "pthread_mutex_destroy error: g_MutexQueue: error=" << ret << endl;
-        exit(1);
+        if (src->compiled->Corrupt())
+        {
+            cerr << g_Program << ": corrupt compiled command file: " << src->path << endl;
+            exit(1);
+        }
+        ExitSource(src);
+        return;
     }
-    ret = pthread_mutex_destroy(&g_MutexLog);
-    if (ret != 0)
+    if (rec.type == CompiledFile::ANNOTATION)
     {
-        cerr << "pthread_mutex_destroy error: g_MutexLog: error=" << ret << endl;
-        exit(1);
+        if ((rec.flags & CompiledFile::PRIORITY) != 0)
+        {
+            src->next_annot.priority = rec.priority;
+        }
+        if ((rec.flags & CompiledFile::IDEMPOTENT) != 0)
+        {
+            src->next_annot.idempotent = true;
+        }
+        if (rec.size > 0)
+        {
+            src->line.assign(rec.text, rec.size);
+            ParseAnnotation(src->line, src->next_annot);
+        }
+        return;
     }
-    //  destroy cond
-    ret = pthread_cond_destroy(&g_CondSync);
-    if (ret != 0)
+    src->line.assign(rec.text, rec.size);
+    if (rec.type == CompiledFile::COMMAND)
+    {
+        CommandLine(src, src->line);
+    }
+    else
+    {
+        ProcessLine(src, src->line);
+    }
+}
+
+//  Compile the command file in to out, see CompiledFile. Comments and
+//  empty lines are dropped, lines trimmed, and the priority and idempotent
+//  keys of annotations parsed; the directives are checked at run time.
+void Compile(const string& in, const string& out)
+{
+    ifstream fin(in.c_str());
+    CompiledFile::Writer writer;
+    if (!fin || !writer.Open(out))
     {
-        cerr << "pthread_cond_destroy error: g_CondSync: error=" << ret << endl;
+        cerr << g_Program << ": open file error: " << (fin ? out : in) << endl;
         exit(1);
     }
-    ret = pthread_cond_destroy(&g_CondNotEmpty);
-    if (ret != 0)
+    string line;
+    string exec;
+    uint64_t bytes = 0;
+    bool loop = false;              //  a template is expected
+    bool ok = true;
+    while (ok && getline(fin, line))
+    {
+        bytes += line.size() + 1;
+        NSStringHelper::Trim(line);
+        if (line.empty())
+        {
+            continue;
+        }
+        if (NSStringHelper::StartsWith(line, "#foreach ") || NSStringHelper::StartsWith(line, "#pipepart "))
+        {
+            ok = writer.Add(CompiledFile::LOOP, line.data(), line.size());
+            loop = true;
+        }
+        else if (NSStringHelper::StartsWith(line, "#@"))
+        {
+            //  checked as at run time, the other keys are kept as text
+            Annotation annot;
+            ParseAnnotation(line, annot);
+            unsigned flags = 0;
+            exec.clear();
+            vector<NSStringHelper::StringView> words;
+            NSStringHelper::SplitSpaceView(NSStringHelper::StringView(line).substr(2), back_inserter(words));
+            for (size_type i=0; i<words.size(); ++i)
+            {
+                if (NSStringHelper::StartsWith(words[i], "priority="))
+                {
+                    flags |= CompiledFile::PRIORITY;
+                }
+                else if (words[i] == "idempotent")
+                {
+                    flags |= CompiledFile::IDEMPOTENT;
+                }
+                else
+                {
+                    exec += exec.empty() ? "#@ " : " ";
+                    exec.append(words[i].data(), words[i].size());
+                }
+            }
+            ok = writer.Add(CompiledFile::ANNOTATION, exec.data(), exec.size(), flags, annot.priority);
+        }
+        else if (line[0] != '#')
+        {
+            ok = writer.Add(CompiledFile::COMMAND, line.data(), line.size());
+            loop = false;
+        }
+        else if (line == "#sync" || line == "#exit")
+        {
+            if (loop)
+            {
+                cerr << g_Program << ": #foreach must be followed by a command template, not " << line << endl;
+                exit(1);
+            }
+            ok = writer.Add(line == "#sync" ? CompiledFile::SYNC : CompiledFile::EXIT, line.data(), line.size());
+            if (line == "#exit")
+            {
+                //  the rest is never read
+                break;
+            }
+        }
+        else if (!loop && (NSStringHelper::StartsWith(line, "#class") || NSStringHelper::StartsWith(line, "#builtin")
+            || NSStringHelper::StartsWith(line, "#locality") || NSStringHelper::StartsWith(line, "#reduce ")))
+        {
+            //  anything else is a comment, as in ProcessLine
+            ok = writer.Add(CompiledFile::DIRECTIVE, line.data(), line.size());
+        }
+    }
+    uint64_t commands = writer.Commands();
+    if (!ok || !writer.Close(bytes))
     {
-        cerr << "pthread_cond_destroy error: g_CondNotEmpty: error=" << ret << endl;
+        cerr << g_Program << ": write file error: " << out << endl;
         exit(1);
     }
-    //  exit
-    if (g_ErrorOccur)
+    cout << "commands: " << commands << ", from " << bytes << " bytes of " << in << " to " << out << endl;
+}
+
+//  Whether the rest of src is cancelled by --halt segment.
+bool SegmentCancelled(const Source* src)
+{
+    LockMutex(&g_MutexQueue, "g_MutexQueue");
+    bool halted = src->halted;
+    UnlockMutex(&g_MutexQueue, "g_MutexQueue");
+    return halted;
+}
+
+//  The reader of the input src waits for, with its path: that of the
+//  #foreach loop moving, or src itself. NULL if src waits for no input.
+LineReader* InputReader(Source* src, const string*& path)
+{
+    if (src->exited || src->has_pending || src->expanding)
     {
-        LogFile("main thread: something wrong, anyway, I am exiting, bye");
+        return NULL;
     }
-    else
+    if (src->moving != string::npos)
     {
-        LogFile("main thread: all threads exited normally, I am exiting, bye");
+        ForeachLoop* loop = src->loops[src->moving];
+        path = &loop->path;
+        return &loop->reader;
+    }
+    path = &src->path;
+    return &src->reader;
+}
+
+//  Queue commands of src from buffered input and templates, until its
+//  queue is full or more input is needed.
+void Produce(Source* src)
+{
+    while (g_CancelSignal == 0 && g_Halted == HALT_NEVER)
+    {
+        if (g_HaltSegment && SegmentCancelled(src))
+        {
+            ExitSource(src);
+            return;
+        }
+        if (src->has_pending)
+        {
+            if (!PushCommand(src, src->pending, src->pending_flags))
+            {
+                return;
+            }
+            src->has_pending = false;
+        }
+        if (src->moving != string::npos && !MoveLoops(src))
+        {
+            //  a #foreach loop waits for its input
+            return;
+        }
+        if (src->expanding)
+        {
+            src->pending_annot = src->tmpl_annot;
+            //  the parts of #pipepart differ in their input, not in their text
+            bool part = AttachPart(src, src->pending_annot);
+            ExpandNext(src, src->pending);
+            src->pending_flags = 0;
+            src->has_pending = !src->pending.empty() && (part || !SkipDuplicate(src, src->pending));
+            if (src->has_pending)
+            {
+                AttachReducer(src, src->pending_annot);
+            }
+            continue;
+        }
+        if (src->exited)
+        {
+            return;
+        }
+        if (src->compiled != NULL)
+        {
+            NextRecord(src);
+            continue;
+        }
+        if (!NextLine(src->reader, src->line))
+        {
+            if (src->reader.eof && !g_vSimulateSlots.empty())
+            {
+                //  offline, the end of file ends the input
+                ExitSource(src);
+            }
+            else if (src->reader.eof)
+            {
+                //  read again, wait for the next writer of a FIFO
+                CloseSource(src);
+                OpenSource(src);
+            }
+            return;
+        }
+        ProcessLine(src, src->line);
     }
 }
 
+//  The producer: an event loop reading all sources with poll(), woken by
+//  g_WakePipe when a full queue gets room or the run is cancelled or halted.
 void MainLoop()
 {
     if (g_Print)
     {
         cerr << "=========mainloop=========" << endl;
     }
-    int ret;
-    bool runflag = true;
-    while (runflag)
+    for (size_type i=0; i<g_vSource.size(); ++i)
+    {
+        OpenSource(g_vSource[i]);
+    }
+    vector<struct pollfd> fds;
+    vector<LineReader*> polled;
+    vector<const string*> paths;
+    while (g_CancelSignal == 0 && g_Halted == HALT_NEVER)
     {
-        ifstream fin;
-        fin.open(g_CmdFile.c_str());
-        if (!fin.good())
+        bool open = false;
+        for (size_type i=0; i<g_vSource.size(); ++i)
         {
-            cerr << "fin.open error: " << g_CmdFile << endl;
-            exit(1);
+            if (!g_vSource[i]->exited)
+            {
+                Produce(g_vSource[i]);
+                open = open || !g_vSource[i]->exited;
+            }
+        }
+        if (!open || g_CancelSignal != 0 || g_Halted != HALT_NEVER)
+        {
+            break;
+        }
+        //  wait for input of sources with room in their queue
+        fds.clear();
+        polled.clear();
+        paths.clear();
+        struct pollfd pfd;
+        pfd.fd = g_WakePipe[0];
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        fds.push_back(pfd);
+        for (size_type i=0; i<g_vSource.size(); ++i)
+        {
+            const string* path = NULL;
+            LineReader* reader = InputReader(g_vSource[i], path);
+            if (reader != NULL)
+            {
+                pfd.fd = reader->fd;
+                fds.push_back(pfd);
+                polled.push_back(reader);
+                paths.push_back(path);
+            }
         }
-        string line;
-        while (runflag && getline(fin, line))
+        //  with --share, room in the queue and finished commands are not signaled
+        if (poll(&fds[0], fds.size(), g_pShare != NULL ? 10 : -1) < 0)
         {
-            //cout << "Command: " << line << endl;
-            //  empty line
-            NSStringHelper::Trim(line);
-            if (line.empty())
+            if (errno == EINTR)
             {
                 continue;
             }
-            if (line == "#exit")
+            cerr << "poll error: errno=" << errno << endl;
+            exit(1);
+        }
+        if (fds[0].revents != 0)
+        {
+            char buf[64];
+            while (read(g_WakePipe[0], buf, sizeof(buf)) > 0)
             {
-                runflag = false;
             }
-            //  lock g_MutexQueue
-            ret = pthread_mutex_lock(&g_MutexQueue);
-            if (ret != 0)
+        }
+        for (size_type k=0; k<polled.size(); ++k)
+        {
+            if (fds[k + 1].revents != 0)
             {
-                cerr << "pthread_mutex_lock error: g_MutexQueue: error=" << ret << endl;
-                exit(1);
+                FillReader(*polled[k], *paths[k]);
             }
-            //  push
-            g_qCommand.push(line);
-            //  unlock g_MutexQueue
-            ret = pthread_mutex_unlock(&g_MutexQueue);
-            if (ret != 0)
+        }
+    }
+    if (g_pShare != NULL)
+    {
+        //  the workers stop once the commands pushed are done
+        g_pShare->EndProducer(g_ShareMember);
+        g_ShareProduced.store(true);
+    }
+}
+
+//  Read command durations from a log file of multirun, i.e. lines of
+//  "execute done command: &CMD& elapsed=S", or from lines of "S<TAB>CMD".
+void LoadHistory(const string& path)
+{
+    ifstream fin(path.c_str());
+    if (!fin)
+    {
+        cerr << g_Program << ": open file error: " << path << endl;
+        exit(1);
+    }
+    const char* const markers[] = { ": execute done command: &", ": execute failed command: &" };
+    const string elapsed = "& elapsed=";
+    string line;
+    string cmd;
+    while (getline(fin, line))
+    {
+        double seconds = 0;
+        size_type pos = string::npos;
+        for (size_type k=0; k<2 && pos==string::npos; ++k)
+        {
+            pos = line.find(markers[k]);
+            if (pos != string::npos)
             {
-                cerr << "pthread_mutex_unlock error: g_MutexQueue: error=" << ret << endl;
-                exit(1);
+                pos += strlen(markers[k]);
             }
-            //  signal g_CondNotEmpty
-            if (runflag)
+        }
+        if (pos != string::npos)
+        {
+            size_type end = line.rfind(elapsed);
+            if (end == string::npos || end < pos)
             {
-                ret = pthread_cond_signal(&g_CondNotEmpty);
-                if (ret != 0)
-                {
-                    cerr << "pthread_cond_signal error: g_CondNotEmpty: error=" << ret << endl;
-                    exit(1);
-                }
+                continue;
             }
-            else
+            cmd.assign(line, pos, end - pos);
+            seconds = atof(line.c_str() + end + elapsed.size());
+        }
+        else
+        {
+            size_type tab = line.find('\t');
+            if (line.empty() || line[0] == '#' || tab == string::npos)
             {
-                ret = pthread_cond_broadcast(&g_CondNotEmpty);
-                if (ret != 0)
-                {
-                    cerr << "pthread_cond_broadcast error: g_CondNotEmpty: error=" << ret << endl;
-                    exit(1);
-                }
+                continue;
+            }
+            seconds = atof(line.c_str());
+            cmd.assign(line, tab + 1, string::npos);
+        }
+        NSStringHelper::Trim(cmd);
+        pair<double, size_type>& entry = g_History[cmd];
+        entry.first += seconds;
+        ++entry.second;
+    }
+}
+
+//  Parse all inputs as the producer does, then replay the run with the
+//  durations in history for each number of threads, nothing is executed.
+void Simulate()
+{
+    for (size_type i=0; i<g_vHistoryFile.size(); ++i)
+    {
+        LoadHistory(g_vHistoryFile[i]);
+    }
+    double total = 0;
+    for (unordered_map<string, pair<double, size_type> >::const_iterator it=g_History.begin(); it!=g_History.end(); ++it)
+    {
+        total += it->second.first / it->second.second;
+    }
+    g_HistoryMean = g_History.empty() ? 1.0 : total / g_History.size();
+    //  ExitSource locks the queue mutex
+    pthread_mutex_init(&g_MutexQueue, NULL);
+    for (size_type i=0; i<g_vSource.size(); ++i)
+    {
+        Source* src = g_vSource[i];
+        g_Simulator.AddSource(src->weight);
+        OpenSource(src);
+        while (!src->exited)
+        {
+            Produce(src);
+            const string* path = NULL;
+            LineReader* reader = InputReader(src, path);
+            if (reader != NULL)
+            {
+                FillReader(*reader, *path);
             }
         }
-        fin.close();
+    }
+    pthread_mutex_destroy(&g_MutexQueue);
+    cout << "commands: " << g_Simulator.TaskNum() << ", barriers: " << g_Simulator.BarrierNum()
+        << ", inputs: " << g_vSource.size() << endl;
+    if (g_pDedup != NULL)
+    {
+        cout << "duplicates skipped: " << g_DedupSkipped << ", " << (g_pDedup->Exact() ? "exact set" : "Bloom filter")
+            << ", false-positive rate " << g_pDedup->FalsePositiveRate() << endl;
+        delete g_pDedup;
+        g_pDedup = NULL;
+    }
+    cout << "durations: " << g_SimulateKnown << " from history, " << g_SimulateUnknown
+        << " unknown taken as " << g_HistoryMean << "s" << endl;
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%8s %14s %12s %18s %18s", "threads", "makespan(s)", "utilization",
+        "barrier_idle(s)", "tail_idle(s)");
+    cout << buf << endl;
+    for (size_type i=0; i<g_vSimulateSlots.size(); ++i)
+    {
+        ScheduleSimulator::Result result = g_Simulator.Run(g_vSimulateSlots[i]);
+        snprintf(buf, sizeof(buf), "%8zu %14.3f %11.1f%% %18.3f %18.3f", result.slots, result.makespan,
+            100 * result.Utilization(), result.barrier_idle, result.tail_idle);
+        cout << buf << endl;
+    }
+    for (size_type i=0; i<g_vSource.size(); ++i)
+    {
+        delete g_vSource[i];
     }
 }
 
 int main(int argc, char* argv[])
 {
     InitOption(argc, argv);
+    if (!g_CompileOutput.empty())
+    {
+        Compile(g_CompileInput, g_CompileOutput);
+        return 0;
+    }
+    if (!g_vSimulateSlots.empty())
+    {
+        Simulate();
+        return 0;
+    }
+    InitSignal();
     InitThread();
     MainLoop();
     Uninit();
+    if (g_CancelSignal != 0)
+    {
+        return 128 + g_CancelSignal;
+    }
+    if (g_HaltWhen != HALT_NEVER || g_HaltSegment)
+    {
+        //  the number of failed commands, as GNU parallel
+        return static_cast<int>(min<unsigned long long>(g_Metrics.failed.load(), 101));
+    }
     if (g_ErrorOccur)
     {
         return 1;
@@ -33,5 +33,415 @@ do
     fi
 done
 
+#   offline simulation of the schedule
+./multirun testcase/simulate.cmd --simulate 1,2,4 --history testcase/simulate_history.txt > testcase/simulate_output.txt
+if diff testcase/simulate_output.txt testcase/simulate_ref.txt > testcase/simulate_diff.txt
+then
+    echo simulate passed
+    rm testcase/simulate_diff.txt testcase/simulate_output.txt
+else
+    echo "diff failed, please refer to testcase/simulate_diff.txt for detail"
+    exit 1
+fi
+
+#   a simulation leaves the outputs of #reduce alone, and splits #pipepart
+#   into a part per simulated thread
+echo kept > testcase/simulate_kept.txt
+./multirun testcase/simulate_reduce.cmd --simulate 2 --history testcase/simulate_history.txt > testcase/simulate_output.txt
+cat testcase/simulate_kept.txt >> testcase/simulate_output.txt
+if diff testcase/simulate_output.txt testcase/simulate_reduce_ref.txt > testcase/simulate_diff.txt
+then
+    echo simulate reduce passed
+    rm testcase/simulate_diff.txt testcase/simulate_output.txt testcase/simulate_kept.txt
+else
+    echo "diff failed, please refer to testcase/simulate_diff.txt for detail"
+    exit 1
+fi
+
+#   a compiled command file gives the same schedule
+./multirun --compile testcase/simulate.cmd testcase/simulate.mrc > /dev/null
+./multirun testcase/simulate.mrc --simulate 1,2,4 --history testcase/simulate_history.txt > testcase/compile_output.txt
+if diff testcase/compile_output.txt testcase/simulate_ref.txt > testcase/compile_diff.txt
+then
+    echo compile passed
+    rm testcase/compile_diff.txt testcase/compile_output.txt testcase/simulate.mrc
+else
+    echo "diff failed, please refer to testcase/compile_diff.txt for detail"
+    exit 1
+fi
+
+#   in-process file commands, with the errors of coreutils
+rm -rf testcase/builtin_tmp
+./multirun testcase/builtin.cmd 2 -l testcase/builtin_log.txt 2> /dev/null && status=0 || status=$?
+echo "exit $status, failed $(grep -c "execute failed" testcase/builtin_log.txt)" >> testcase/builtin_output.txt
+if diff testcase/builtin_output.txt testcase/builtin_ref.txt > testcase/builtin_diff.txt
+then
+    echo builtin passed
+    rm -r testcase/builtin_diff.txt testcase/builtin_output.txt testcase/builtin_log.txt testcase/builtin_tmp
+else
+    echo "diff failed, please refer to testcase/builtin_diff.txt for detail"
+    exit 1
+fi
+
+#   the metrics file is valid Prometheus text with the final counts
+./multirun testcase/metrics.cmd 2 --metrics-file testcase/metrics.prom > /dev/null || true
+grep -E "^multirun_(threads|running|completed_total|failed_total|barriers_total) |_count |le=\"\+Inf\"|^multirun_source_dispatched_total" \
+    testcase/metrics.prom > testcase/metrics_output.txt
+echo "invalid $(grep -v "^# HELP multirun_[a-z_]* .\|^# TYPE multirun_[a-z_]* \(gauge\|counter\|histogram\)$" testcase/metrics.prom \
+    | grep -cv '^multirun_[a-z_]*\({[a-z]*="[^"]*"}\)\? [0-9.e+-]*$')" >> testcase/metrics_output.txt
+if diff testcase/metrics_output.txt testcase/metrics_ref.txt > testcase/metrics_diff.txt
+then
+    echo metrics passed
+    rm testcase/metrics_diff.txt testcase/metrics_output.txt testcase/metrics.prom
+else
+    echo "diff failed, please refer to testcase/metrics_diff.txt for detail"
+    exit 1
+fi
+
+#   the trace is valid JSON with a span per command, escaped
+./multirun testcase/trace.cmd 2 --trace testcase/trace.json > /dev/null || true
+if python3 -c 'import json, sys
+events = json.load(open(sys.argv[1]))["traceEvents"]
+spans = [e["name"] for e in events if e["ph"] == "X"]
+sys.exit(sorted(spans) != sorted(["true", "false", "echo \"q\\\"uote\\\\slash\ttab\" > /dev/null"]))' testcase/trace.json
+then
+    echo trace passed
+    rm testcase/trace.json
+else
+    echo "trace failed, please refer to testcase/trace.json for detail"
+    exit 1
+fi
+
+#   duplicates are skipped, exactly and then by a Bloom filter
+./multirun testcase/dedup.cmd 1 --dedup -l testcase/dedup_log.txt > testcase/dedup_output.txt
+grep -o "dedup: [0-9]* duplicates skipped, [0-9]* distinct commands in [a-zA-Z ]* of" testcase/dedup_log.txt \
+    >> testcase/dedup_output.txt
+./multirun testcase/dedup_bloom.cmd 4 --dedup-memory 1024 -l testcase/dedup_log.txt | sort -n | uniq -c \
+    | awk '$1 == 1 { ++n } END { print n, "distinct" }' >> testcase/dedup_output.txt
+grep -o "dedup: [0-9]* duplicates skipped, [0-9]* distinct commands in [a-zA-Z ]* of" testcase/dedup_log.txt \
+    >> testcase/dedup_output.txt
+if diff testcase/dedup_output.txt testcase/dedup_ref.txt > testcase/dedup_diff.txt
+then
+    echo dedup passed
+    rm testcase/dedup_diff.txt testcase/dedup_output.txt testcase/dedup_log.txt
+else
+    echo "diff failed, please refer to testcase/dedup_diff.txt for detail"
+    exit 1
+fi
+
+#   higher priorities run first, equal ones in order, never across #sync,
+#   and a command waiting long enough overtakes a higher one unless --aging 0
+./multirun testcase/priority.cmd 1 > testcase/priority_output.txt
+for aging in 0.1 0
+do
+    (printf 'sleep 0.5\necho aged low\n'; sleep 0.3; printf '#@ priority=1\necho high\n#exit\n') \
+        | ./multirun /dev/stdin 1 --aging $aging >> testcase/priority_output.txt
+done
+if diff testcase/priority_output.txt testcase/priority_ref.txt > testcase/priority_diff.txt
+then
+    echo priority passed
+    rm testcase/priority_diff.txt testcase/priority_output.txt
+else
+    echo "diff failed, please refer to testcase/priority_diff.txt for detail"
+    exit 1
+fi
+
+#   annotations set the directory, environment and redirections of a
+#   command, and a command that cannot be spawned directly falls back to
+#   the shell
+echo lower case > testcase/annot_in.txt
+./multirun testcase/annot.cmd 1 -l testcase/annot_log.txt 2> /dev/null && status=0 || status=$?
+(cd testcase && grep ANNOT_ annot_out.txt && grep -v = annot_out.txt | sed "s|.*/||" \
+    && grep -c annot_no_such_file annot_err.txt && cat annot_both.txt annot_shell.txt) > testcase/annot_output.txt
+echo "exit $status, failed $(grep -o "exit=[0-9]*" testcase/annot_log.txt | xargs)" >> testcase/annot_output.txt
+if diff testcase/annot_output.txt testcase/annot_ref.txt > testcase/annot_diff.txt
+then
+    echo annot passed
+    rm testcase/annot_diff.txt testcase/annot_output.txt testcase/annot_log.txt testcase/annot_in.txt \
+        testcase/annot_out.txt testcase/annot_err.txt testcase/annot_both.txt testcase/annot_shell.txt
+else
+    echo "diff failed, please refer to testcase/annot_diff.txt for detail"
+    exit 1
+fi
+
+#   each job class runs on its own threads with its own nice value, and a
+#   #sync waits for the commands of all classes
+rm -f testcase/class_slots.txt
+BASE=$(nice) ./multirun testcase/class.cmd 1 --class io:2:5 | sort > testcase/class_output.txt
+awk '{ c = substr($1, 1, 1) } /\+/ { if (++n[c] > m[c]) m[c] = n[c] } /-/ { --n[c] }
+    END { print "threads " m["d"] " " m["i"] }' testcase/class_slots.txt >> testcase/class_output.txt
+if diff testcase/class_output.txt testcase/class_ref.txt > testcase/class_diff.txt
+then
+    echo class passed
+    rm testcase/class_diff.txt testcase/class_output.txt testcase/class_slots.txt
+else
+    echo "diff failed, please refer to testcase/class_diff.txt for detail"
+    exit 1
+fi
+
+#   a thread prefers commands with the locality key of its previous one
+./multirun testcase/locality.cmd 1 > testcase/locality_output.txt
+./multirun testcase/locality.cmd 1 --locality 4 >> testcase/locality_output.txt
+if diff testcase/locality_output.txt testcase/locality_ref.txt > testcase/locality_diff.txt
+then
+    echo locality passed
+    rm testcase/locality_diff.txt testcase/locality_output.txt
+else
+    echo "diff failed, please refer to testcase/locality_diff.txt for detail"
+    exit 1
+fi
+
+#   inputs share a thread by weight, and #sync and #exit apply to their
+#   own input only
+./multirun testcase/weight_a.cmd:2 1 -i testcase/weight_b.cmd > testcase/weight_output.txt
+./multirun testcase/weight_slow.cmd 2 -i testcase/weight_sync.cmd >> testcase/weight_output.txt
+if diff testcase/weight_output.txt testcase/weight_ref.txt > testcase/weight_diff.txt
+then
+    echo weight passed
+    rm testcase/weight_diff.txt testcase/weight_output.txt
+else
+    echo "diff failed, please refer to testcase/weight_diff.txt for detail"
+    exit 1
+fi
+
+#   a full queue stops reading its input until the workers catch up
+./multirun testcase/queue.cmd 1 -q 2 -l testcase/queue_log.txt
+./multirun testcase/queue.cmd 1 --queue-bytes 25 -l testcase/queue_bytes_log.txt
+mark=$(cat testcase/queue_log.txt testcase/queue_bytes_log.txt \
+    | grep -o "high-water mark [0-9]* commands [0-9]* bytes, producer blocked [0-9]*" \
+    | awk '$3 <= 2 && $5 <= 25 && $9 > 0' | wc -l)
+if [ $mark -eq 2 ] && [ $(cat testcase/queue_log.txt testcase/queue_bytes_log.txt | grep -c "execute done") -eq 12 ]
+then
+    echo queue passed
+    rm testcase/queue_log.txt testcase/queue_bytes_log.txt
+else
+    echo "queue failed, please refer to testcase/queue_log.txt and testcase/queue_bytes_log.txt for detail"
+    exit 1
+fi
+
+#   SIGINT stops the run with 128+2, and the running commands and their
+#   children are killed, those ignoring SIGTERM after the grace period
+./multirun testcase/signal.cmd 3 -g 1 > /dev/null &
+sleep 0.5
+running=$(ps -eo args | grep -c "^sleep 31\.[5-9]" || true)
+kill -INT $!
+{ wait $!; } 2> /dev/null && status=0 || status=$?
+left=$(ps -eo args | grep -c "^sleep 31\.[5-9]" || true)
+if [ $status -eq 130 ] && [ $running -eq 4 ] && [ $left -eq 0 ]
+then
+    echo signal passed
+else
+    echo "signal failed: exit $status, $running commands running before and $left after"
+    exit 1
+fi
+
+#   pipelines pass data along, fail with the last failed stage, and take a
+#   thread per stage
+rm -f testcase/pipeline_slots.txt
+./multirun testcase/pipeline.cmd 2 -l testcase/pipeline_log.txt > testcase/pipeline_output.txt && status=0 || status=$?
+echo "exit $status, failed $(grep -o "exit=[0-9]*" testcase/pipeline_log.txt | xargs)," \
+    "slots $(awk '$1 == "+" { if (++n > m) m = n } $1 == "-" { --n } END { print m }' testcase/pipeline_slots.txt)" \
+    >> testcase/pipeline_output.txt
+if diff testcase/pipeline_output.txt testcase/pipeline_ref.txt > testcase/pipeline_diff.txt
+then
+    echo pipeline passed
+    rm testcase/pipeline_diff.txt testcase/pipeline_output.txt testcase/pipeline_log.txt testcase/pipeline_slots.txt
+else
+    echo "diff failed, please refer to testcase/pipeline_diff.txt for detail"
+    exit 1
+fi
+
+#   templates over ranges, lists and files, nested, and over stdin read
+#   without holding back the other inputs
+printf '1\n\n  2  \n3' > testcase/foreach_values.txt
+./multirun testcase/foreach.cmd 1 > testcase/foreach_output.txt
+(echo a; sleep 1; echo b) | ./multirun testcase/foreach_stdin.cmd 2 -i testcase/foreach_other.cmd \
+    | grep -v "stdin a" >> testcase/foreach_output.txt
+printf '#foreach i in 1..5..0\necho {i}\n#exit\n' | ./multirun /dev/stdin 1 2>> testcase/foreach_output.txt || true
+if diff testcase/foreach_output.txt testcase/foreach_ref.txt > testcase/foreach_diff.txt
+then
+    echo foreach passed
+    rm testcase/foreach_diff.txt testcase/foreach_output.txt testcase/foreach_values.txt
+else
+    echo "diff failed, please refer to testcase/foreach_diff.txt for detail"
+    exit 1
+fi
+
+#   a file is split at newlines, each part is piped to a command, and the
+#   outputs are appended in order
+seq 1 30 | sed 's/^/line /' > testcase/pipepart_input.txt
+./multirun testcase/pipepart.cmd 4 | awk '{ n += $1 } END { print "lines", n }' > testcase/pipepart_output.txt
+cat testcase/pipepart_out.txt >> testcase/pipepart_output.txt
+echo "left $(ls testcase | grep -c '\.part')" >> testcase/pipepart_output.txt
+if diff testcase/pipepart_output.txt testcase/pipepart_ref.txt > testcase/pipepart_diff.txt
+then
+    echo pipepart passed
+    rm testcase/pipepart_diff.txt testcase/pipepart_output.txt testcase/pipepart_input.txt testcase/pipepart_out.txt
+else
+    echo "diff failed, please refer to testcase/pipepart_diff.txt for detail"
+    exit 1
+fi
+
+#   outputs of a group are reduced in order or merged, and the captured
+#   parts are removed
+seq 1 30 | sed 's/^/line /' > testcase/reduce_input.txt
+./multirun testcase/reduce.cmd 4 > /dev/null
+cat testcase/reduce_cat.txt testcase/reduce_merge.txt > testcase/reduce_output.txt
+echo "left $(ls testcase | grep -c '\.part\|\.merge')" >> testcase/reduce_output.txt
+if diff testcase/reduce_output.txt testcase/reduce_ref.txt > testcase/reduce_diff.txt
+then
+    echo reduce passed
+    rm testcase/reduce_diff.txt testcase/reduce_output.txt testcase/reduce_input.txt testcase/reduce_cat.txt \
+        testcase/reduce_merge.txt
+else
+    echo "diff failed, please refer to testcase/reduce_diff.txt for detail"
+    exit 1
+fi
+
+#   a straggler before #sync is copied and the copy wins, unless it writes a file
+rm -rf testcase/speculate_tmp testcase/speculate_out.txt
+start=$(date +%s%N)
+./multirun testcase/speculate.cmd 2 --speculate 3 -l testcase/speculate_log.txt > testcase/speculate_output.txt
+elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+if [ $elapsed -lt 5000 ] && [ "$(cat testcase/speculate_output.txt testcase/speculate_out.txt)" = "$(printf 'copied\nredirected')" ] \
+    && [ $(grep -c "speculate command" testcase/speculate_log.txt) -eq 1 ]
+then
+    echo speculate passed
+    rm -r testcase/speculate_tmp testcase/speculate_out.txt testcase/speculate_output.txt testcase/speculate_log.txt
+else
+    echo "speculate failed in $elapsed ms, please refer to testcase/speculate_log.txt for detail"
+    exit 1
+fi
+
+#   the status table, read by multictrl while a command runs, not taken by
+#   a second process while in use, and replaced when left by a killed one
+./multirun testcase/status.cmd 1 --status multirun_test_$$ -l testcase/status_log.txt > /dev/null &
+sleep 0.3
+./multictrl status multirun_test_$$ > testcase/status_output.txt
+./multirun testcase/status.cmd 1 --status multirun_test_$$ > /dev/null 2>> testcase/status_output.txt && taken=1 || taken=0
+wait
+(./multirun testcase/status.cmd 1 --status multirun_test_$$ > /dev/null & sleep 0.3; kill -KILL $!; wait $!) 2> /dev/null || true
+./multirun testcase/status.cmd 1 --status multirun_test_$$ > /dev/null && replaced=1 || replaced=0
+if grep -q "  running 1  " testcase/status_output.txt && grep -q "sleep 1; echo status$" testcase/status_output.txt \
+    && grep -q "status table multirun_test_$$: in use by another process" testcase/status_output.txt \
+    && [ $taken -eq 0 ] && [ $replaced -eq 1 ] && ! ./multictrl status multirun_test_$$ 2> /dev/null
+then
+    echo status passed
+    rm testcase/status_output.txt testcase/status_log.txt
+else
+    echo "status failed, please refer to testcase/status_output.txt for detail"
+    exit 1
+fi
+
+#   two processes sharing a queue run each command once
+: > testcase/share_output.txt
+./multirun testcase/share.cmd 2 --share multirun_share_$$ -l testcase/share_log.txt >> testcase/share_output.txt &
+./multirun - 2 --share multirun_share_$$ -l testcase/share_log.txt >> testcase/share_output.txt
+wait
+(seq 1 200; echo end) | sort > testcase/share_ref.txt
+if sort testcase/share_output.txt | diff - testcase/share_ref.txt > testcase/share_diff.txt
+then
+    echo share passed
+    rm testcase/share_diff.txt testcase/share_output.txt testcase/share_ref.txt testcase/share_log.txt
+else
+    echo "diff failed, please refer to testcase/share_diff.txt for detail"
+    exit 1
+fi
+
+#   the commands of a killed member are all run again, more than fit in a list
+(seq 1 300 | sed 's/.*/sleep 2; echo &/'; echo "#exit") > testcase/share_kill.cmd
+: > testcase/share_output.txt
+./multirun testcase/share_kill.cmd 300 --share multirun_kill_$$ >> testcase/share_output.txt &
+sleep 1
+kill -9 $!
+{ wait $!; } 2> /dev/null || true
+timeout 60 ./multirun - 150 --share multirun_kill_$$ -l testcase/share_log.txt >> testcase/share_output.txt
+seq 1 300 | sort > testcase/share_ref.txt
+if sort testcase/share_output.txt | diff - testcase/share_ref.txt > testcase/share_diff.txt
+then
+    echo share kill passed
+    rm testcase/share_kill.cmd testcase/share_diff.txt testcase/share_output.txt testcase/share_ref.txt testcase/share_log.txt
+else
+    echo "diff failed, please refer to testcase/share_diff.txt for detail"
+    exit 1
+fi
+
+#   a failed segment cancels the rest of its input, the exit status counts failures
+./multirun testcase/halt.cmd 1 --halt segment -l testcase/halt_log.txt > testcase/halt_output.txt 2> /dev/null && status=0 || status=$?
+if [ "$status $(cat testcase/halt_output.txt)" = "1 one" ] && grep -q "failed before #sync" testcase/halt_log.txt
+then
+    echo halt passed
+    rm testcase/halt_output.txt testcase/halt_log.txt
+else
+    echo "halt failed, please refer to testcase/halt_log.txt for detail"
+    exit 1
+fi
+
+#   4 starts of a group limited to 10/s take at least 0.3 seconds
+start=$(date +%s%N)
+./multirun testcase/rate.cmd 4 --rate api=10/s -l testcase/rate_log.txt > testcase/rate_output.txt
+elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+if [ $elapsed -ge 300 ] && [ "$(sort testcase/rate_output.txt | uniq -c | tr -s ' ')" = "$(printf ' 4 api\n 1 other')" ]
+then
+    echo rate passed
+    rm testcase/rate_output.txt testcase/rate_log.txt
+else
+    echo "rate failed in $elapsed ms, please refer to testcase/rate_log.txt for detail"
+    exit 1
+fi
+
+#   commands of a group waiting for its tokens do not hold back the others
+./multirun testcase/rate_other.cmd 1 --rate slow=10/s > testcase/rate_output.txt
+if [ "$(xargs < testcase/rate_output.txt)" = "slow other other other slow slow slow" ]
+then
+    echo rate other passed
+    rm testcase/rate_output.txt
+else
+    echo "rate other failed, please refer to testcase/rate_output.txt for detail"
+    exit 1
+fi
+
+#   a served jobserver is joined by a nested multirun, not the one of make test
+MAKEFLAGS= ./multirun testcase/jobserver.cmd 2 --jobserver pipe -l testcase/jobserver_log.txt > testcase/jobserver_output.txt
+if [ "$(sort testcase/jobserver_output.txt | tr '\n' ' ')" = "inner inner outer " ] \
+    && grep -q "serve 2 jobserver slots" testcase/jobserver_log.txt && grep -q "join the jobserver" testcase/jobserver_inner_log.txt
+then
+    echo jobserver passed
+    rm testcase/jobserver_output.txt testcase/jobserver_log.txt testcase/jobserver_inner_log.txt
+else
+    echo "jobserver failed, please refer to testcase/jobserver_log.txt for detail"
+    exit 1
+fi
+
+#   the StringView functions agree with the std::string ones
+if [ -x ./multirun_strtest ]
+then
+    ./multirun_strtest
+    if grep -qw avx2 /proc/cpuinfo 2> /dev/null
+    then
+        ./multirun_strtest_avx2
+    else
+        echo "stringtest AVX2 skipped, the CPU has no AVX2"
+    fi
+else
+    echo "stringtest skipped, run \"make test\" to build multirun_strtest"
+fi
+
+#   dispatching must not allocate once warmed up, nor wait for slots of a make -j
+if [ -x ./multirun_alloc ]
+then
+    ./multirun_alloc testcase/alloc.cmd 4 --jobserver off 2> testcase/alloc_output.txt
+    if grep -q "^main thread: 0 heap allocations" testcase/alloc_output.txt
+    then
+        echo alloc passed
+        rm testcase/alloc_output.txt
+    else
+        echo "alloc failed, please refer to testcase/alloc_output.txt for detail"
+        exit 1
+    fi
+else
+    echo "alloc skipped, run \"make test\" to build multirun_alloc"
+fi
+
 rm $MYFIFO
 
@@ -0,0 +1,157 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include "StringHelper.h"
+
+using namespace std;
+using namespace NSVirgo;
+using namespace NSVirgo::NSStringHelper;
+
+//  Cross-check of the StringView functions of StringHelper.h against the
+//  std::string ones on random inputs, run by "make test" as built for SSE2
+//  and for AVX2.
+
+size_type g_Checked = 0;
+
+void Check(bool ok, const char* name, const string& str)
+{
+    if (!ok)
+    {
+        cerr << name << " mismatch on \"";
+        for (size_type i=0; i<str.size(); ++i)
+        {
+            char ch = str[i];
+            cerr << (ch == '\t' ? "\\t" : ch == '\r' ? "\\r" : ch == '\n' ? "\\n" : string(1, ch));
+        }
+        cerr << "\"" << endl;
+        exit(1);
+    }
+    ++g_Checked;
+}
+
+//  Lengths around the 16 and 32 byte vectors, and a few more.
+size_type RandomLength()
+{
+    static const size_type lengths[] = {0, 1, 3, 4, 5, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65, 96, 100};
+    size_type n = lengths[rand() % (sizeof(lengths) / sizeof(lengths[0]))];
+    return rand() % 2 == 0 ? n : rand() % 130;
+}
+
+//  A string of blanks and a few letters, blank runs are long at times so
+//  that whole vectors are blank.
+string RandomString(size_type n)
+{
+    static const char blanks[] = " \t\r\n";
+    const int letter = rand() % 4 == 0 ? 2 : rand() % 4 == 0 ? 90 : 40;
+    string str;
+    for (size_type i=0; i<n; ++i)
+    {
+        str += rand() % 100 < letter ? "ab"[rand() % 2] : blanks[rand() % 4];
+    }
+    return str;
+}
+
+vector<string> ToStrings(const vector<StringView>& views)
+{
+    vector<string> strs;
+    for (size_type i=0; i<views.size(); ++i)
+    {
+        strs.push_back(views[i].str());
+    }
+    return strs;
+}
+
+//  Compare every function on str, placed at each offset of a buffer so that
+//  the vector loads are unaligned in every way.
+void CheckString(const string& str)
+{
+    static const char* seps[] = {"a", " ", "ab", "  ", "a a", "\n"};
+    for (size_type offset=0; offset<4; ++offset)
+    {
+        string buf = string(offset, 'x') + str + "x";
+        const char* begin = buf.data() + offset;
+        const char* end = begin + str.size();
+        for (const char* p=begin; p<=end; ++p)
+        {
+            const char* blank = p;
+            for (; blank<end && !detail::IsBlank(*blank); ++blank)
+            {
+            }
+            const char* other = p;
+            for (; other<end && detail::IsBlank(*other); ++other)
+            {
+            }
+            Check(detail::ScanBlank(p, end, true) == blank, "ScanBlank(true)", str);
+            Check(detail::ScanBlank(p, end, false) == other, "ScanBlank(false)", str);
+            const char* back = end;
+            for (; back>p && detail::IsBlank(back[-1]); --back)
+            {
+            }
+            Check(SkipBlankBack(p, end) == back, "SkipBlankBack", str);
+        }
+        StringView view(begin, str.size());
+
+        string trimmed = str;
+        Trim(trimmed, string(" \r\n\t"));
+        Check(TrimView(view).str() == trimmed, "TrimView", str);
+
+        vector<string> words;
+        SplitSpace<string>(str, back_inserter(words));
+        vector<StringView> views;
+        SplitSpaceView(view, back_inserter(views));
+        Check(ToStrings(views) == words, "SplitSpaceView", str);
+
+        for (int output_empty=0; output_empty<2; ++output_empty)
+        {
+            words.clear();
+            SplitChar<string>(str, back_inserter(words), str.empty() ? ' ' : str[0], output_empty);
+            views.clear();
+            SplitCharView(view, back_inserter(views), str.empty() ? ' ' : str[0], output_empty);
+            Check(ToStrings(views) == words, "SplitCharView", str);
+            for (size_type i=0; i<sizeof(seps)/sizeof(seps[0]); ++i)
+            {
+                words.clear();
+                SplitString<string>(str, back_inserter(words), seps[i], output_empty);
+                views.clear();
+                SplitStringView(view, back_inserter(views), seps[i], output_empty);
+                Check(ToStrings(views) == words, "SplitStringView", str);
+            }
+        }
+
+        for (size_type i=0; i<sizeof(seps)/sizeof(seps[0]); ++i)
+        {
+            size_type replaced = 0;
+            string expected = Replace(str, string(seps[i]), string("<>"), &replaced);
+            size_type appended = 0;
+            string out = "prefix";
+            ReplaceAppend(view, seps[i], "<>", out, &appended);
+            Check(out == "prefix" + expected && appended == replaced, "ReplaceAppend", str);
+        }
+    }
+}
+
+int main()
+{
+    srand(1);
+    CheckString("");
+    for (size_type n=1; n<=100; ++n)
+    {
+        CheckString(string(n, ' '));
+        CheckString(RandomString(n));
+    }
+    for (int i=0; i<20000; ++i)
+    {
+        CheckString(RandomString(RandomLength()));
+    }
+#if defined(__AVX2__)
+    const char* isa = "AVX2";
+#elif defined(__SSE2__)
+    const char* isa = "SSE2";
+#else
+    const char* isa = "scalar";
+#endif
+    cout << "stringtest " << isa << ": " << g_Checked << " checks passed" << endl;
+    return 0;
+}
@@ -0,0 +1,3 @@
+#foreach i in 1..5000
+true /path/to/input/file_{i}.txt
+#exit
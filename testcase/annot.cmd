@@ -0,0 +1,14 @@
+#@ cwd=testcase env=ANNOT_A=1 env=ANNOT_B=two stdout=annot_out.txt
+env
+#@ cwd=testcase stdin=annot_in.txt stdout+=annot_out.txt
+tr a-z A-Z
+#@ cwd=testcase stdout+=annot_out.txt
+pwd
+#@ cwd=testcase stderr=annot_err.txt
+ls annot_no_such_file
+#@ stdout=testcase/annot_both.txt stderr=&1
+sh -c 'echo out; echo err >&2'
+annot_no_such_command
+cd testcase
+echo $((6 * 7)) > testcase/annot_shell.txt
+#exit
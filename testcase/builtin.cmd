@@ -0,0 +1,29 @@
+#builtin
+mkdir -p testcase/builtin_tmp/a/b
+#sync
+touch testcase/builtin_tmp/a/f1 testcase/builtin_tmp/a/f2
+#sync
+cp testcase/builtin.cmd testcase/builtin_tmp/a/b
+mv testcase/builtin_tmp/a/f1 testcase/builtin_tmp/a/f3
+ln -s missing testcase/builtin_tmp/link
+#sync
+cp testcase/builtin_tmp/a/b/builtin.cmd testcase/builtin_tmp/a/b
+mv testcase/builtin_tmp/link testcase/builtin_tmp/link2
+rm testcase/builtin_tmp/a/f2
+rm -f testcase/builtin_tmp/missing
+rm testcase/builtin_tmp/missing
+mkdir testcase/builtin_tmp/a
+mkdir testcase/builtin_tmp/a/c/d -p
+mkdir testcase/builtin_tmp/r
+touch testcase/builtin_tmp/a/f4 -c
+touch -- testcase/builtin_tmp/-x
+touch testcase/builtin_tmp/f5
+#sync
+rm testcase/builtin_tmp/f5 -f
+rm -f -r testcase/builtin_tmp/r
+rm -f -- testcase/builtin_tmp/-y
+#sync
+#builtin off
+find testcase/builtin_tmp | sort > testcase/builtin_output.txt
+cmp testcase/builtin.cmd testcase/builtin_tmp/a/b/builtin.cmd
+#exit
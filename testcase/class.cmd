@@ -0,0 +1,13 @@
+sh -c 'echo d+ >> testcase/class_slots.txt; sleep 0.3; echo d- >> testcase/class_slots.txt'
+sh -c 'echo d+ >> testcase/class_slots.txt; sleep 0.3; echo d- >> testcase/class_slots.txt'
+sh -c 'echo d+ >> testcase/class_slots.txt; sleep 0.3; echo d- >> testcase/class_slots.txt'
+#class io
+sh -c 'echo i+ >> testcase/class_slots.txt; sleep 0.3; echo i- >> testcase/class_slots.txt'
+sh -c 'echo i+ >> testcase/class_slots.txt; sleep 0.3; echo i- >> testcase/class_slots.txt'
+sh -c 'echo i+ >> testcase/class_slots.txt; sleep 0.3; echo i- >> testcase/class_slots.txt'
+sh -c 'echo i+ >> testcase/class_slots.txt; sleep 0.3; echo i- >> testcase/class_slots.txt'
+#sync
+sh -c 'echo synced $(grep -c "[di]-" testcase/class_slots.txt), nice $(($(nice) - BASE))'
+#class
+sh -c 'echo default nice $(($(nice) - BASE))'
+#exit
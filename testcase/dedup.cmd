@@ -0,0 +1,6 @@
+echo a
+echo b
+echo a
+#foreach i in a b c
+echo {i}
+#exit
@@ -0,0 +1,5 @@
+#foreach i in 1..100
+echo {i}
+#foreach i in 1..100
+echo {i}
+#exit
@@ -0,0 +1,13 @@
+#foreach i in 1..3
+echo up {i}
+#foreach i in 3..1
+echo down {i}
+#foreach i in -4..4..4
+echo step {i}
+#foreach x in a b
+#foreach n in @/dev/null
+echo never {x}
+#foreach x in a b
+#foreach n in @testcase/foreach_values.txt
+echo {x}-{} {n}
+#exit
@@ -0,0 +1,2 @@
+echo other
+#exit
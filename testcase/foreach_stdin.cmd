@@ -0,0 +1,3 @@
+#foreach v in @-
+echo stdin {v}
+#exit
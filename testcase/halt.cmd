@@ -0,0 +1,5 @@
+echo one
+false
+#sync
+echo two
+#exit
@@ -0,0 +1,3 @@
+./multirun testcase/jobserver_inner.cmd 2 -l testcase/jobserver_inner_log.txt
+echo outer
+#exit
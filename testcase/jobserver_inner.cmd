@@ -0,0 +1,3 @@
+echo inner
+echo inner
+#exit
@@ -0,0 +1,7 @@
+sleep 0.2
+echo a 1
+echo b 1
+echo a 2
+echo b 2
+echo a 3
+#exit
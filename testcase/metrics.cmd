@@ -0,0 +1,5 @@
+true
+false
+#sync
+true
+#exit
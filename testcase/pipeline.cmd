@@ -0,0 +1,10 @@
+printf 'b\na\nc\n' #| sort #| tr a-z A-Z
+#sync
+false #| true
+true #| sh -c 'exit 3' #| sh -c 'exit 4' #| true
+#sync
+sh -c 'echo + >> testcase/pipeline_slots.txt; sleep 0.3; echo - >> testcase/pipeline_slots.txt'
+sh -c 'echo + >> testcase/pipeline_slots.txt; sleep 0.3; echo - >> testcase/pipeline_slots.txt' #| sh -c 'echo + >> testcase/pipeline_slots.txt; sleep 0.3; echo - >> testcase/pipeline_slots.txt'
+sh -c 'echo + >> testcase/pipeline_slots.txt; sleep 0.3; echo - >> testcase/pipeline_slots.txt'
+sh -c 'echo + >> testcase/pipeline_slots.txt; sleep 0.3; echo - >> testcase/pipeline_slots.txt'
+#exit
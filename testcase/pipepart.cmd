@@ -0,0 +1,5 @@
+#pipepart testcase/pipepart_input.txt 10 testcase/pipepart_out.txt
+tr a-z A-Z
+#pipepart testcase/pipepart_input.txt 25
+wc -l
+#exit
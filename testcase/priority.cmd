@@ -0,0 +1,16 @@
+sleep 0.2
+#@ priority=1
+echo p1 a
+echo p0 a
+#@ priority=5
+echo p5
+echo p0 b
+#@ priority=1
+echo p1 b
+#@ priority=-5
+echo low before sync
+#sync
+echo p0 after sync
+#@ priority=9
+echo p9 after sync
+#exit
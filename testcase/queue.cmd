@@ -0,0 +1,7 @@
+sleep 0.05
+sleep 0.05
+sleep 0.05
+sleep 0.05
+sleep 0.05
+sleep 0.05
+#exit
@@ -0,0 +1,10 @@
+#@ rate=api
+echo api
+#@ rate=api
+echo api
+#@ rate=api
+echo api
+#@ rate=api
+echo api
+echo other
+#exit
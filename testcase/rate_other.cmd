@@ -0,0 +1,12 @@
+#@ rate=slow
+echo slow
+#@ rate=slow
+echo slow
+#@ rate=slow
+echo slow
+#@ rate=slow
+echo slow
+echo other
+echo other
+echo other
+#exit
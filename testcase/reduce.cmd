@@ -0,0 +1,17 @@
+#reduce cat testcase/reduce_cat.txt
+sh -c 'sleep 0.3; echo 1'
+echo 2
+sh -c 'sleep 0.1; echo 3'
+#foreach i in 4..6
+echo {i}
+#pipepart testcase/reduce_input.txt 40
+sed s/line/part/
+echo 7
+#reduce end
+#reduce merge testcase/reduce_merge.txt 2n
+printf 'a 25\nc 30\n'
+printf 'b 0\nd 40\n'
+#foreach i in 1..20
+echo x {i}
+#reduce end
+#exit
@@ -0,0 +1,5 @@
+#foreach i in 1..200
+echo {i}
+#sync
+echo end
+#exit
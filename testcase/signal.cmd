@@ -0,0 +1,5 @@
+sh -c 'trap "" INT TERM; sleep 31.9'
+sh -c 'sleep 31.5 & sleep 31.6; wait'
+sleep 31.7
+sleep 31.8
+#exit
@@ -0,0 +1,6 @@
+#foreach i in 1..6
+step_a {i}
+#sync
+step_b
+step_c
+#exit
@@ -0,0 +1,7 @@
+#reduce cat testcase/simulate_kept.txt
+step_a 1
+step_a 2
+#reduce end
+#pipepart testcase/simulate_history.txt
+step_c {part}
+#exit
@@ -0,0 +1,11 @@
+sh -c 'sleep 0.1'
+sh -c 'sleep 0.1'
+sh -c 'sleep 0.1'
+#sync
+#@ idempotent
+sh -c 'if mkdir testcase/speculate_tmp 2> /dev/null; then sleep 10; fi; echo copied'
+#sync
+#@ idempotent stdout=testcase/speculate_out.txt
+sh -c 'if mkdir testcase/speculate_tmp/out 2> /dev/null; then sleep 1; fi; echo redirected'
+#sync
+#exit
@@ -0,0 +1,2 @@
+sleep 1; echo status
+#exit
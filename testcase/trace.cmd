@@ -0,0 +1,5 @@
+true
+false
+#sync
+echo "q\"uote\\slash	tab" > /dev/null
+#exit
@@ -0,0 +1,8 @@
+sleep 0.2
+echo a1
+echo a2
+echo a3
+echo a4
+echo a5
+echo a6
+#exit
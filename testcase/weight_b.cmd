@@ -0,0 +1,4 @@
+echo b1
+echo b2
+echo b3
+#exit
@@ -0,0 +1,2 @@
+sh -c 'sleep 0.6; echo a-slow'
+#exit
@@ -0,0 +1,4 @@
+echo b1
+#sync
+echo b2
+#exit